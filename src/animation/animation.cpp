@@ -1,26 +1,36 @@
 #include "animation/animation.hpp"
 #include "entt/entt.hpp"
-#include "game.hpp"
+#include "scenegraph/transform.hpp"
 #include "util/debug.hpp"
+#include <algorithm>
 #include <cmath>
 #include <glm/ext/quaternion_common.hpp>
-#include <glm/fwd.hpp>
-#include <unordered_map>
-#include <variant>
 #include <vector>
 
 using namespace platformer;
 
 animation_system::animation_system() {}
 
-template <typename T>
-int binary_search(const std::vector<std::pair<float, T>> &pFrames,
-                  float pValue) {
+int animation_action::target(entt::entity pEntity) {
+  int numTargets = this->targets.size();
+  for (int i = 0; i < numTargets; i += 1) {
+    if (this->targets[i] == pEntity) {
+      return i;
+    }
+  }
+  this->targets.push_back(pEntity);
+  return this->targets.size() - 1;
+}
+
+namespace {
+// Returns the index of the last key at or before pTime, stopping one before
+// the last key so that there is always a next one
+int binary_search(const std::vector<float> &pTimes, float pTime) {
   int min = 0;
-  int max = pFrames.size() - 2;
+  int max = pTimes.size() - 2;
   while (min < max) {
     int mid = min + (max - min + 1) / 2;
-    if (pFrames[mid].first > pValue) {
+    if (pTimes[mid] > pTime) {
       max = mid - 1;
     } else {
       min = mid;
@@ -29,73 +39,126 @@ int binary_search(const std::vector<std::pair<float, T>> &pFrames,
   return min;
 }
 
-template <typename T>
-T interpolate_step(const std::vector<std::pair<float, T>> &pFrames,
-                   float pTime) {
-  if (pFrames.size() <= 1) {
-    return pFrames[0].second;
+// Most updates stay on the same key or move to the next one, so the cursor
+// walks forward a few keys before giving up and searching
+constexpr int CURSOR_STEPS = 4;
+
+// Same as binary_search(), starting from the key found by the last sample.
+// Times before the cursor mean a seek or a loop, and are searched again.
+int find_key(const std::vector<float> &pTimes, float pTime, int &pCursor) {
+  int last = pTimes.size() - 2;
+  // Nothing comes before the first key, e.g. while a track starting late
+  // waits for it
+  if (pCursor == 0 && pTimes[0] > pTime) {
+    return 0;
   }
-  int pos = binary_search(pFrames, pTime);
-  auto tmin = pFrames[pos];
-  auto tmax = pFrames[pos + 1];
-  float t = std::min(
-      1.0f, std::max(0.0f, (pTime - tmin.first) / (tmax.first - tmin.first)));
-  if (t >= 1) {
-    return tmax.second;
-  } else {
-    return tmin.second;
+  if (pCursor > last || pTimes[pCursor] > pTime) {
+    pCursor = binary_search(pTimes, pTime);
+    return pCursor;
   }
+  for (int i = 0; i < CURSOR_STEPS; i += 1) {
+    if (pCursor == last || pTimes[pCursor + 1] > pTime) {
+      return pCursor;
+    }
+    pCursor += 1;
+  }
+  pCursor = binary_search(pTimes, pTime);
+  return pCursor;
+}
+
+glm::vec3 interpolate(const glm::vec3 &pFrom, const glm::vec3 &pTo, float pT) {
+  return pFrom + (pTo - pFrom) * pT;
+}
+
+glm::quat interpolate(const glm::quat &pFrom, const glm::quat &pTo, float pT) {
+  return glm::slerp(pFrom, pTo, pT);
 }
 
 template <typename T>
-T interpolate_linear(const std::vector<std::pair<float, T>> &pFrames,
-                     float pTime) {
-  if (pFrames.size() <= 1) {
-    return pFrames[0].second;
+T sample(const animation_track<T> &pTrack, float pTime, int &pCursor) {
+  if (pTrack.times.size() <= 1) {
+    return pTrack.values[0];
   }
-  int pos = binary_search(pFrames, pTime);
-  auto tmin = pFrames[pos];
-  auto tmax = pFrames[pos + 1];
-  float t = std::min(
-      1.0f, std::max(0.0f, (pTime - tmin.first) / (tmax.first - tmin.first)));
-  return tmin.second + (tmax.second - tmin.second) * t;
+  int pos = find_key(pTrack.times, pTime, pCursor);
+  float tmin = pTrack.times[pos];
+  float tmax = pTrack.times[pos + 1];
+  float t = std::min(1.0f, std::max(0.0f, (pTime - tmin) / (tmax - tmin)));
+  if (pTrack.interpolation == animation_channel_interpolation::STEP) {
+    return t >= 1.0f ? pTrack.values[pos + 1] : pTrack.values[pos];
+  }
+  return interpolate(pTrack.values[pos], pTrack.values[pos + 1], t);
 }
 
-glm::quat
-interpolate_slerp(const std::vector<std::pair<float, glm::quat>> &pFrames,
-                  float pTime) {
-  if (pFrames.size() <= 1) {
-    return pFrames[0].second;
+// pSlots maps the targets of the action to those of the component, and
+// pPoseSlots the targets of the component to pPoses
+template <typename T>
+void sample_tracks(const std::vector<animation_track<T>> &pTracks,
+                   const int *pSlots, const int *pPoseSlots, float pTime,
+                   float pWeight, int *pCursors,
+                   std::vector<animation_pose> &pPoses,
+                   T animation_pose::*pValue,
+                   float animation_pose::*pValueWeight) {
+  int numTracks = pTracks.size();
+  for (int i = 0; i < numTracks; i += 1) {
+    auto &track = pTracks[i];
+    auto &pose = pPoses[pPoseSlots[pSlots[track.target]]];
+    pose.*pValue += sample(track, pTime, pCursors[i]) * pWeight;
+    pose.*pValueWeight += pWeight;
   }
-  int pos = binary_search(pFrames, pTime);
-  auto tmin = pFrames[pos];
-  auto tmax = pFrames[pos + 1];
-  float t = std::min(
-      1.0f, std::max(0.0f, (pTime - tmin.first) / (tmax.first - tmin.first)));
-  return glm::slerp(tmin.second, tmax.second, t);
 }
+} // namespace
 
-template <typename T>
-void push_entity_animation_result(
-    std::unordered_map<entt::entity, std::pair<float, T>> &pMap,
-    entt::entity pEntity, float weight, const T &value) {
-  auto cursor = pMap.find(pEntity);
-  if (cursor == pMap.end()) {
-    pMap.insert_or_assign(pEntity, std::pair<float, T>{weight, value * weight});
-  } else {
-    cursor->second.first += weight;
-    cursor->second.second += value * weight;
+void animation_system::build_slots(animation_component &pAnim) {
+  if (pAnim.mActionTargets.size() == pAnim.actions.size() &&
+      std::equal(pAnim.mActionTargets.begin(), pAnim.mActionTargets.end(),
+                 pAnim.actions.begin(),
+                 [](const std::vector<entt::entity> &pTargets,
+                    const animation_action &pAction) {
+                   return pTargets == pAction.targets;
+                 })) {
+    return;
+  }
+  int numActions = pAnim.actions.size();
+  pAnim.mTargets.clear();
+  pAnim.mActionTargets.resize(numActions);
+  pAnim.mSlots.resize(numActions);
+  for (int i = 0; i < numActions; i += 1) {
+    auto &targets = pAnim.actions[i].targets;
+    auto &slots = pAnim.mSlots[i];
+    pAnim.mActionTargets[i] = targets;
+    slots.clear();
+    for (auto target : targets) {
+      auto found =
+          std::find(pAnim.mTargets.begin(), pAnim.mTargets.end(), target);
+      slots.push_back(found - pAnim.mTargets.begin());
+      if (found == pAnim.mTargets.end()) {
+        pAnim.mTargets.push_back(target);
+      }
+    }
   }
 }
 
-void animation_system::update(game &pGame, float pDelta) {
-  auto &registry = pGame.registry();
-  auto view = registry.view<animation_component>();
-  std::unordered_map<entt::entity, std::pair<float, glm::vec3>> translations;
-  std::unordered_map<entt::entity, std::pair<float, glm::quat>> rotations;
-  std::unordered_map<entt::entity, std::pair<float, glm::vec3>> scales;
+void animation_system::update(entt::registry &pRegistry, float pDelta) {
+  auto view = pRegistry.view<animation_component>();
   for (auto entity : view) {
-    auto &anim = registry.get<animation_component>(entity);
+    auto &anim = pRegistry.get<animation_component>(entity);
+    this->build_slots(anim);
+    // Targets shared with components sampled before share their poses
+    this->mSlots.clear();
+    for (auto target : anim.mTargets) {
+      std::size_t index = entt::to_entity(target);
+      if (index >= this->mPoseOf.size()) {
+        this->mPoseOf.resize(index + 1, -1);
+      }
+      if (this->mPoseOf[index] < 0) {
+        this->mPoseOf[index] = this->mTargets.size();
+        this->mTargets.push_back(target);
+        this->mPoses.push_back(animation_pose{
+            glm::vec3(0.0f), 0.0f, glm::quat(0.0f, 0.0f, 0.0f, 0.0f), 0.0f,
+            glm::vec3(0.0f), 0.0f});
+      }
+      this->mSlots.push_back(this->mPoseOf[index]);
+    }
     int numActions = anim.actions.size();
     for (int i = 0; i < numActions; i += 1) {
       auto &action = anim.actions[i];
@@ -104,54 +167,55 @@ void animation_system::update(game &pGame, float pDelta) {
         playback.current = fmodf((playback.current + pDelta), action.duration);
       }
       if (playback.weight > 0.0f) {
-        for (auto &channel : action.channels) {
-          if (std::holds_alternative<animation_channel_translation>(channel)) {
-            auto &chan = std::get<animation_channel_translation>(channel);
-            auto value = interpolate_linear(chan.frames, playback.current);
-            push_entity_animation_result(translations, chan.entity,
-                                         playback.weight, value);
-          } else if (std::holds_alternative<animation_channel_rotation>(
-                         channel)) {
-            auto &chan = std::get<animation_channel_rotation>(channel);
-            auto value = interpolate_slerp(chan.frames, playback.current);
-            push_entity_animation_result(rotations, chan.entity,
-                                         playback.weight, value);
-          } else if (std::holds_alternative<animation_channel_scale>(channel)) {
-            auto &chan = std::get<animation_channel_scale>(channel);
-            auto value = interpolate_linear(chan.frames, playback.current);
-            push_entity_animation_result(scales, chan.entity, playback.weight,
-                                         value);
-          }
+        std::size_t numTracks = action.translations.size() +
+                                action.rotations.size() +
+                                action.scales.size();
+        if (playback.cursors.size() != numTracks) {
+          playback.cursors.assign(numTracks, 0);
         }
+        int *cursors = playback.cursors.data();
+        const int *slots = anim.mSlots[i].data();
+        const int *poseSlots = this->mSlots.data();
+        sample_tracks(action.translations, slots, poseSlots,
+                      playback.current, playback.weight, cursors,
+                      this->mPoses, &animation_pose::translation,
+                      &animation_pose::translationWeight);
+        cursors += action.translations.size();
+        sample_tracks(action.rotations, slots, poseSlots, playback.current,
+                      playback.weight, cursors, this->mPoses,
+                      &animation_pose::rotation,
+                      &animation_pose::rotationWeight);
+        cursors += action.rotations.size();
+        sample_tracks(action.scales, slots, poseSlots, playback.current,
+                      playback.weight, cursors, this->mPoses,
+                      &animation_pose::scale, &animation_pose::scaleWeight);
       }
     }
   }
-  // Apply transform to each entity
-  for (auto &pair : translations) {
-    auto entity = pair.first;
-    auto [weight, value] = pair.second;
-    value /= weight;
-    auto transVal = registry.try_get<transform>(entity);
-    if (transVal != nullptr) {
-      transVal->position(value);
+  // Apply the blended values to each target
+  int numTargets = this->mTargets.size();
+  for (int i = 0; i < numTargets; i += 1) {
+    auto &pose = this->mPoses[i];
+    entt::entity target = this->mTargets[i];
+    this->mPoseOf[entt::to_entity(target)] = -1;
+    if (pose.translationWeight <= 0.0f && pose.rotationWeight <= 0.0f &&
+        pose.scaleWeight <= 0.0f) {
+      continue;
     }
-  }
-  for (auto &pair : rotations) {
-    auto entity = pair.first;
-    auto [weight, value] = pair.second;
-    value /= weight;
-    auto transVal = registry.try_get<transform>(entity);
-    if (transVal != nullptr) {
-      transVal->rotation(glm::normalize(value));
+    auto transVal = pRegistry.try_get<transform>(target);
+    if (transVal == nullptr) {
+      continue;
     }
-  }
-  for (auto &pair : scales) {
-    auto entity = pair.first;
-    auto [weight, value] = pair.second;
-    value /= weight;
-    auto transVal = registry.try_get<transform>(entity);
-    if (transVal != nullptr) {
-      transVal->scale(value);
+    if (pose.translationWeight > 0.0f) {
+      transVal->position(pose.translation / pose.translationWeight);
+    }
+    if (pose.rotationWeight > 0.0f) {
+      transVal->rotation(glm::normalize(pose.rotation));
+    }
+    if (pose.scaleWeight > 0.0f) {
+      transVal->scale(pose.scale / pose.scaleWeight);
     }
   }
+  this->mTargets.clear();
+  this->mPoses.clear();
 }
@@ -3,10 +3,9 @@
 
 #include "entt/entity/entity.hpp"
 #include "entt/entity/fwd.hpp"
-#include <glm/fwd.hpp>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
 #include <string>
-#include <utility>
-#include <variant>
 #include <vector>
 
 namespace platformer {
@@ -16,42 +15,36 @@ enum class animation_channel_interpolation {
   LINEAR,
 };
 
-enum class animation_channel_behavior {
-  DEFAULT,
-  CONSTANT,
-  LINEAR,
-  REPEAT,
-};
-
-struct animation_channel_base {
-  entt::entity entity = entt::null;
-  animation_channel_interpolation intepolation =
+/**
+ * @brief Keyframes of one property of one target, with times and values kept
+ * in separate arrays so that searching the times stays cache friendly.
+ */
+template <typename T> struct animation_track {
+  // Index of the animated entity in animation_action::targets
+  int target = 0;
+  animation_channel_interpolation interpolation =
       animation_channel_interpolation::LINEAR;
-  animation_channel_behavior pre_behavior = animation_channel_behavior::DEFAULT;
-  animation_channel_behavior post_behavior =
-      animation_channel_behavior::DEFAULT;
-};
-
-struct animation_channel_translation : public animation_channel_base {
-  std::vector<std::pair<float, glm::vec3>> frames;
-};
-
-struct animation_channel_rotation : public animation_channel_base {
-  std::vector<std::pair<float, glm::quat>> frames;
-};
-
-struct animation_channel_scale : public animation_channel_base {
-  std::vector<std::pair<float, glm::vec3>> frames;
+  // Sorted, in seconds
+  std::vector<float> times;
+  std::vector<T> values;
 };
 
-typedef std::variant<animation_channel_translation, animation_channel_rotation,
-                     animation_channel_scale>
-    animation_channel;
-
+/**
+ * @brief A compiled clip: tracks are grouped by the property they animate, so
+ * each group is sampled by its own loop without looking at the type of every
+ * channel.
+ */
 struct animation_action {
   std::string name;
-  std::vector<animation_channel> channels;
   float duration;
+  // Entities animated by the tracks, each listed once
+  std::vector<entt::entity> targets;
+  std::vector<animation_track<glm::vec3>> translations;
+  std::vector<animation_track<glm::quat>> rotations;
+  std::vector<animation_track<glm::vec3>> scales;
+
+  // Returns the index of the entity in targets, adding it if needed
+  int target(entt::entity pEntity);
 };
 
 struct animation_playback {
@@ -59,20 +52,62 @@ struct animation_playback {
   bool playing = true;
   bool loop = true;
   float weight = 1.0;
+  // Last key sampled in each track of the action (translations, then
+  // rotations, then scales), so that moving forward only checks the next keys
+  std::vector<int> cursors;
+};
+
+// Weighted sums of the values sampled for one target, before normalizing
+struct animation_pose {
+  glm::vec3 translation;
+  float translationWeight;
+  glm::quat rotation;
+  float rotationWeight;
+  glm::vec3 scale;
+  float scaleWeight;
 };
 
 class animation_component {
 public:
   std::vector<animation_action> actions;
   std::vector<animation_playback> playbacks;
-};
 
-class game;
+private:
+  // Filled by the animation_system and reused every update, rebuilt when the
+  // targets of the actions change
+  // Targets of each action when the slots were built
+  std::vector<std::vector<entt::entity>> mActionTargets;
+  // Entities animated by any of the actions, each listed once
+  std::vector<entt::entity> mTargets;
+  // Index in mTargets of each target of each action
+  std::vector<std::vector<int>> mSlots;
+
+  friend class animation_system;
+};
 
 class animation_system {
 public:
   animation_system();
-  void update(game &pGame, float pDelta);
+  /**
+   * @brief Advances every playback and poses its targets. Components
+   * animating the same entity are blended together by weight.
+   */
+  void update(entt::registry &pRegistry, float pDelta);
+
+private:
+  // Maps the targets of every action to mTargets of the component, if they
+  // changed since the last update
+  void build_slots(animation_component &pAnim);
+
+  // Reused every update
+  // Entities animated by any component, each listed once
+  std::vector<entt::entity> mTargets;
+  // Blended values of each entity in mTargets
+  std::vector<animation_pose> mPoses;
+  // Index in mPoses by entity index, -1 for entities not animated
+  std::vector<int> mPoseOf;
+  // Index in mPoses of each target of the component being sampled
+  std::vector<int> mSlots;
 };
 
 } // namespace platformer
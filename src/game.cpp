@@ -26,6 +26,7 @@
 #include <glm/ext/quaternion_transform.hpp>
 #include <glm/fwd.hpp>
 #include <glm/gtx/quaternion.hpp>
+#include <chrono>
 #include <glm/gtx/string_cast.hpp>
 #include <memory>
 
@@ -39,6 +40,9 @@ void game::init(application &pApplication) {
   this->mName.init(this->mRegistry);
   auto &transformSys = this->mRegistry.ctx().emplace<transform_system>();
   transformSys.init(this->mRegistry);
+  transformSys.pool(&this->mThreadPool);
+  this->mPhysics.init(this->mRegistry);
+  this->mPhysics.pool(&this->mThreadPool);
   this->mMovement.init(*this);
 
   /*
@@ -57,8 +61,13 @@ void game::update(application &pApplication, float pDelta) {
   }
 
   this->mMovement.update(*this, pDelta);
-  this->mPhysics.update(*this, pDelta);
-  this->mAnimation.update(*this, pDelta);
+  this->mPhysics.update(this->mRegistry, pDelta);
+  this->mAnimation.update(this->mRegistry, pDelta);
+  auto &transformSys = this->mRegistry.ctx().get<transform_system>();
+  transformSys.propagate(this->mRegistry);
+  transformSys.record_history(this->mRegistry);
+  transformSys.interpolate_snapshots(this->mRegistry, this->mPhysics.alpha());
+  this->mMovement.sync_camera(*this);
   this->mDebugUi.update(*this, pDelta);
   this->mRenderer.render();
 }
@@ -113,6 +122,7 @@ void game::make_player() {
       auto &transformBodyVal = this->mRegistry.emplace<transform>(playerBody);
       transformBodyVal.scale(glm::vec3(0.3f, 1.0f, 0.3f));
       transformBodyVal.parent(player);
+      this->mRegistry.patch<transform>(playerBody);
       std::vector<mesh::mesh_pair> meshes{};
       meshes.push_back({std::make_shared<standard_material>(
                             glm::vec3(1.0f, 0.1f, 0.1f), 0.5f, 0.0f),
@@ -138,6 +148,7 @@ void game::make_player() {
       transformVal.scale(glm::vec3(0.3f, 0.3f, 0.3f));
       transformVal.position(glm::vec3(0.0, 1.0, 0.0));
       transformVal.parent(player);
+      this->mRegistry.patch<transform>(playerHead);
       std::vector<mesh::mesh_pair> meshes{};
       meshes.push_back({std::make_shared<standard_material>(
                             glm::vec3(0.1f, 1.0f, 0.1f), 0.5f, 0.0f),
@@ -154,19 +165,34 @@ void game::make_player() {
 }
 
 void game::change_scene(std::shared_ptr<scene> &pScene) {
+  auto startTime = std::chrono::steady_clock::now();
   if (this->mScene != nullptr) {
     this->mScene->dispose();
   }
+  // Everything is destroyed at once, so the per-entity index maintenance can
+  // be skipped and the indexes dropped afterwards.
+  auto &transformSys = this->mRegistry.ctx().get<transform_system>();
+  transformSys.begin_teardown(this->mRegistry);
+  this->mName.begin_teardown(this->mRegistry);
+  this->mPhysics.begin_teardown(this->mRegistry);
   this->mRegistry.clear();
+  transformSys.end_teardown(this->mRegistry);
+  this->mName.end_teardown(this->mRegistry);
+  this->mPhysics.end_teardown(this->mRegistry);
   this->make_player();
   this->mScene = pScene;
   if (this->mScene != nullptr) {
     this->mScene->init(*(this->mApplication), *this);
   }
+  std::chrono::duration<float, std::milli> elapsed =
+      std::chrono::steady_clock::now() - startTime;
+  this->mSceneChangeTime = elapsed.count();
 }
 
 const std::shared_ptr<scene> &game::current_scene() const {
   return this->mScene;
 }
 
+float game::scene_change_time() const { return this->mSceneChangeTime; }
+
 application &game::app() { return *(this->mApplication); }
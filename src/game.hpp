@@ -11,6 +11,7 @@
 #include "scene/scene.hpp"
 #include "scenegraph/name.hpp"
 #include "ui/debug_ui.hpp"
+#include "util/thread_pool.hpp"
 #include <entt/entt.hpp>
 #include <memory>
 
@@ -28,6 +29,8 @@ public:
   platformer::renderer &renderer();
   void change_scene(std::shared_ptr<scene> &pScene);
   const std::shared_ptr<scene> &current_scene() const;
+  // Time spent in the last change_scene(), in milliseconds
+  float scene_change_time() const;
   application &app();
 
 private:
@@ -40,8 +43,10 @@ private:
   animation_system mAnimation;
   debug_ui_system mDebugUi;
   platformer::renderer mRenderer;
+  thread_pool mThreadPool;
   application *mApplication;
   std::shared_ptr<scene> mScene;
+  float mSceneChangeTime = 0.0f;
 
   void make_player();
 };
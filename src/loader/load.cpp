@@ -436,42 +436,42 @@ animation_action entity_loader::read_animation(int pIndex) {
   action.duration = anim->mDuration / tps;
   for (int chanId = 0; chanId < anim->mNumChannels; chanId += 1) {
     auto nodeAnim = anim->mChannels[chanId];
-    auto entity = this->mEntityByNames.at(nodeAnim->mNodeName.C_Str());
+    int target =
+        action.target(this->mEntityByNames.at(nodeAnim->mNodeName.C_Str()));
+    // assimp does not specify the interpolation (gltf does), so tracks keep
+    // the default linear one
     if (nodeAnim->mNumPositionKeys > 0) {
-      animation_channel_translation channel;
-      channel.entity = entity;
-      // assimp does not specify this (gltf does)
-      channel.intepolation = animation_channel_interpolation::LINEAR;
+      auto &track = action.translations.emplace_back();
+      track.target = target;
+      track.times.reserve(nodeAnim->mNumPositionKeys);
+      track.values.reserve(nodeAnim->mNumPositionKeys);
       for (int i = 0; i < nodeAnim->mNumPositionKeys; i += 1) {
         auto key = nodeAnim->mPositionKeys[i];
-        channel.frames.emplace_back(key.mTime / tps,
-                                    convert_ai_to_glm(key.mValue));
+        track.times.push_back(key.mTime / tps);
+        track.values.push_back(convert_ai_to_glm(key.mValue));
       }
-      action.channels.emplace_back(std::move(channel));
     }
     if (nodeAnim->mNumRotationKeys > 0) {
-      animation_channel_rotation channel;
-      channel.entity = entity;
-      // assimp does not specify this (gltf does)
-      channel.intepolation = animation_channel_interpolation::LINEAR;
+      auto &track = action.rotations.emplace_back();
+      track.target = target;
+      track.times.reserve(nodeAnim->mNumRotationKeys);
+      track.values.reserve(nodeAnim->mNumRotationKeys);
       for (int i = 0; i < nodeAnim->mNumRotationKeys; i += 1) {
         auto key = nodeAnim->mRotationKeys[i];
-        channel.frames.emplace_back(key.mTime / tps,
-                                    convert_ai_to_glm(key.mValue));
+        track.times.push_back(key.mTime / tps);
+        track.values.push_back(convert_ai_to_glm(key.mValue));
       }
-      action.channels.emplace_back(std::move(channel));
     }
     if (nodeAnim->mNumScalingKeys > 0) {
-      animation_channel_scale channel;
-      channel.entity = entity;
-      // assimp does not specify this (gltf does)
-      channel.intepolation = animation_channel_interpolation::LINEAR;
+      auto &track = action.scales.emplace_back();
+      track.target = target;
+      track.times.reserve(nodeAnim->mNumScalingKeys);
+      track.values.reserve(nodeAnim->mNumScalingKeys);
       for (int i = 0; i < nodeAnim->mNumScalingKeys; i += 1) {
         auto key = nodeAnim->mScalingKeys[i];
-        channel.frames.emplace_back(key.mTime / tps,
-                                    convert_ai_to_glm(key.mValue));
+        track.times.push_back(key.mTime / tps);
+        track.values.push_back(convert_ai_to_glm(key.mValue));
       }
-      action.channels.emplace_back(std::move(channel));
     }
     // TODO: The engine does not support shape keys yet
   }
@@ -41,6 +41,9 @@ void shader_material::render(subpipeline &pSubpipeline, geometry &pGeometry,
   this->mShader.set("uProjection", camHandle.projection());
   this->mShader.set("uInverseView", camHandle.inverse_view());
   this->mShader.set("uInverseProjection", camHandle.inverse_projection());
+  // Entities with a transform_snapshot, and their children, are drawn in
+  // between simulation ticks
+  auto &transformSys = registry.ctx().get<transform_system>();
   int textureAcc = 0;
   for (auto &[key, value] : this->mUniforms) {
     auto &valueType = value.type();
@@ -73,8 +76,8 @@ void shader_material::render(subpipeline &pSubpipeline, geometry &pGeometry,
   renderer.apply_render_state({.depthFunc = GL_LEQUAL});
   for (auto entity : pEntities) {
     // Set up uniforms
-    auto &transformVal = registry.get<transform>(entity);
-    this->mShader.set("uModel", transformVal.matrix_world(registry));
+    this->mShader.set("uModel",
+                      transformSys.matrix_world_interpolated(registry, entity));
     pGeometry.render();
   }
 }
@@ -101,6 +104,7 @@ void standard_material::render(subpipeline &pSubpipeline, geometry &pGeometry,
                                std::vector<entt::entity> &pEntities) {
   auto &renderer = pSubpipeline.renderer();
   auto &registry = renderer.registry();
+  auto &transformSys = registry.ctx().get<transform_system>();
   bool useInstancing = true;
   bool useArmature = false;
   // FIXME: It should be possible to render armatures without armature component
@@ -205,8 +209,8 @@ void standard_material::render(subpipeline &pSubpipeline, geometry &pGeometry,
     std::vector<glm::mat4> models;
     models.reserve(pEntities.size());
     for (auto entity : pEntities) {
-      auto &transformVal = registry.get<transform>(entity);
-      models.push_back(transformVal.matrix_world(registry));
+      models.push_back(
+          transformSys.matrix_world_interpolated(registry, entity));
     }
     buffer.set(models);
     buffer.bind();
@@ -222,8 +226,8 @@ void standard_material::render(subpipeline &pSubpipeline, geometry &pGeometry,
     buffer.dispose();
   } else {
     for (auto entity : pEntities) {
-      auto &transformVal = registry.get<transform>(entity);
-      shaderVal->set("uModel", transformVal.matrix_world(registry));
+      shaderVal->set("uModel",
+                     transformSys.matrix_world_interpolated(registry, entity));
       if (useArmature) {
         auto armatureVal = registry.try_get<armature_component>(entity);
         if (armatureVal == nullptr) {
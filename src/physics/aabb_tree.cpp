@@ -0,0 +1,298 @@
+#include "physics/aabb_tree.hpp"
+#include <algorithm>
+
+using namespace platformer;
+
+namespace {
+float surface_area(const glm::vec3 &pMin, const glm::vec3 &pMax) {
+  glm::vec3 size = pMax - pMin;
+  return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+} // namespace
+
+aabb_tree::aabb_tree(float pMargin) : mMargin(pMargin) {}
+
+int aabb_tree::insert(entt::entity pEntity, const glm::vec3 &pMin,
+                      const glm::vec3 &pMax, std::uint32_t pLayers) {
+  int leaf = this->allocate_node();
+  auto &nodeVal = this->mNodes[leaf];
+  nodeVal.min = pMin - glm::vec3(this->mMargin);
+  nodeVal.max = pMax + glm::vec3(this->mMargin);
+  nodeVal.entity = pEntity;
+  nodeVal.layers = pLayers;
+  nodeVal.height = 0;
+  this->insert_leaf(leaf);
+  this->mSize += 1;
+  return leaf;
+}
+
+void aabb_tree::remove(int pProxy) {
+  this->remove_leaf(pProxy);
+  this->free_node(pProxy);
+  this->mSize -= 1;
+}
+
+bool aabb_tree::move(int pProxy, const glm::vec3 &pMin,
+                     const glm::vec3 &pMax) {
+  auto &nodeVal = this->mNodes[pProxy];
+  if (glm::all(glm::lessThanEqual(nodeVal.min, pMin)) &&
+      glm::all(glm::greaterThanEqual(nodeVal.max, pMax))) {
+    return false;
+  }
+  this->remove_leaf(pProxy);
+  nodeVal.min = pMin - glm::vec3(this->mMargin);
+  nodeVal.max = pMax + glm::vec3(this->mMargin);
+  this->insert_leaf(pProxy);
+  return true;
+}
+
+void aabb_tree::layers(int pProxy, std::uint32_t pLayers) {
+  if (this->mNodes[pProxy].layers == pLayers) {
+    return;
+  }
+  this->mNodes[pProxy].layers = pLayers;
+  for (int index = this->mNodes[pProxy].parent; index != null_node;
+       index = this->mNodes[index].parent) {
+    auto &nodeVal = this->mNodes[index];
+    nodeVal.layers = this->mNodes[nodeVal.left].layers |
+                     this->mNodes[nodeVal.right].layers;
+  }
+}
+
+void aabb_tree::clear() {
+  this->mNodes.clear();
+  this->mRoot = null_node;
+  this->mFreeList = null_node;
+  this->mSize = 0;
+}
+
+std::size_t aabb_tree::size() const { return this->mSize; }
+
+entt::entity aabb_tree::entity(int pProxy) const {
+  return this->mNodes[pProxy].entity;
+}
+
+const glm::vec3 &aabb_tree::fat_min(int pProxy) const {
+  return this->mNodes[pProxy].min;
+}
+
+const glm::vec3 &aabb_tree::fat_max(int pProxy) const {
+  return this->mNodes[pProxy].max;
+}
+
+bool aabb_tree::overlaps(const glm::vec3 &pAMin, const glm::vec3 &pAMax,
+                         const glm::vec3 &pBMin, const glm::vec3 &pBMax) {
+  return glm::all(glm::lessThanEqual(pAMin, pBMax)) &&
+         glm::all(glm::lessThanEqual(pBMin, pAMax));
+}
+
+bool aabb_tree::intersects_ray(const glm::vec3 &pOrigin,
+                               const glm::vec3 &pDirection,
+                               const glm::vec3 &pMin, const glm::vec3 &pMax,
+                               float pMaxDistance, float &pDistance,
+                               int &pAxis) {
+  float enter = 0.0f;
+  float exit = pMaxDistance;
+  pAxis = -1;
+  for (int i = 0; i < 3; i += 1) {
+    if (pDirection[i] == 0.0f) {
+      // Parallel to the slab; either always inside it or never
+      if (pOrigin[i] < pMin[i] || pOrigin[i] > pMax[i]) {
+        return false;
+      }
+      continue;
+    }
+    float inverse = 1.0f / pDirection[i];
+    float nearDistance = (pMin[i] - pOrigin[i]) * inverse;
+    float farDistance = (pMax[i] - pOrigin[i]) * inverse;
+    if (nearDistance > farDistance) {
+      std::swap(nearDistance, farDistance);
+    }
+    if (nearDistance > enter) {
+      enter = nearDistance;
+      pAxis = i;
+    }
+    exit = std::min(exit, farDistance);
+    if (enter > exit) {
+      return false;
+    }
+  }
+  pDistance = enter;
+  return true;
+}
+
+int aabb_tree::allocate_node() {
+  if (this->mFreeList == null_node) {
+    this->mNodes.emplace_back();
+    return this->mNodes.size() - 1;
+  }
+  int index = this->mFreeList;
+  this->mFreeList = this->mNodes[index].parent;
+  this->mNodes[index] = node();
+  return index;
+}
+
+void aabb_tree::free_node(int pIndex) {
+  auto &nodeVal = this->mNodes[pIndex];
+  nodeVal.entity = entt::null;
+  nodeVal.height = -1;
+  nodeVal.parent = this->mFreeList;
+  this->mFreeList = pIndex;
+}
+
+void aabb_tree::insert_leaf(int pLeaf) {
+  if (this->mRoot == null_node) {
+    this->mRoot = pLeaf;
+    this->mNodes[pLeaf].parent = null_node;
+    return;
+  }
+  // Descend towards the sibling that grows the total surface area the least
+  glm::vec3 leafMin = this->mNodes[pLeaf].min;
+  glm::vec3 leafMax = this->mNodes[pLeaf].max;
+  int index = this->mRoot;
+  while (this->mNodes[index].left != null_node) {
+    const auto &current = this->mNodes[index];
+    float area = surface_area(current.min, current.max);
+    float combined = surface_area(glm::min(current.min, leafMin),
+                                  glm::max(current.max, leafMax));
+    // Cost of making a new parent for this node and the leaf
+    float cost = 2.0f * combined;
+    // Minimum cost of pushing the leaf further down
+    float inheritance = 2.0f * (combined - area);
+    auto descend_cost = [&](int pChild) {
+      const auto &child = this->mNodes[pChild];
+      float grown = surface_area(glm::min(child.min, leafMin),
+                                 glm::max(child.max, leafMax));
+      if (child.left == null_node) {
+        return grown + inheritance;
+      }
+      return grown - surface_area(child.min, child.max) + inheritance;
+    };
+    float costLeft = descend_cost(current.left);
+    float costRight = descend_cost(current.right);
+    if (cost < costLeft && cost < costRight) {
+      break;
+    }
+    index = costLeft < costRight ? current.left : current.right;
+  }
+
+  int sibling = index;
+  int oldParent = this->mNodes[sibling].parent;
+  int newParent = this->allocate_node();
+  auto &parentVal = this->mNodes[newParent];
+  parentVal.parent = oldParent;
+  parentVal.min = glm::min(leafMin, this->mNodes[sibling].min);
+  parentVal.max = glm::max(leafMax, this->mNodes[sibling].max);
+  parentVal.height = this->mNodes[sibling].height + 1;
+  parentVal.layers =
+      this->mNodes[pLeaf].layers | this->mNodes[sibling].layers;
+  parentVal.left = sibling;
+  parentVal.right = pLeaf;
+  this->mNodes[sibling].parent = newParent;
+  this->mNodes[pLeaf].parent = newParent;
+  if (oldParent == null_node) {
+    this->mRoot = newParent;
+  } else if (this->mNodes[oldParent].left == sibling) {
+    this->mNodes[oldParent].left = newParent;
+  } else {
+    this->mNodes[oldParent].right = newParent;
+  }
+  this->refit(this->mNodes[pLeaf].parent);
+}
+
+void aabb_tree::remove_leaf(int pLeaf) {
+  if (pLeaf == this->mRoot) {
+    this->mRoot = null_node;
+    return;
+  }
+  int parent = this->mNodes[pLeaf].parent;
+  int grandParent = this->mNodes[parent].parent;
+  int sibling = this->mNodes[parent].left == pLeaf ? this->mNodes[parent].right
+                                                   : this->mNodes[parent].left;
+  if (grandParent == null_node) {
+    this->mRoot = sibling;
+    this->mNodes[sibling].parent = null_node;
+    this->free_node(parent);
+    return;
+  }
+  if (this->mNodes[grandParent].left == parent) {
+    this->mNodes[grandParent].left = sibling;
+  } else {
+    this->mNodes[grandParent].right = sibling;
+  }
+  this->mNodes[sibling].parent = grandParent;
+  this->free_node(parent);
+  this->refit(grandParent);
+}
+
+void aabb_tree::refit(int pIndex) {
+  // Walk back to the root, rebalancing and growing the boxes on the way
+  int index = pIndex;
+  while (index != null_node) {
+    index = this->balance(index);
+    auto &nodeVal = this->mNodes[index];
+    const auto &left = this->mNodes[nodeVal.left];
+    const auto &right = this->mNodes[nodeVal.right];
+    nodeVal.height = 1 + std::max(left.height, right.height);
+    nodeVal.min = glm::min(left.min, right.min);
+    nodeVal.max = glm::max(left.max, right.max);
+    nodeVal.layers = left.layers | right.layers;
+    index = nodeVal.parent;
+  }
+}
+
+int aabb_tree::balance(int pIndex) {
+  // Rotates the taller grandchild up whenever the subtrees differ in height
+  // by more than one, returning the node that took pIndex's place.
+  int a = pIndex;
+  if (this->mNodes[a].left == null_node || this->mNodes[a].height < 2) {
+    return a;
+  }
+  int b = this->mNodes[a].left;
+  int c = this->mNodes[a].right;
+  int diff = this->mNodes[c].height - this->mNodes[b].height;
+  if (diff >= -1 && diff <= 1) {
+    return a;
+  }
+  // Both directions are the same rotation with the children swapped
+  bool rotateRight = diff > 0;
+  int taller = rotateRight ? c : b;
+  int shorter = rotateRight ? b : c;
+  int f = this->mNodes[taller].left;
+  int g = this->mNodes[taller].right;
+
+  // The taller child replaces a
+  this->mNodes[taller].left = a;
+  this->mNodes[taller].parent = this->mNodes[a].parent;
+  this->mNodes[a].parent = taller;
+  int parent = this->mNodes[taller].parent;
+  if (parent == null_node) {
+    this->mRoot = taller;
+  } else if (this->mNodes[parent].left == a) {
+    this->mNodes[parent].left = taller;
+  } else {
+    this->mNodes[parent].right = taller;
+  }
+
+  // The taller grandchild stays below the taller child, the other one moves
+  // to a
+  if (this->mNodes[f].height < this->mNodes[g].height) {
+    std::swap(f, g);
+  }
+  this->mNodes[taller].right = f;
+  this->mNodes[a].left = shorter;
+  this->mNodes[a].right = g;
+  this->mNodes[g].parent = a;
+  auto &aVal = this->mNodes[a];
+  aVal.min = glm::min(this->mNodes[shorter].min, this->mNodes[g].min);
+  aVal.max = glm::max(this->mNodes[shorter].max, this->mNodes[g].max);
+  aVal.height =
+      1 + std::max(this->mNodes[shorter].height, this->mNodes[g].height);
+  aVal.layers = this->mNodes[shorter].layers | this->mNodes[g].layers;
+  auto &tallerVal = this->mNodes[taller];
+  tallerVal.min = glm::min(aVal.min, this->mNodes[f].min);
+  tallerVal.max = glm::max(aVal.max, this->mNodes[f].max);
+  tallerVal.height = 1 + std::max(aVal.height, this->mNodes[f].height);
+  tallerVal.layers = aVal.layers | this->mNodes[f].layers;
+  return taller;
+}
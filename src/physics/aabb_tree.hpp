@@ -0,0 +1,164 @@
+#ifndef __AABB_TREE_HPP__
+#define __AABB_TREE_HPP__
+
+#include "entt/entity/fwd.hpp"
+#include <entt/entt.hpp>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace platformer {
+/**
+ * @brief A dynamic bounding volume hierarchy over axis aligned boxes. Leaves
+ * store a box enlarged by a margin, so that objects moving a little do not
+ * need to be reinserted every frame.
+ *
+ * Every proxy also carries layer bits, and every node the union of the bits
+ * below it, so queries for some layers skip whole subtrees without testing
+ * their boxes.
+ */
+class aabb_tree {
+public:
+  static constexpr int null_node = -1;
+
+  aabb_tree(float pMargin = 0.1f);
+
+  static constexpr std::uint32_t all_layers = ~std::uint32_t(0);
+
+  /**
+   * @brief Inserts a box and returns its proxy, which identifies it until it
+   * is removed.
+   */
+  int insert(entt::entity pEntity, const glm::vec3 &pMin,
+             const glm::vec3 &pMax, std::uint32_t pLayers = all_layers);
+  void remove(int pProxy);
+  /**
+   * @brief Updates the box of the proxy. Returns whether the proxy had to be
+   * reinserted, which only happens once it leaves its enlarged box.
+   */
+  bool move(int pProxy, const glm::vec3 &pMin, const glm::vec3 &pMax);
+  // Changes the layer bits of the proxy
+  void layers(int pProxy, std::uint32_t pLayers);
+  void clear();
+
+  std::size_t size() const;
+  entt::entity entity(int pProxy) const;
+  const glm::vec3 &fat_min(int pProxy) const;
+  const glm::vec3 &fat_max(int pProxy) const;
+
+  /**
+   * @brief Calls pCallback(entity) for every proxy whose enlarged box
+   * overlaps the given box. Safe to call from several threads at once.
+   */
+  template <typename Callback>
+  void query(const glm::vec3 &pMin, const glm::vec3 &pMax,
+             Callback &&pCallback) const {
+    this->query(pMin, pMax, all_layers, pCallback);
+  }
+
+  // Same as above, only for proxies sharing a layer bit with pMask
+  template <typename Callback>
+  void query(const glm::vec3 &pMin, const glm::vec3 &pMax, std::uint32_t pMask,
+             Callback &&pCallback) const {
+    if (this->mRoot == null_node) {
+      return;
+    }
+    // The tree is kept balanced, so its height stays far below this
+    int stack[MAX_HEIGHT];
+    int size = 0;
+    stack[size++] = this->mRoot;
+    while (size > 0) {
+      int index = stack[--size];
+      const node &nodeVal = this->mNodes[index];
+      if ((nodeVal.layers & pMask) == 0 ||
+          !overlaps(nodeVal.min, nodeVal.max, pMin, pMax)) {
+        continue;
+      }
+      if (nodeVal.left == null_node) {
+        pCallback(nodeVal.entity);
+      } else {
+        stack[size++] = nodeVal.left;
+        stack[size++] = nodeVal.right;
+      }
+    }
+  }
+
+  /**
+   * @brief Walks the proxies whose enlarged box the ray hits, calling
+   * pCallback(entity, maxDistance) for each. The callback returns the new
+   * maximum distance, e.g. the distance of the closest hit so far, which
+   * prunes the rest of the walk.
+   */
+  template <typename Callback>
+  void raycast(const glm::vec3 &pOrigin, const glm::vec3 &pDirection,
+               float pMaxDistance, Callback &&pCallback) const {
+    if (this->mRoot == null_node) {
+      return;
+    }
+    float maxDistance = pMaxDistance;
+    int stack[MAX_HEIGHT];
+    int size = 0;
+    stack[size++] = this->mRoot;
+    while (size > 0) {
+      int index = stack[--size];
+      const node &nodeVal = this->mNodes[index];
+      float distance;
+      int axis;
+      if (!intersects_ray(pOrigin, pDirection, nodeVal.min, nodeVal.max,
+                          maxDistance, distance, axis)) {
+        continue;
+      }
+      if (nodeVal.left == null_node) {
+        maxDistance = pCallback(nodeVal.entity, maxDistance);
+      } else {
+        stack[size++] = nodeVal.left;
+        stack[size++] = nodeVal.right;
+      }
+    }
+  }
+
+  static bool overlaps(const glm::vec3 &pAMin, const glm::vec3 &pAMax,
+                       const glm::vec3 &pBMin, const glm::vec3 &pBMax);
+  /**
+   * @brief Tests the ray against the box within pMaxDistance, giving the
+   * distance to where it enters the box and the axis of the face it enters
+   * through. Rays starting inside the box hit it at 0, with pAxis set to -1.
+   */
+  static bool intersects_ray(const glm::vec3 &pOrigin,
+                             const glm::vec3 &pDirection, const glm::vec3 &pMin,
+                             const glm::vec3 &pMax, float pMaxDistance,
+                             float &pDistance, int &pAxis);
+
+private:
+  static constexpr int MAX_HEIGHT = 256;
+
+  struct node {
+    glm::vec3 min;
+    glm::vec3 max;
+    entt::entity entity = entt::null;
+    // Layers of the leaf, or of all the leaves below
+    std::uint32_t layers = all_layers;
+    // Doubles as the next free node while the node is unused
+    int parent = null_node;
+    int left = null_node;
+    int right = null_node;
+    // Leaves are 0, unused nodes are -1
+    int height = -1;
+  };
+
+  int allocate_node();
+  void free_node(int pIndex);
+  void insert_leaf(int pLeaf);
+  void remove_leaf(int pLeaf);
+  int balance(int pIndex);
+  void refit(int pIndex);
+
+  std::vector<node> mNodes;
+  int mRoot = null_node;
+  int mFreeList = null_node;
+  std::size_t mSize = 0;
+  float mMargin;
+};
+} // namespace platformer
+
+#endif // __AABB_TREE_HPP__
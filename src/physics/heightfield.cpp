@@ -0,0 +1,127 @@
+#include "physics/heightfield.hpp"
+#include <limits>
+
+using namespace platformer;
+
+heightfield::heightfield(const glm::vec3 &pOrigin, float pCellSize,
+                         int pWidth, int pDepth, std::vector<float> pHeights)
+    : mOrigin(pOrigin), mCellSize(pCellSize), mWidth(pWidth), mDepth(pDepth),
+      mHeights(std::move(pHeights)) {
+  this->mHeights.resize(static_cast<std::size_t>(pWidth) * pDepth,
+                        pOrigin.y);
+  this->mMaxHeight = pOrigin.y;
+  for (float heightVal : this->mHeights) {
+    this->mMaxHeight = std::max(this->mMaxHeight, heightVal);
+  }
+}
+
+const glm::vec3 &heightfield::origin() const { return this->mOrigin; }
+float heightfield::cell_size() const { return this->mCellSize; }
+int heightfield::width() const { return this->mWidth; }
+int heightfield::depth() const { return this->mDepth; }
+
+float heightfield::height(int pX, int pZ) const {
+  return this->mHeights[pZ * this->mWidth + pX];
+}
+
+void heightfield::height(int pX, int pZ, float pValue) {
+  this->mHeights[pZ * this->mWidth + pX] = pValue;
+  this->mMaxHeight = std::max(this->mMaxHeight, pValue);
+}
+
+glm::vec3 heightfield::min() const { return this->mOrigin; }
+
+glm::vec3 heightfield::max() const {
+  return glm::vec3(this->mOrigin.x + this->mWidth * this->mCellSize,
+                   this->mMaxHeight,
+                   this->mOrigin.z + this->mDepth * this->mCellSize);
+}
+
+std::uint32_t heightfield::layer() const { return this->mLayer; }
+void heightfield::layer(std::uint32_t pValue) { this->mLayer = pValue; }
+std::uint32_t heightfield::mask() const { return this->mMask; }
+void heightfield::mask(std::uint32_t pValue) { this->mMask = pValue; }
+
+int heightfield::cell_of(float pValue, float pOrigin, int pCount) const {
+  // Clamped before converting, as far away points may not fit in an int
+  float cell = std::floor((pValue - pOrigin) / this->mCellSize);
+  return static_cast<int>(
+      std::clamp(cell, 0.0f, static_cast<float>(pCount - 1)));
+}
+
+bool heightfield::raycast(const glm::vec3 &pOrigin,
+                          const glm::vec3 &pDirection, float pMaxDistance,
+                          float &pDistance, glm::vec3 &pNormal) const {
+  if (this->mWidth == 0 || this->mDepth == 0) {
+    return false;
+  }
+  float enter;
+  int enterAxis;
+  if (!aabb_tree::intersects_ray(pOrigin, pDirection, this->min(),
+                                 this->max(), pMaxDistance, enter,
+                                 enterAxis)) {
+    return false;
+  }
+  // Columns don't overlap on the XZ plane, so the first column hit while
+  // walking the cells in order is the closest one
+  glm::vec3 point = pOrigin + pDirection * enter;
+  const int axes[2] = {0, 2};
+  const int counts[2] = {this->mWidth, this->mDepth};
+  int cell[2];
+  int step[2];
+  float next[2];
+  float delta[2];
+  for (int i = 0; i < 2; i += 1) {
+    int axis = axes[i];
+    cell[i] = this->cell_of(point[axis], this->mOrigin[axis], counts[i]);
+    if (pDirection[axis] > 0.0f) {
+      step[i] = 1;
+      next[i] = (this->mOrigin[axis] + (cell[i] + 1) * this->mCellSize -
+                 pOrigin[axis]) /
+                pDirection[axis];
+      delta[i] = this->mCellSize / pDirection[axis];
+    } else if (pDirection[axis] < 0.0f) {
+      step[i] = -1;
+      next[i] = (this->mOrigin[axis] + cell[i] * this->mCellSize -
+                 pOrigin[axis]) /
+                pDirection[axis];
+      delta[i] = -this->mCellSize / pDirection[axis];
+    } else {
+      step[i] = 0;
+      next[i] = std::numeric_limits<float>::infinity();
+      delta[i] = std::numeric_limits<float>::infinity();
+    }
+  }
+  while (true) {
+    float heightVal = this->mHeights[cell[1] * this->mWidth + cell[0]];
+    if (heightVal > this->mOrigin.y) {
+      glm::vec3 columnMin(this->mOrigin.x + cell[0] * this->mCellSize,
+                          this->mOrigin.y,
+                          this->mOrigin.z + cell[1] * this->mCellSize);
+      glm::vec3 columnMax(columnMin.x + this->mCellSize, heightVal,
+                          columnMin.z + this->mCellSize);
+      int axis;
+      if (aabb_tree::intersects_ray(pOrigin, pDirection, columnMin,
+                                    columnMax, pMaxDistance, pDistance,
+                                    axis)) {
+        if (axis < 0) {
+          pNormal = -pDirection;
+        } else {
+          pNormal = glm::vec3(0.0f);
+          pNormal[axis] = pDirection[axis] > 0.0f ? -1.0f : 1.0f;
+        }
+        return true;
+      }
+    }
+    // Vertical rays never leave their cell
+    int i = next[1] < next[0] ? 1 : 0;
+    if (step[i] == 0 || next[i] > pMaxDistance) {
+      return false;
+    }
+    cell[i] += step[i];
+    if (cell[i] < 0 || cell[i] >= counts[i]) {
+      return false;
+    }
+    next[i] += delta[i];
+  }
+}
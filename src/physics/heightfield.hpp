@@ -0,0 +1,106 @@
+#ifndef __HEIGHTFIELD_HPP__
+#define __HEIGHTFIELD_HPP__
+
+#include "physics/aabb_tree.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace platformer {
+/**
+ * @brief Ground terrain or a floor of tiles as one collider: a grid of solid
+ * columns on the XZ plane, stored as one height per cell. Each column goes
+ * from the base of the field up to the height of its cell, and cells at or
+ * below the base are holes. Columns have flat tops, so slopes are stairs the
+ * size of a cell.
+ *
+ * The field is placed in world space by its origin and doesn't need a
+ * transform. Boxes and rays only visit the cells they cross, found by
+ * indexing the grid directly.
+ * @note Call registry.patch<heightfield>() after changing the heights, so
+ * that bodies resting on the field wake up.
+ */
+class heightfield {
+public:
+  heightfield(){};
+  /**
+   * @param pOrigin The corner of cell (0, 0) at the base of the field.
+   * @param pHeights Heights in world space, row by row along X.
+   */
+  heightfield(const glm::vec3 &pOrigin, float pCellSize, int pWidth,
+              int pDepth, std::vector<float> pHeights);
+
+  const glm::vec3 &origin() const;
+  float cell_size() const;
+  int width() const;
+  int depth() const;
+  float height(int pX, int pZ) const;
+  void height(int pX, int pZ, float pValue);
+  // Bounds of the whole field
+  glm::vec3 min() const;
+  glm::vec3 max() const;
+
+  // Layer bits, paired with those of collisions like collision::layer()
+  std::uint32_t layer() const;
+  void layer(std::uint32_t pValue);
+  std::uint32_t mask() const;
+  void mask(std::uint32_t pValue);
+
+  /**
+   * @brief Calls pCallback(min, max) with the box of every column that
+   * overlaps the given box.
+   */
+  template <typename Callback>
+  void query(const glm::vec3 &pMin, const glm::vec3 &pMax,
+             Callback &&pCallback) const {
+    if (!aabb_tree::overlaps(this->min(), this->max(), pMin, pMax)) {
+      return;
+    }
+    int minX = this->cell_of(pMin.x, this->mOrigin.x, this->mWidth);
+    int maxX = this->cell_of(pMax.x, this->mOrigin.x, this->mWidth);
+    int minZ = this->cell_of(pMin.z, this->mOrigin.z, this->mDepth);
+    int maxZ = this->cell_of(pMax.z, this->mOrigin.z, this->mDepth);
+    for (int z = minZ; z <= maxZ; z += 1) {
+      for (int x = minX; x <= maxX; x += 1) {
+        float heightVal = this->mHeights[z * this->mWidth + x];
+        if (heightVal <= this->mOrigin.y || pMin.y > heightVal) {
+          continue;
+        }
+        glm::vec3 columnMin(this->mOrigin.x + x * this->mCellSize,
+                            this->mOrigin.y,
+                            this->mOrigin.z + z * this->mCellSize);
+        glm::vec3 columnMax(columnMin.x + this->mCellSize, heightVal,
+                            columnMin.z + this->mCellSize);
+        pCallback(columnMin, columnMax);
+      }
+    }
+  }
+
+  /**
+   * @brief Finds the first column hit by the ray within pMaxDistance, walking
+   * the cells along the ray in order. The normal is that of the face hit,
+   * like in physics_system::raycast().
+   */
+  bool raycast(const glm::vec3 &pOrigin, const glm::vec3 &pDirection,
+               float pMaxDistance, float &pDistance, glm::vec3 &pNormal) const;
+
+private:
+  // Returns the cell containing the coordinate on one axis, clamped to the
+  // field
+  int cell_of(float pValue, float pOrigin, int pCount) const;
+
+  glm::vec3 mOrigin = glm::vec3(0.0f);
+  float mCellSize = 1.0f;
+  int mWidth = 0;
+  int mDepth = 0;
+  std::vector<float> mHeights;
+  // At least as high as the highest column, bounding the field
+  float mMaxHeight = 0.0f;
+  std::uint32_t mLayer = 1;
+  std::uint32_t mMask = aabb_tree::all_layers;
+};
+} // namespace platformer
+
+#endif // __HEIGHTFIELD_HPP__
@@ -59,7 +59,6 @@ void fps_movement_system::init(game &pGame) {
 void fps_movement_system::update(game &pGame, float pDelta) {
   this->update_movedir(pGame, pDelta);
   this->update_jump(pGame, pDelta);
-  this->sync_camera(pGame);
 }
 
 void fps_movement_system::update_movedir(game &pGame, float pDelta) {
@@ -150,15 +149,18 @@ void fps_movement_system::sync_camera(game &pGame) {
   if (this->mThirdPerson) {
     auto &camTransform = registry.get<transform>(cameraEntity);
     auto &playerTransform = registry.get<transform>(bodyEntity);
+    glm::mat4 playerMatrix =
+        playerTransform.matrix_world_interpolated(registry);
+    glm::vec3 playerPosition = glm::vec3(playerMatrix[3]);
     glm::vec3 eyeDir = glm::normalize(
-        glm::vec3(glm::normalize(playerTransform.matrix_world(registry) *
-                                 glm::vec4(0.0, 0.0, 1.0, 0.0))) *
+        glm::vec3(
+            glm::normalize(playerMatrix * glm::vec4(0.0, 0.0, 1.0, 0.0))) *
         glm::vec3(1.0f, 0.0f, 1.0f));
     if (!std::isnan(eyeDir.x)) {
-      camTransform.position((playerTransform.position() + eyeDir * 5.0f +
+      camTransform.position((playerPosition + eyeDir * 5.0f +
                              glm::vec3(0.0f, 2.0f, 0.0f)));
       glm::quat quat = glm::identity<glm::quat>();
-      glm::vec3 diff = camTransform.position() - playerTransform.position();
+      glm::vec3 diff = camTransform.position() - playerPosition;
       quat = glm::rotate(quat, std::atan2(diff.x, diff.z),
                          glm::vec3(0.0, 1.0, 0.0));
       quat = glm::rotate(quat, -0.3f, glm::vec3(1.0, 0.0, 0.0));
@@ -166,8 +168,8 @@ void fps_movement_system::sync_camera(game &pGame) {
       // camTransform.look_at(playerTransform.position());
     }
   } else {
-    cameraTransform.matrix_world(registry,
-                                 headTransform.matrix_world(registry));
+    cameraTransform.matrix_world(
+        registry, headTransform.matrix_world_interpolated(registry));
   }
 
   if (headMesh != nullptr) {
@@ -31,6 +31,11 @@ public:
   void init(game &pGame);
   void update(game &pGame, float pDelta);
   void handle_event(game &pGame, SDL_Event &pEvent);
+  /**
+   * @brief Moves the camera to the interpolated pose of the player, so call
+   * it after transform_system::interpolate_snapshots().
+   */
+  void sync_camera(game &pGame);
 
   bool mouse_locked() const;
 
@@ -57,7 +62,6 @@ private:
   void update_movedir(game &pGame, float pDelta);
   void update_jump(game &pGame, float pDelta);
   void mouse_pan(game &pGame, int pXRel, int pYRel);
-  void sync_camera(game &pGame);
   void handle_key(SDL_Keycode &pKey, bool pState);
 };
 } // namespace platformer
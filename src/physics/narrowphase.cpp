@@ -0,0 +1,1134 @@
+#include "physics/narrowphase.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#if defined(__AVX__) || defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+using namespace platformer;
+
+namespace {
+// Added to the absolute rotation terms, so that nearly parallel edges don't
+// produce a degenerate cross axis that separates everything
+constexpr float PARALLEL_EPSILON = 1e-5f;
+// How far from perpendicular the world axes of a box may be before it is
+// treated as sheared
+constexpr float SHEAR_EPSILON = 1e-3f;
+
+enum box_field {
+  CX,
+  CY,
+  CZ,
+  // Axis j component i is at U + j * 3 + i
+  U,
+  EX = U + 9,
+  EY,
+  EZ,
+};
+
+// Largest factor the matrix scales any length by, bounding spheres under
+// non uniform scale
+float max_scale(const glm::mat4 &pMatrix) {
+  return std::max(glm::length(glm::vec3(pMatrix[0])),
+                  std::max(glm::length(glm::vec3(pMatrix[1])),
+                           glm::length(glm::vec3(pMatrix[2]))));
+}
+
+float point_box_distance2(const glm::vec3 &pPoint, const glm::vec3 &pMin,
+                          const glm::vec3 &pMax) {
+  float distance = 0.0f;
+  for (int i = 0; i < 3; i += 1) {
+    float gap = std::max(pMin[i] - pPoint[i], 0.0f) +
+                std::max(pPoint[i] - pMax[i], 0.0f);
+    distance += gap * gap;
+  }
+  return distance;
+}
+
+bool sphere_overlaps(const float *pSphere, const glm::vec3 &pMin,
+                     const glm::vec3 &pMax) {
+  glm::vec3 center(pSphere[0], pSphere[1], pSphere[2]);
+  return point_box_distance2(center, pMin, pMax) <= pSphere[3] * pSphere[3];
+}
+
+// Squared distance between the segment and the box. Between the points where
+// the segment crosses the planes of the box, every coordinate stays on one
+// side of the box, so the distance is a quadratic whose minimum is exact.
+// pParameter receives where along the segment it is closest, from 0 to 1.
+float segment_box_distance2(const glm::vec3 &pStart, const glm::vec3 &pEnd,
+                            const glm::vec3 &pMin, const glm::vec3 &pMax,
+                            float *pParameter = nullptr) {
+  glm::vec3 direction = pEnd - pStart;
+  float cuts[8] = {0.0f, 1.0f};
+  int numCuts = 2;
+  for (int i = 0; i < 3; i += 1) {
+    if (direction[i] == 0.0f) {
+      continue;
+    }
+    for (float plane : {pMin[i], pMax[i]}) {
+      float cut = (plane - pStart[i]) / direction[i];
+      if (cut > 0.0f && cut < 1.0f) {
+        // Keep the cuts sorted; cuts[0] is 0, so this stops before it
+        int k = numCuts;
+        while (cuts[k - 1] > cut) {
+          cuts[k] = cuts[k - 1];
+          k -= 1;
+        }
+        cuts[k] = cut;
+        numCuts += 1;
+      }
+    }
+  }
+  float closest = std::numeric_limits<float>::infinity();
+  for (int k = 0; k + 1 < numCuts; k += 1) {
+    // The gap along axis i is pStart[i] - plane + direction[i] * t on the
+    // side of the box the middle of the piece is on
+    float middle = (cuts[k] + cuts[k + 1]) * 0.5f;
+    float squares = 0.0f;
+    float products = 0.0f;
+    for (int i = 0; i < 3; i += 1) {
+      float value = pStart[i] + direction[i] * middle;
+      float plane;
+      if (value < pMin[i]) {
+        plane = pMin[i];
+      } else if (value > pMax[i]) {
+        plane = pMax[i];
+      } else {
+        continue;
+      }
+      squares += direction[i] * direction[i];
+      products += (pStart[i] - plane) * direction[i];
+    }
+    float t = squares > 0.0f
+                  ? std::clamp(-products / squares, cuts[k], cuts[k + 1])
+                  : cuts[k];
+    float distance = point_box_distance2(pStart + direction * t, pMin, pMax);
+    if (distance < closest) {
+      closest = distance;
+      if (pParameter != nullptr) {
+        *pParameter = t;
+      }
+    }
+  }
+  return closest;
+}
+
+// Squared distance between the closest points of two segments, which are
+// stored in pPointA and pPointB
+float segment_closest(const glm::vec3 &pStartA, const glm::vec3 &pEndA,
+                      const glm::vec3 &pStartB, const glm::vec3 &pEndB,
+                      glm::vec3 &pPointA, glm::vec3 &pPointB) {
+  glm::vec3 directionA = pEndA - pStartA;
+  glm::vec3 directionB = pEndB - pStartB;
+  glm::vec3 offset = pStartA - pStartB;
+  float lengthA = glm::dot(directionA, directionA);
+  float lengthB = glm::dot(directionB, directionB);
+  float projectionB = glm::dot(directionB, offset);
+  // Parameters of the closest points along A and B
+  float s = 0.0f;
+  float t = 0.0f;
+  if (lengthA == 0.0f && lengthB == 0.0f) {
+    pPointA = pStartA;
+    pPointB = pStartB;
+    return glm::dot(offset, offset);
+  }
+  if (lengthA == 0.0f) {
+    t = std::clamp(projectionB / lengthB, 0.0f, 1.0f);
+  } else {
+    float projectionA = glm::dot(directionA, offset);
+    if (lengthB == 0.0f) {
+      s = std::clamp(-projectionA / lengthA, 0.0f, 1.0f);
+    } else {
+      float cosine = glm::dot(directionA, directionB);
+      float denominator = lengthA * lengthB - cosine * cosine;
+      // Parallel segments are closest anywhere along their overlap, so start
+      // from the start of A
+      if (denominator > 0.0f) {
+        s = std::clamp(
+            (cosine * projectionB - projectionA * lengthB) / denominator,
+            0.0f, 1.0f);
+      }
+      t = (cosine * s + projectionB) / lengthB;
+      if (t < 0.0f) {
+        t = 0.0f;
+        s = std::clamp(-projectionA / lengthA, 0.0f, 1.0f);
+      } else if (t > 1.0f) {
+        t = 1.0f;
+        s = std::clamp((cosine - projectionA) / lengthA, 0.0f, 1.0f);
+      }
+    }
+  }
+  pPointA = pStartA + directionA * s;
+  pPointB = pStartB + directionB * t;
+  glm::vec3 gap = pPointA - pPointB;
+  return glm::dot(gap, gap);
+}
+
+float segment_distance2(const glm::vec3 &pStartA, const glm::vec3 &pEndA,
+                        const glm::vec3 &pStartB, const glm::vec3 &pEndB) {
+  glm::vec3 pointA;
+  glm::vec3 pointB;
+  return segment_closest(pStartA, pEndA, pStartB, pEndB, pointA, pointB);
+}
+
+// The segment inside a sphere or a capsule
+void core_segment(const world_shape &pShape, glm::vec3 &pStart,
+                  glm::vec3 &pEnd) {
+  glm::vec3 half =
+      pShape.capsule ? pShape.axes[0] * pShape.extent.x : glm::vec3(0.0f);
+  pStart = pShape.center - half;
+  pEnd = pShape.center + half;
+}
+
+// The point relative to the centre and axes of the box
+glm::vec3 box_local(const world_shape &pBox, const glm::vec3 &pPoint) {
+  glm::vec3 offset = pPoint - pBox.center;
+  return glm::vec3(glm::dot(offset, pBox.axes[0]),
+                   glm::dot(offset, pBox.axes[1]),
+                   glm::dot(offset, pBox.axes[2]));
+}
+
+// Separating axis test of an oriented box against the world aligned box with
+// the given centre and half extents, over the 15 candidate axes
+bool box_overlaps(const float *pBox, const glm::vec3 &pCenter,
+                  const glm::vec3 &pExtent) {
+  float t[3] = {pBox[CX] - pCenter.x, pBox[CY] - pCenter.y,
+                pBox[CZ] - pCenter.z};
+  const float *extent = pBox + EX;
+  // r[i][j] is world axis i dotted with box axis j
+  float r[3][3];
+  float absR[3][3];
+  for (int i = 0; i < 3; i += 1) {
+    for (int j = 0; j < 3; j += 1) {
+      r[i][j] = pBox[U + j * 3 + i];
+      absR[i][j] = std::abs(r[i][j]) + PARALLEL_EPSILON;
+    }
+  }
+  for (int i = 0; i < 3; i += 1) {
+    float radius = extent[0] * absR[i][0] + extent[1] * absR[i][1] +
+                   extent[2] * absR[i][2];
+    if (std::abs(t[i]) > pExtent[i] + radius) {
+      return false;
+    }
+  }
+  for (int j = 0; j < 3; j += 1) {
+    float radius = pExtent[0] * absR[0][j] + pExtent[1] * absR[1][j] +
+                   pExtent[2] * absR[2][j];
+    float distance = t[0] * r[0][j] + t[1] * r[1][j] + t[2] * r[2][j];
+    if (std::abs(distance) > radius + extent[j]) {
+      return false;
+    }
+  }
+  for (int i = 0; i < 3; i += 1) {
+    int i1 = (i + 1) % 3;
+    int i2 = (i + 2) % 3;
+    for (int j = 0; j < 3; j += 1) {
+      int j1 = (j + 1) % 3;
+      int j2 = (j + 2) % 3;
+      float radiusA = pExtent[i1] * absR[i2][j] + pExtent[i2] * absR[i1][j];
+      float radiusB = extent[j1] * absR[i][j2] + extent[j2] * absR[i][j1];
+      float distance = t[i2] * r[i1][j] - t[i1] * r[i2][j];
+      if (std::abs(distance) > radiusA + radiusB) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Separating axis test of two oriented boxes, done as the test of B against
+// the aligned box A turns into once A's axes are the world axes
+bool boxes_overlap(const world_shape &pA, const world_shape &pB) {
+  float box[15];
+  glm::vec3 center = box_local(pA, pB.center);
+  for (int i = 0; i < 3; i += 1) {
+    box[CX + i] = center[i];
+    box[EX + i] = pB.extent[i];
+  }
+  for (int j = 0; j < 3; j += 1) {
+    for (int i = 0; i < 3; i += 1) {
+      box[U + j * 3 + i] = glm::dot(pB.axes[j], pA.axes[i]);
+    }
+  }
+  return box_overlaps(box, glm::vec3(0.0f), pA.extent);
+}
+
+glm::vec3 unit_or(const glm::vec3 &pVector, const glm::vec3 &pFallback) {
+  float length = glm::length(pVector);
+  return length > 0.0f ? pVector / length : pFallback;
+}
+
+// The ray tests below only keep hits closer than pDistance, updating it and
+// pNormal, and return whether they did. Rays are given unit directions.
+
+bool ray_sphere(const glm::vec3 &pOrigin, const glm::vec3 &pDirection,
+                const glm::vec3 &pCenter, float pRadius, float &pDistance,
+                glm::vec3 &pNormal) {
+  if (pRadius <= 0.0f) {
+    return false;
+  }
+  glm::vec3 offset = pOrigin - pCenter;
+  float projection = glm::dot(offset, pDirection);
+  float gap = glm::dot(offset, offset) - pRadius * pRadius;
+  float discriminant = projection * projection - gap;
+  if ((gap > 0.0f && projection > 0.0f) || discriminant < 0.0f) {
+    return false;
+  }
+  float distance = std::max(-projection - std::sqrt(discriminant), 0.0f);
+  if (distance >= pDistance) {
+    return false;
+  }
+  pDistance = distance;
+  pNormal = unit_or(offset + pDirection * distance, -pDirection);
+  return true;
+}
+
+bool ray_capsule(const glm::vec3 &pOrigin, const glm::vec3 &pDirection,
+                 const glm::vec3 &pStart, const glm::vec3 &pEnd,
+                 float pRadius, float &pDistance, glm::vec3 &pNormal) {
+  if (pRadius <= 0.0f) {
+    return false;
+  }
+  bool hit = false;
+  glm::vec3 axis = pEnd - pStart;
+  float length2 = glm::dot(axis, axis);
+  if (length2 > 0.0f) {
+    // The side is where the ray, with the axis projected out, is as far as
+    // the radius from the axis
+    glm::vec3 offset = pOrigin - pStart;
+    glm::vec3 sideOffset = offset - axis * (glm::dot(offset, axis) / length2);
+    glm::vec3 sideDirection =
+        pDirection - axis * (glm::dot(pDirection, axis) / length2);
+    float a = glm::dot(sideDirection, sideDirection);
+    float b = glm::dot(sideOffset, sideDirection);
+    float c = glm::dot(sideOffset, sideOffset) - pRadius * pRadius;
+    float discriminant = b * b - a * c;
+    if (a > 0.0f && discriminant >= 0.0f && (c <= 0.0f || b < 0.0f)) {
+      float distance = std::max((-b - std::sqrt(discriminant)) / a, 0.0f);
+      float along = glm::dot(offset + pDirection * distance, axis) / length2;
+      if (along >= 0.0f && along <= 1.0f && distance < pDistance) {
+        pDistance = distance;
+        pNormal = unit_or(sideOffset + sideDirection * distance, -pDirection);
+        hit = true;
+      }
+    }
+  }
+  hit |= ray_sphere(pOrigin, pDirection, pStart, pRadius, pDistance, pNormal);
+  hit |= ray_sphere(pOrigin, pDirection, pEnd, pRadius, pDistance, pNormal);
+  return hit;
+}
+
+// Slab test against the box with its own centre and axes but the given half
+// extents
+bool ray_box(const glm::vec3 &pOrigin, const glm::vec3 &pDirection,
+             const world_shape &pBox, const glm::vec3 &pExtent,
+             float &pDistance, glm::vec3 &pNormal) {
+  glm::vec3 origin = box_local(pBox, pOrigin);
+  glm::vec3 direction(glm::dot(pDirection, pBox.axes[0]),
+                      glm::dot(pDirection, pBox.axes[1]),
+                      glm::dot(pDirection, pBox.axes[2]));
+  float enter = -std::numeric_limits<float>::infinity();
+  float leave = pDistance;
+  int axis = -1;
+  for (int i = 0; i < 3; i += 1) {
+    if (direction[i] == 0.0f) {
+      if (std::abs(origin[i]) > pExtent[i]) {
+        return false;
+      }
+      continue;
+    }
+    float near = (-std::copysign(pExtent[i], direction[i]) - origin[i]) /
+                 direction[i];
+    float far =
+        (std::copysign(pExtent[i], direction[i]) - origin[i]) / direction[i];
+    if (near > enter) {
+      enter = near;
+      axis = i;
+    }
+    leave = std::min(leave, far);
+  }
+  if (enter > leave || leave < 0.0f || enter >= pDistance) {
+    return false;
+  }
+  if (enter <= 0.0f) {
+    pDistance = 0.0f;
+    pNormal = -pDirection;
+  } else {
+    pDistance = enter;
+    pNormal = direction[axis] > 0.0f ? -pBox.axes[axis] : pBox.axes[axis];
+  }
+  return true;
+}
+
+// The box grown by the radius is the box grown along each of its axes, along
+// with its edges turned into capsules
+bool ray_rounded_box(const glm::vec3 &pOrigin, const glm::vec3 &pDirection,
+                     const world_shape &pBox, float pRadius, float &pDistance,
+                     glm::vec3 &pNormal) {
+  if (pRadius <= 0.0f) {
+    return ray_box(pOrigin, pDirection, pBox, pBox.extent, pDistance,
+                   pNormal);
+  }
+  // Most rays miss even the box grown on every axis at once
+  float bound = pDistance;
+  glm::vec3 boundNormal;
+  if (!ray_box(pOrigin, pDirection, pBox, pBox.extent + glm::vec3(pRadius),
+               bound, boundNormal)) {
+    return false;
+  }
+  bool hit = false;
+  for (int i = 0; i < 3; i += 1) {
+    glm::vec3 extent = pBox.extent;
+    extent[i] += pRadius;
+    hit |= ray_box(pOrigin, pDirection, pBox, extent, pDistance, pNormal);
+  }
+  for (int i = 0; i < 3; i += 1) {
+    glm::vec3 half = pBox.axes[i] * pBox.extent[i];
+    glm::vec3 sideJ = pBox.axes[(i + 1) % 3] * pBox.extent[(i + 1) % 3];
+    glm::vec3 sideK = pBox.axes[(i + 2) % 3] * pBox.extent[(i + 2) % 3];
+    for (glm::vec3 edge : {sideJ + sideK, sideJ - sideK, -sideJ + sideK,
+                           -sideJ - sideK}) {
+      edge += pBox.center;
+      hit |= ray_capsule(pOrigin, pDirection, edge - half, edge + half,
+                         pRadius, pDistance, pNormal);
+    }
+  }
+  return hit;
+}
+
+// The segment from pStart to pEnd moving along the direction touches the
+// one from pOtherStart to pOtherEnd, at the given distance, where the
+// closest points are inside both. The displacements that bring them that
+// close lie along the parallelogram between them, thickened by the radius.
+bool segments_cast(const glm::vec3 &pStart, const glm::vec3 &pEnd,
+                   const glm::vec3 &pOtherStart, const glm::vec3 &pOtherEnd,
+                   const glm::vec3 &pDirection, float pRadius,
+                   float &pDistance, glm::vec3 &pNormal) {
+  glm::vec3 u = pOtherEnd - pOtherStart;
+  glm::vec3 v = pStart - pEnd;
+  glm::vec3 corner = pOtherStart - pStart;
+  glm::vec3 normal = glm::cross(u, v);
+  float length = glm::length(normal);
+  // Parallel segments are closest at the end of one of them, which the
+  // rounded ends cover
+  if (length <= PARALLEL_EPSILON * glm::length(u) * glm::length(v)) {
+    return false;
+  }
+  normal /= length;
+  float offset = -glm::dot(corner, normal);
+  if (offset < 0.0f) {
+    normal = -normal;
+    offset = -offset;
+  }
+  float speed = -glm::dot(pDirection, normal);
+  if (speed <= 0.0f) {
+    return false;
+  }
+  float distance = std::max((offset - pRadius) / speed, 0.0f);
+  if (distance >= pDistance) {
+    return false;
+  }
+  glm::vec3 point = pDirection * distance - normal * pRadius - corner;
+  float uu = glm::dot(u, u);
+  float uv = glm::dot(u, v);
+  float vv = glm::dot(v, v);
+  float pu = glm::dot(point, u);
+  float pv = glm::dot(point, v);
+  float determinant = uu * vv - uv * uv;
+  float alongU = (pu * vv - pv * uv) / determinant;
+  float alongV = (pv * uu - pu * uv) / determinant;
+  if (alongU < 0.0f || alongU > 1.0f || alongV < 0.0f || alongV > 1.0f) {
+    return false;
+  }
+  pDistance = distance;
+  pNormal = normal;
+  return true;
+}
+
+// Same as ray_capsule(), with the ray cast from a point of the target
+// against the moving capsule, so the normal is turned back towards it
+bool point_cast(const glm::vec3 &pPoint, const glm::vec3 &pDirection,
+                const glm::vec3 &pStart, const glm::vec3 &pEnd, float pRadius,
+                float &pDistance, glm::vec3 &pNormal) {
+  if (!ray_capsule(pPoint, -pDirection, pStart, pEnd, pRadius, pDistance,
+                   pNormal)) {
+    return false;
+  }
+  pNormal = -pNormal;
+  return true;
+}
+
+// Half the length of the box projected on the axis
+float box_radius(const world_shape &pBox, const glm::vec3 &pAxis) {
+  return pBox.extent.x * std::abs(glm::dot(pBox.axes[0], pAxis)) +
+         pBox.extent.y * std::abs(glm::dot(pBox.axes[1], pAxis)) +
+         pBox.extent.z * std::abs(glm::dot(pBox.axes[2], pAxis));
+}
+
+// The 15 candidate separating axes of two boxes: the face axes of both,
+// then the cross products of their edges, skipping nearly parallel ones.
+// Returns the number of axes.
+int box_axes(const world_shape &pA, const world_shape &pB,
+             glm::vec3 (&pAxes)[15]) {
+  int numAxes = 0;
+  for (int i = 0; i < 3; i += 1) {
+    pAxes[numAxes++] = pA.axes[i];
+    pAxes[numAxes++] = pB.axes[i];
+  }
+  for (int i = 0; i < 3; i += 1) {
+    for (int j = 0; j < 3; j += 1) {
+      glm::vec3 axis = glm::cross(pA.axes[i], pB.axes[j]);
+      float length = glm::length(axis);
+      if (length > PARALLEL_EPSILON * 10.0f) {
+        pAxes[numAxes++] = axis / length;
+      }
+    }
+  }
+  return numAxes;
+}
+
+// Pushes the round shape out of the box. The normal points away from the box.
+bool round_box_penetration(const world_shape &pRound, const world_shape &pBox,
+                           glm::vec3 &pNormal, float &pDepth) {
+  glm::vec3 start;
+  glm::vec3 end;
+  core_segment(pRound, start, end);
+  start = box_local(pBox, start);
+  end = box_local(pBox, end);
+  float parameter = 0.0f;
+  float distance2 = segment_box_distance2(start, end, -pBox.extent,
+                                          pBox.extent, &parameter);
+  if (distance2 > pRound.radius * pRound.radius) {
+    return false;
+  }
+  if (distance2 > 0.0f) {
+    glm::vec3 point = start + (end - start) * parameter;
+    glm::vec3 gap = point - glm::clamp(point, -pBox.extent, pBox.extent);
+    float distance = std::sqrt(distance2);
+    gap /= distance;
+    pNormal = pBox.axes[0] * gap.x + pBox.axes[1] * gap.y +
+              pBox.axes[2] * gap.z;
+    pDepth = pRound.radius - distance;
+    return true;
+  }
+  // The core is inside the box, so it leaves through the closest face
+  pDepth = std::numeric_limits<float>::infinity();
+  for (int i = 0; i < 3; i += 1) {
+    float low = std::min(start[i], end[i]) - pRound.radius;
+    float high = std::max(start[i], end[i]) + pRound.radius;
+    if (pBox.extent[i] - low < pDepth) {
+      pDepth = pBox.extent[i] - low;
+      pNormal = pBox.axes[i];
+    }
+    if (high + pBox.extent[i] < pDepth) {
+      pDepth = high + pBox.extent[i];
+      pNormal = -pBox.axes[i];
+    }
+  }
+  return true;
+}
+
+// Shapes are tested eight at a time with AVX, or four at a time with SSE
+#if defined(__AVX__)
+typedef __m256 lanes;
+constexpr int LANES = 8;
+inline lanes lanes_set(float pValue) { return _mm256_set1_ps(pValue); }
+inline lanes lanes_load(const float *pValues) {
+  return _mm256_loadu_ps(pValues);
+}
+inline lanes lanes_add(lanes pA, lanes pB) { return _mm256_add_ps(pA, pB); }
+inline lanes lanes_sub(lanes pA, lanes pB) { return _mm256_sub_ps(pA, pB); }
+inline lanes lanes_mul(lanes pA, lanes pB) { return _mm256_mul_ps(pA, pB); }
+inline lanes lanes_max(lanes pA, lanes pB) { return _mm256_max_ps(pA, pB); }
+inline lanes lanes_or(lanes pA, lanes pB) { return _mm256_or_ps(pA, pB); }
+inline lanes lanes_abs(lanes pValue) {
+  return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), pValue);
+}
+inline lanes lanes_gt(lanes pA, lanes pB) {
+  return _mm256_cmp_ps(pA, pB, _CMP_GT_OQ);
+}
+inline lanes lanes_le(lanes pA, lanes pB) {
+  return _mm256_cmp_ps(pA, pB, _CMP_LE_OQ);
+}
+inline int lanes_mask(lanes pValue) { return _mm256_movemask_ps(pValue); }
+#elif defined(__SSE__)
+typedef __m128 lanes;
+constexpr int LANES = 4;
+inline lanes lanes_set(float pValue) { return _mm_set1_ps(pValue); }
+inline lanes lanes_load(const float *pValues) { return _mm_loadu_ps(pValues); }
+inline lanes lanes_add(lanes pA, lanes pB) { return _mm_add_ps(pA, pB); }
+inline lanes lanes_sub(lanes pA, lanes pB) { return _mm_sub_ps(pA, pB); }
+inline lanes lanes_mul(lanes pA, lanes pB) { return _mm_mul_ps(pA, pB); }
+inline lanes lanes_max(lanes pA, lanes pB) { return _mm_max_ps(pA, pB); }
+inline lanes lanes_or(lanes pA, lanes pB) { return _mm_or_ps(pA, pB); }
+inline lanes lanes_abs(lanes pValue) {
+  return _mm_andnot_ps(_mm_set1_ps(-0.0f), pValue);
+}
+inline lanes lanes_gt(lanes pA, lanes pB) { return _mm_cmpgt_ps(pA, pB); }
+inline lanes lanes_le(lanes pA, lanes pB) { return _mm_cmple_ps(pA, pB); }
+inline int lanes_mask(lanes pValue) { return _mm_movemask_ps(pValue); }
+#endif
+
+#if defined(__AVX__) || defined(__SSE__)
+// Lanes where |pDistance| > pRadius, i.e. the axis separates the shapes
+inline lanes lanes_separated(lanes pDistance, lanes pRadius) {
+  return lanes_gt(lanes_abs(pDistance), pRadius);
+}
+#endif
+} // namespace
+
+bool platformer::overlaps(const world_shape &pA, const world_shape &pB) {
+  bool roundA = pA.sphere || pA.capsule;
+  bool roundB = pB.sphere || pB.capsule;
+  if (!roundA && !roundB) {
+    return boxes_overlap(pA, pB);
+  }
+  glm::vec3 startA;
+  glm::vec3 endA;
+  if (roundA && roundB) {
+    glm::vec3 startB;
+    glm::vec3 endB;
+    core_segment(pA, startA, endA);
+    core_segment(pB, startB, endB);
+    float radius = pA.radius + pB.radius;
+    return segment_distance2(startA, endA, startB, endB) <= radius * radius;
+  }
+  const world_shape &round = roundA ? pA : pB;
+  const world_shape &box = roundA ? pB : pA;
+  core_segment(round, startA, endA);
+  return segment_box_distance2(box_local(box, startA), box_local(box, endA),
+                               -box.extent, box.extent) <=
+         round.radius * round.radius;
+}
+
+bool platformer::cast_sphere(const world_shape &pShape,
+                             const glm::vec3 &pCenter, float pRadius,
+                             const glm::vec3 &pDirection, float pMaxDistance,
+                             float &pDistance, glm::vec3 &pNormal) {
+  return cast_capsule(pShape, pCenter, pCenter, pRadius, pDirection,
+                      pMaxDistance, pDistance, pNormal);
+}
+
+bool platformer::cast_capsule(const world_shape &pShape, const glm::vec3 &pA,
+                              const glm::vec3 &pB, float pRadius,
+                              const glm::vec3 &pDirection, float pMaxDistance,
+                              float &pDistance, glm::vec3 &pNormal) {
+  world_shape caster;
+  caster.sphere = pA == pB;
+  caster.capsule = !caster.sphere;
+  caster.center = (pA + pB) * 0.5f;
+  caster.axes[0] = unit_or(pB - pA, caster.axes[0]);
+  caster.extent.x = glm::length(pB - pA) * 0.5f;
+  caster.radius = pRadius;
+  if (overlaps(pShape, caster)) {
+    pDistance = 0.0f;
+    pNormal = -pDirection;
+    return true;
+  }
+  // The caster first touches the shape at either end, or with its side
+  // against a corner or an edge of the shape
+  float distance = pMaxDistance;
+  glm::vec3 normal;
+  bool hit = false;
+  if (pShape.sphere || pShape.capsule) {
+    glm::vec3 start;
+    glm::vec3 end;
+    core_segment(pShape, start, end);
+    float radius = pRadius + pShape.radius;
+    hit |= ray_capsule(pA, pDirection, start, end, radius, distance, normal);
+    if (caster.capsule) {
+      hit |= ray_capsule(pB, pDirection, start, end, radius, distance, normal);
+      hit |= point_cast(start, pDirection, pA, pB, radius, distance, normal);
+      hit |= point_cast(end, pDirection, pA, pB, radius, distance, normal);
+      hit |= segments_cast(pA, pB, start, end, pDirection, radius, distance,
+                           normal);
+    }
+  } else {
+    hit |= ray_rounded_box(pA, pDirection, pShape, pRadius, distance, normal);
+    if (caster.capsule) {
+      hit |=
+          ray_rounded_box(pB, pDirection, pShape, pRadius, distance, normal);
+      for (int i = 0; i < 3; i += 1) {
+        glm::vec3 half = pShape.axes[i] * pShape.extent[i];
+        glm::vec3 sideJ = pShape.axes[(i + 1) % 3] * pShape.extent[(i + 1) % 3];
+        glm::vec3 sideK = pShape.axes[(i + 2) % 3] * pShape.extent[(i + 2) % 3];
+        for (glm::vec3 edge : {sideJ + sideK, sideJ - sideK, -sideJ + sideK,
+                               -sideJ - sideK}) {
+          edge += pShape.center;
+          // Each edge once, and each corner from the edges along the X axis
+          if (i == 0) {
+            hit |= point_cast(edge - half, pDirection, pA, pB, pRadius,
+                              distance, normal);
+            hit |= point_cast(edge + half, pDirection, pA, pB, pRadius,
+                              distance, normal);
+          }
+          hit |= segments_cast(pA, pB, edge - half, edge + half, pDirection,
+                               pRadius, distance, normal);
+        }
+      }
+    }
+  }
+  if (!hit) {
+    return false;
+  }
+  pDistance = distance;
+  pNormal = normal;
+  return true;
+}
+
+bool platformer::penetration(const world_shape &pA, const world_shape &pB,
+                             glm::vec3 &pNormal, float &pDepth) {
+  bool roundA = pA.sphere || pA.capsule;
+  bool roundB = pB.sphere || pB.capsule;
+  if (roundA && roundB) {
+    glm::vec3 startA;
+    glm::vec3 endA;
+    glm::vec3 startB;
+    glm::vec3 endB;
+    core_segment(pA, startA, endA);
+    core_segment(pB, startB, endB);
+    glm::vec3 pointA;
+    glm::vec3 pointB;
+    float distance = std::sqrt(
+        segment_closest(startA, endA, startB, endB, pointA, pointB));
+    if (distance > pA.radius + pB.radius) {
+      return false;
+    }
+    pNormal = unit_or(pointA - pointB, glm::vec3(0.0f, 1.0f, 0.0f));
+    pDepth = pA.radius + pB.radius - distance;
+    return true;
+  }
+  if (roundA) {
+    return round_box_penetration(pA, pB, pNormal, pDepth);
+  }
+  if (roundB) {
+    if (!round_box_penetration(pB, pA, pNormal, pDepth)) {
+      return false;
+    }
+    pNormal = -pNormal;
+    return true;
+  }
+  // The separating axis the boxes overlap the least along. Face axes come
+  // first, so they win ties against edge axes.
+  glm::vec3 axes[15];
+  int numAxes = box_axes(pA, pB, axes);
+  glm::vec3 offset = pA.center - pB.center;
+  pDepth = std::numeric_limits<float>::infinity();
+  for (int k = 0; k < numAxes; k += 1) {
+    float distance = glm::dot(offset, axes[k]);
+    float depth = box_radius(pA, axes[k]) + box_radius(pB, axes[k]) -
+                  std::abs(distance);
+    if (depth < 0.0f) {
+      return false;
+    }
+    if (depth < pDepth) {
+      pDepth = depth;
+      pNormal = distance >= 0.0f ? axes[k] : -axes[k];
+    }
+  }
+  return true;
+}
+
+bool platformer::sweep(const world_shape &pA, const world_shape &pB,
+                       const glm::vec3 &pDisplacement, float &pTime,
+                       glm::vec3 &pNormal) {
+  float length = glm::length(pDisplacement);
+  if (length == 0.0f) {
+    return false;
+  }
+  glm::vec3 direction = pDisplacement / length;
+  float distance;
+  if (pA.sphere || pA.capsule) {
+    glm::vec3 start;
+    glm::vec3 end;
+    core_segment(pA, start, end);
+    if (!cast_capsule(pB, start, end, pA.radius, direction, length, distance,
+                      pNormal) ||
+        distance <= 0.0f) {
+      return false;
+    }
+    pTime = distance / length;
+    return true;
+  }
+  if (pB.sphere || pB.capsule) {
+    // The same as B moving the other way into A
+    glm::vec3 start;
+    glm::vec3 end;
+    core_segment(pB, start, end);
+    if (!cast_capsule(pA, start, end, pB.radius, -direction, length,
+                      distance, pNormal) ||
+        distance <= 0.0f) {
+      return false;
+    }
+    pTime = distance / length;
+    pNormal = -pNormal;
+    return true;
+  }
+  // Along each axis, the projections overlap during an interval of time; the
+  // boxes hit when the last of those intervals starts, if before any ends
+  glm::vec3 axes[15];
+  int numAxes = box_axes(pA, pB, axes);
+  glm::vec3 offset = pB.center - pA.center;
+  float enter = -std::numeric_limits<float>::infinity();
+  float leave = std::numeric_limits<float>::infinity();
+  for (int k = 0; k < numAxes; k += 1) {
+    float gap = glm::dot(offset, axes[k]);
+    float radius = box_radius(pA, axes[k]) + box_radius(pB, axes[k]);
+    float speed = glm::dot(pDisplacement, axes[k]);
+    if (speed == 0.0f) {
+      if (std::abs(gap) > radius) {
+        return false;
+      }
+      continue;
+    }
+    float start = (gap - std::copysign(radius, speed)) / speed;
+    float end = (gap + std::copysign(radius, speed)) / speed;
+    if (start > enter) {
+      enter = start;
+      pNormal = speed > 0.0f ? -axes[k] : axes[k];
+    }
+    leave = std::min(leave, end);
+  }
+  if (enter < 0.0f || enter >= 1.0f || enter > leave) {
+    return false;
+  }
+  pTime = enter;
+  return true;
+}
+
+void world_shape::bounds(glm::vec3 &pMin, glm::vec3 &pMax) const {
+  glm::vec3 half;
+  if (this->sphere) {
+    half = glm::vec3(this->radius);
+  } else if (this->capsule) {
+    half = glm::abs(this->axes[0]) * this->extent.x + glm::vec3(this->radius);
+  } else {
+    half = glm::abs(this->axes[0]) * this->extent.x +
+           glm::abs(this->axes[1]) * this->extent.y +
+           glm::abs(this->axes[2]) * this->extent.z;
+  }
+  pMin = this->center - half;
+  pMax = this->center + half;
+}
+
+bool world_shape::aligned() const {
+  if (this->sphere || this->capsule) {
+    return false;
+  }
+  for (int j = 0; j < 3; j += 1) {
+    glm::vec3 axis = glm::abs(this->axes[j]);
+    if (std::max(axis.x, std::max(axis.y, axis.z)) < 1.0f - SHEAR_EPSILON) {
+      return false;
+    }
+  }
+  return true;
+}
+
+collision_shape collision_shape::box(const glm::vec3 &pMin,
+                                     const glm::vec3 &pMax) {
+  return box((pMin + pMax) * 0.5f, (pMax - pMin) * 0.5f,
+             glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+}
+
+collision_shape collision_shape::box(const glm::vec3 &pCenter,
+                                     const glm::vec3 &pExtent,
+                                     const glm::quat &pOrientation) {
+  collision_shape shape;
+  shape.mType = BOX;
+  shape.mCenter = pCenter;
+  shape.mExtent = pExtent;
+  shape.mOrientation = pOrientation;
+  return shape;
+}
+
+collision_shape collision_shape::sphere(const glm::vec3 &pCenter,
+                                        float pRadius) {
+  collision_shape shape;
+  shape.mType = SPHERE;
+  shape.mCenter = pCenter;
+  shape.mRadius = pRadius;
+  return shape;
+}
+
+collision_shape collision_shape::capsule(const glm::vec3 &pA,
+                                         const glm::vec3 &pB, float pRadius) {
+  collision_shape shape;
+  shape.mType = CAPSULE;
+  shape.mCenter = pA;
+  shape.mEnd = pB;
+  shape.mRadius = pRadius;
+  return shape;
+}
+
+collision_shape::shape_type collision_shape::type() const {
+  return this->mType;
+}
+
+void collision_shape::bounds(glm::vec3 &pMin, glm::vec3 &pMax) const {
+  world_shape shape = this->to_world(glm::mat4(1.0f));
+  shape.bounds(pMin, pMax);
+}
+
+world_shape collision_shape::to_world(const glm::mat4 &pMatrix) const {
+  world_shape shape;
+  if (this->mType == SPHERE) {
+    shape.sphere = true;
+    shape.center = glm::vec3(pMatrix * glm::vec4(this->mCenter, 1.0f));
+    shape.radius = this->mRadius * max_scale(pMatrix);
+    return shape;
+  }
+  if (this->mType == CAPSULE) {
+    // Like spheres, non uniform scale grows the radius to the largest factor
+    glm::vec3 start = glm::vec3(pMatrix * glm::vec4(this->mCenter, 1.0f));
+    glm::vec3 end = glm::vec3(pMatrix * glm::vec4(this->mEnd, 1.0f));
+    float length = glm::length(end - start);
+    shape.center = (start + end) * 0.5f;
+    shape.radius = this->mRadius * max_scale(pMatrix);
+    if (length <= 0.0f) {
+      shape.sphere = true;
+      return shape;
+    }
+    shape.capsule = true;
+    shape.axes[0] = (end - start) / length;
+    shape.extent = glm::vec3(length * 0.5f, 0.0f, 0.0f);
+    return shape;
+  }
+
+  // The box is a centre and three scaled axes, which the matrix maps into the
+  // world
+  glm::mat3 rotation = glm::mat3_cast(this->mOrientation);
+  glm::vec3 axes[3];
+  for (int j = 0; j < 3; j += 1) {
+    axes[j] = rotation[j] * this->mExtent[j];
+  }
+  glm::mat3 linear(pMatrix);
+  shape.center = glm::vec3(pMatrix * glm::vec4(this->mCenter, 1.0f));
+  bool sheared = false;
+  for (int j = 0; j < 3; j += 1) {
+    glm::vec3 axis = linear * axes[j];
+    float length = glm::length(axis);
+    shape.extent[j] = length;
+    shape.axes[j] = length > 0.0f ? axis / length : glm::vec3(0.0f);
+  }
+  for (int j = 0; j < 3 && !sheared; j += 1) {
+    float cosine = glm::dot(shape.axes[j], shape.axes[(j + 1) % 3]);
+    sheared = std::abs(cosine) > SHEAR_EPSILON ||
+              glm::length(shape.axes[j]) < 0.5f;
+  }
+  if (sheared) {
+    // Skewed or flattened boxes are no longer boxes, so fall back to the
+    // world aligned box around the mapped axes
+    glm::vec3 half = glm::abs(linear * axes[0]) + glm::abs(linear * axes[1]) +
+                     glm::abs(linear * axes[2]);
+    shape.axes[0] = glm::vec3(1.0f, 0.0f, 0.0f);
+    shape.axes[1] = glm::vec3(0.0f, 1.0f, 0.0f);
+    shape.axes[2] = glm::vec3(0.0f, 0.0f, 1.0f);
+    shape.extent = half;
+  }
+  return shape;
+}
+
+void shape_batch::clear() {
+  for (auto &values : this->mSpheres) {
+    values.clear();
+  }
+  this->mSphereOwners.clear();
+  for (auto &values : this->mBoxes) {
+    values.clear();
+  }
+  this->mBoxOwners.clear();
+  this->mCapsules.clear();
+  this->mCapsuleOwners.clear();
+}
+
+void shape_batch::add(const world_shape &pShape, int pOwner) {
+  if (pShape.sphere) {
+    this->mSpheres[0].push_back(pShape.center.x);
+    this->mSpheres[1].push_back(pShape.center.y);
+    this->mSpheres[2].push_back(pShape.center.z);
+    this->mSpheres[3].push_back(pShape.radius);
+    this->mSphereOwners.push_back(pOwner);
+    return;
+  }
+  if (pShape.capsule) {
+    this->mCapsules.push_back(pShape);
+    this->mCapsuleOwners.push_back(pOwner);
+    return;
+  }
+  this->mBoxes[CX].push_back(pShape.center.x);
+  this->mBoxes[CY].push_back(pShape.center.y);
+  this->mBoxes[CZ].push_back(pShape.center.z);
+  for (int j = 0; j < 3; j += 1) {
+    for (int i = 0; i < 3; i += 1) {
+      this->mBoxes[U + j * 3 + i].push_back(pShape.axes[j][i]);
+    }
+  }
+  this->mBoxes[EX].push_back(pShape.extent.x);
+  this->mBoxes[EY].push_back(pShape.extent.y);
+  this->mBoxes[EZ].push_back(pShape.extent.z);
+  this->mBoxOwners.push_back(pOwner);
+}
+
+void shape_batch::overlapping_capsules(const glm::vec3 &pMin,
+                                       const glm::vec3 &pMax,
+                                       std::vector<int> &pOwners) const {
+  for (std::size_t c = 0; c < this->mCapsules.size(); c += 1) {
+    const auto &capsule = this->mCapsules[c];
+    glm::vec3 start;
+    glm::vec3 end;
+    core_segment(capsule, start, end);
+    if (segment_box_distance2(start, end, pMin, pMax) <=
+        capsule.radius * capsule.radius) {
+      pOwners.push_back(this->mCapsuleOwners[c]);
+    }
+  }
+}
+
+void shape_batch::overlapping_scalar(const glm::vec3 &pMin,
+                                     const glm::vec3 &pMax,
+                                     std::vector<int> &pOwners) const {
+  for (std::size_t s = 0; s < this->mSphereOwners.size(); s += 1) {
+    float sphere[4] = {this->mSpheres[0][s], this->mSpheres[1][s],
+                       this->mSpheres[2][s], this->mSpheres[3][s]};
+    if (sphere_overlaps(sphere, pMin, pMax)) {
+      pOwners.push_back(this->mSphereOwners[s]);
+    }
+  }
+  glm::vec3 center = (pMin + pMax) * 0.5f;
+  glm::vec3 extent = (pMax - pMin) * 0.5f;
+  for (std::size_t b = 0; b < this->mBoxOwners.size(); b += 1) {
+    float box[15];
+    for (int f = 0; f < 15; f += 1) {
+      box[f] = this->mBoxes[f][b];
+    }
+    if (box_overlaps(box, center, extent)) {
+      pOwners.push_back(this->mBoxOwners[b]);
+    }
+  }
+  this->overlapping_capsules(pMin, pMax, pOwners);
+}
+
+#if defined(__AVX__) || defined(__SSE__)
+void shape_batch::overlapping(const glm::vec3 &pMin, const glm::vec3 &pMax,
+                              std::vector<int> &pOwners) const {
+  // Shapes are processed in groups of LANES; the remainder goes through the
+  // scalar tests
+  const lanes zero = lanes_set(0.0f);
+  lanes boxMin[3];
+  lanes boxMax[3];
+  for (int i = 0; i < 3; i += 1) {
+    boxMin[i] = lanes_set(pMin[i]);
+    boxMax[i] = lanes_set(pMax[i]);
+  }
+  std::size_t numSpheres = this->mSphereOwners.size();
+  std::size_t s = 0;
+  for (; s + LANES <= numSpheres; s += LANES) {
+    lanes distance = zero;
+    for (int i = 0; i < 3; i += 1) {
+      lanes center = lanes_load(this->mSpheres[i].data() + s);
+      lanes gap = lanes_add(lanes_max(lanes_sub(boxMin[i], center), zero),
+                            lanes_max(lanes_sub(center, boxMax[i]), zero));
+      distance = lanes_add(distance, lanes_mul(gap, gap));
+    }
+    lanes radius = lanes_load(this->mSpheres[3].data() + s);
+    int mask = lanes_mask(lanes_le(distance, lanes_mul(radius, radius)));
+    for (int lane = 0; lane < LANES; lane += 1) {
+      if (mask & (1 << lane)) {
+        pOwners.push_back(this->mSphereOwners[s + lane]);
+      }
+    }
+  }
+  for (; s < numSpheres; s += 1) {
+    float sphere[4] = {this->mSpheres[0][s], this->mSpheres[1][s],
+                       this->mSpheres[2][s], this->mSpheres[3][s]};
+    if (sphere_overlaps(sphere, pMin, pMax)) {
+      pOwners.push_back(this->mSphereOwners[s]);
+    }
+  }
+
+  glm::vec3 center = (pMin + pMax) * 0.5f;
+  glm::vec3 extent = (pMax - pMin) * 0.5f;
+  lanes a[3];
+  for (int i = 0; i < 3; i += 1) {
+    a[i] = lanes_set(extent[i]);
+  }
+  const lanes epsilon = lanes_set(PARALLEL_EPSILON);
+  std::size_t numBoxes = this->mBoxOwners.size();
+  std::size_t b = 0;
+  for (; b + LANES <= numBoxes; b += LANES) {
+    lanes t[3];
+    for (int i = 0; i < 3; i += 1) {
+      t[i] = lanes_sub(lanes_load(this->mBoxes[CX + i].data() + b),
+                       lanes_set(center[i]));
+    }
+    lanes e[3];
+    for (int j = 0; j < 3; j += 1) {
+      e[j] = lanes_load(this->mBoxes[EX + j].data() + b);
+    }
+    lanes r[3][3];
+    lanes absR[3][3];
+    for (int i = 0; i < 3; i += 1) {
+      for (int j = 0; j < 3; j += 1) {
+        r[i][j] = lanes_load(this->mBoxes[U + j * 3 + i].data() + b);
+        absR[i][j] = lanes_add(lanes_abs(r[i][j]), epsilon);
+      }
+    }
+    // Lanes separated by any of the axes
+    lanes separated = zero;
+    for (int i = 0; i < 3; i += 1) {
+      lanes radius =
+          lanes_add(a[i], lanes_add(lanes_mul(e[0], absR[i][0]),
+                                    lanes_add(lanes_mul(e[1], absR[i][1]),
+                                              lanes_mul(e[2], absR[i][2]))));
+      separated = lanes_or(separated, lanes_separated(t[i], radius));
+    }
+    for (int j = 0; j < 3; j += 1) {
+      lanes radius =
+          lanes_add(e[j], lanes_add(lanes_mul(a[0], absR[0][j]),
+                                    lanes_add(lanes_mul(a[1], absR[1][j]),
+                                              lanes_mul(a[2], absR[2][j]))));
+      lanes distance = lanes_add(
+          lanes_mul(t[0], r[0][j]),
+          lanes_add(lanes_mul(t[1], r[1][j]), lanes_mul(t[2], r[2][j])));
+      separated = lanes_or(separated, lanes_separated(distance, radius));
+    }
+    for (int i = 0; i < 3; i += 1) {
+      int i1 = (i + 1) % 3;
+      int i2 = (i + 2) % 3;
+      for (int j = 0; j < 3; j += 1) {
+        int j1 = (j + 1) % 3;
+        int j2 = (j + 2) % 3;
+        lanes radius = lanes_add(lanes_add(lanes_mul(a[i1], absR[i2][j]),
+                                           lanes_mul(a[i2], absR[i1][j])),
+                                 lanes_add(lanes_mul(e[j1], absR[i][j2]),
+                                           lanes_mul(e[j2], absR[i][j1])));
+        lanes distance = lanes_sub(lanes_mul(t[i2], r[i1][j]),
+                                   lanes_mul(t[i1], r[i2][j]));
+        separated = lanes_or(separated, lanes_separated(distance, radius));
+      }
+    }
+    int mask = lanes_mask(separated);
+    for (int lane = 0; lane < LANES; lane += 1) {
+      if (!(mask & (1 << lane))) {
+        pOwners.push_back(this->mBoxOwners[b + lane]);
+      }
+    }
+  }
+  for (; b < numBoxes; b += 1) {
+    float box[15];
+    for (int f = 0; f < 15; f += 1) {
+      box[f] = this->mBoxes[f][b];
+    }
+    if (box_overlaps(box, center, extent)) {
+      pOwners.push_back(this->mBoxOwners[b]);
+    }
+  }
+  this->overlapping_capsules(pMin, pMax, pOwners);
+}
+#else
+void shape_batch::overlapping(const glm::vec3 &pMin, const glm::vec3 &pMax,
+                              std::vector<int> &pOwners) const {
+  this->overlapping_scalar(pMin, pMax, pOwners);
+}
+#endif
@@ -0,0 +1,133 @@
+#ifndef __NARROWPHASE_HPP__
+#define __NARROWPHASE_HPP__
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <vector>
+
+namespace platformer {
+// A collision shape placed in the world. Boxes are oriented boxes, capsules
+// are the segment along their first axis, as long as twice the first extent,
+// grown by the radius.
+struct world_shape {
+  bool sphere = false;
+  bool capsule = false;
+  glm::vec3 center = glm::vec3(0.0f);
+  // Unit axes of the box
+  glm::vec3 axes[3] = {glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+                       glm::vec3(0.0f, 0.0f, 1.0f)};
+  // Half extents of the box along its axes
+  glm::vec3 extent = glm::vec3(0.0f);
+  float radius = 0.0f;
+
+  void bounds(glm::vec3 &pMin, glm::vec3 &pMax) const;
+  // Whether the shape is a box aligned to the world axes, so that its bounds
+  // are exact
+  bool aligned() const;
+};
+
+/**
+ * @brief Whether two shapes overlap, with the separating axes of boxes and
+ * the closest points of spheres and capsules.
+ */
+bool overlaps(const world_shape &pA, const world_shape &pB);
+
+/**
+ * @brief Moves a sphere from pCenter along the unit direction, finding the
+ * distance at which it first touches the shape and the normal of the shape
+ * there. A radius of 0 casts a ray. A sphere starting inside the shape hits
+ * it at distance 0, with the normal facing back along the direction.
+ */
+bool cast_sphere(const world_shape &pShape, const glm::vec3 &pCenter,
+                 float pRadius, const glm::vec3 &pDirection,
+                 float pMaxDistance, float &pDistance, glm::vec3 &pNormal);
+// Same as cast_sphere() for the capsule around the segment from pA to pB
+bool cast_capsule(const world_shape &pShape, const glm::vec3 &pA,
+                  const glm::vec3 &pB, float pRadius,
+                  const glm::vec3 &pDirection, float pMaxDistance,
+                  float &pDistance, glm::vec3 &pNormal);
+/**
+ * @brief Whether two shapes overlap or touch, along with the shortest way to
+ * push A out of B: the unit normal to push it along and the depth.
+ */
+bool penetration(const world_shape &pA, const world_shape &pB,
+                 glm::vec3 &pNormal, float &pDepth);
+/**
+ * @brief Finds when A, moving by pDisplacement, first touches B, as a
+ * fraction of the displacement, along with the normal of B facing A there.
+ * Shapes that overlap already never hit.
+ */
+bool sweep(const world_shape &pA, const world_shape &pB,
+           const glm::vec3 &pDisplacement, float &pTime, glm::vec3 &pNormal);
+
+class collision_shape {
+public:
+  enum shape_type { BOX, SPHERE, CAPSULE };
+
+  // A box aligned to the local axes
+  static collision_shape box(const glm::vec3 &pMin, const glm::vec3 &pMax);
+  static collision_shape box(const glm::vec3 &pCenter,
+                             const glm::vec3 &pExtent,
+                             const glm::quat &pOrientation);
+  static collision_shape sphere(const glm::vec3 &pCenter, float pRadius);
+  static collision_shape capsule(const glm::vec3 &pA, const glm::vec3 &pB,
+                                 float pRadius);
+
+  shape_type type() const;
+  // Bounds of the shape in local space
+  void bounds(glm::vec3 &pMin, glm::vec3 &pMax) const;
+  /**
+   * @brief Places the shape in the world. Scaling that doesn't keep the box
+   * axes perpendicular turns the box into the world aligned box around it.
+   */
+  world_shape to_world(const glm::mat4 &pMatrix) const;
+
+private:
+  shape_type mType = BOX;
+  // Centre of boxes and spheres, or one end of capsules
+  glm::vec3 mCenter = glm::vec3(0.0f);
+  // Other end of capsules
+  glm::vec3 mEnd = glm::vec3(0.0f);
+  glm::vec3 mExtent = glm::vec3(1.0f);
+  glm::quat mOrientation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+  float mRadius = 0.0f;
+};
+
+/**
+ * @brief Shapes stored as structure of arrays, so that spheres and boxes are
+ * tested against one box eight at a time with AVX, or four at a time with
+ * SSE, when the build targets it.
+ */
+class shape_batch {
+public:
+  void clear();
+  // pOwner is reported back when the shape overlaps
+  void add(const world_shape &pShape, int pOwner);
+  /**
+   * @brief Appends the owner of every shape overlapping the box to pOwners.
+   * Owners with several shapes may be appended more than once.
+   */
+  void overlapping(const glm::vec3 &pMin, const glm::vec3 &pMax,
+                   std::vector<int> &pOwners) const;
+  // Plain scalar implementation, kept for comparison and for targets without
+  // SIMD support.
+  void overlapping_scalar(const glm::vec3 &pMin, const glm::vec3 &pMax,
+                          std::vector<int> &pOwners) const;
+
+private:
+  void overlapping_capsules(const glm::vec3 &pMin, const glm::vec3 &pMax,
+                            std::vector<int> &pOwners) const;
+
+  // Sphere centres and radii
+  std::vector<float> mSpheres[4];
+  std::vector<int> mSphereOwners;
+  // Box centres, axes and extents
+  std::vector<float> mBoxes[15];
+  std::vector<int> mBoxOwners;
+  // Capsules, which are rare enough to be tested one at a time
+  std::vector<world_shape> mCapsules;
+  std::vector<int> mCapsuleOwners;
+};
+} // namespace platformer
+
+#endif // __NARROWPHASE_HPP__
@@ -1,13 +1,235 @@
 #include "physics/physics.hpp"
-#include "game.hpp"
 #define GLM_ENABLE_EXPERIMENTAL
 #include "glm/gtx/string_cast.hpp"
 #include "scenegraph/transform.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
 using namespace platformer;
 
+namespace {
+// Bounds of the transformed box, using the absolute matrix to project the
+// extents instead of transforming all eight corners.
+void world_bounds(const glm::mat4 &pMatrix, const glm::vec3 &pMin,
+                  const glm::vec3 &pMax, glm::vec3 &pWorldMin,
+                  glm::vec3 &pWorldMax) {
+  glm::vec3 center = (pMin + pMax) * 0.5f;
+  glm::vec3 extent = (pMax - pMin) * 0.5f;
+  glm::vec3 worldCenter = pMatrix * glm::vec4(center, 1.0f);
+  glm::vec3 worldExtent = glm::abs(glm::vec3(pMatrix[0])) * extent.x +
+                          glm::abs(glm::vec3(pMatrix[1])) * extent.y +
+                          glm::abs(glm::vec3(pMatrix[2])) * extent.z;
+  pWorldMin = worldCenter - worldExtent;
+  pWorldMax = worldCenter + worldExtent;
+}
+
+// Distance below which boxes are considered touching rather than apart
+constexpr float CONTACT_EPSILON = 1e-4f;
+// Distance below which bodies are considered resting on each other
+constexpr float ISLAND_MARGIN = 0.01f;
+
+bool overlaps_strictly(const glm::vec3 &pAMin, const glm::vec3 &pAMax,
+                       const glm::vec3 &pBMin, const glm::vec3 &pBMax) {
+  for (int i = 0; i < 3; i += 1) {
+    if (pAMin[i] >= pBMax[i] - CONTACT_EPSILON ||
+        pBMin[i] >= pAMax[i] - CONTACT_EPSILON) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Casts a box of the given half extents against the target, which is the
+// same as casting a ray against the target grown by the extents.
+bool cast_against(const glm::vec3 &pMin, const glm::vec3 &pMax,
+                  const glm::vec3 &pOrigin, const glm::vec3 &pDirection,
+                  const glm::vec3 &pExtent, float pMaxDistance,
+                  float &pDistance, glm::vec3 &pNormal) {
+  int axis;
+  if (!aabb_tree::intersects_ray(pOrigin, pDirection, pMin - pExtent,
+                                 pMax + pExtent, pMaxDistance, pDistance,
+                                 axis)) {
+    return false;
+  }
+  if (axis < 0) {
+    pNormal = -pDirection;
+  } else {
+    pNormal = glm::vec3(0.0f);
+    pNormal[axis] = pDirection[axis] > 0.0f ? -1.0f : 1.0f;
+  }
+  return true;
+}
+
+// Finds when box A, moving by pDisplacement, runs into box B, as a fraction
+// of the displacement, along with the axis it hits B on. Boxes that only
+// touch or slide past each other never hit, nor do boxes already overlapping.
+bool sweep_box(const glm::vec3 &pAMin, const glm::vec3 &pAMax,
+               const glm::vec3 &pBMin, const glm::vec3 &pBMax,
+               const glm::vec3 &pDisplacement, float &pTime, int &pAxis) {
+  // The boxes hit once they overlap by more than CONTACT_EPSILON on every
+  // axis, and stop overlapping once any axis separates again
+  float enter = -std::numeric_limits<float>::infinity();
+  float leave = std::numeric_limits<float>::infinity();
+  float gap = 0.0f;
+  int axis = -1;
+  for (int i = 0; i < 3; i += 1) {
+    float distance = pDisplacement[i];
+    if (distance == 0.0f) {
+      if (pAMin[i] >= pBMax[i] - CONTACT_EPSILON ||
+          pBMin[i] >= pAMax[i] - CONTACT_EPSILON) {
+        return false;
+      }
+      continue;
+    }
+    // Distances along the movement until A reaches B, and until it is past B
+    float start = distance > 0.0f ? pBMin[i] - pAMax[i] : pAMin[i] - pBMax[i];
+    float end = distance > 0.0f ? pBMax[i] - pAMin[i] : pAMax[i] - pBMin[i];
+    float speed = std::abs(distance);
+    float axisEnter = (start + CONTACT_EPSILON) / speed;
+    if (axisEnter > enter) {
+      enter = axisEnter;
+      gap = start;
+      axis = i;
+    }
+    leave = std::min(leave, (end - CONTACT_EPSILON) / speed);
+  }
+  if (axis < 0 || enter < 0.0f || enter >= 1.0f || enter >= leave) {
+    return false;
+  }
+  // Boxes closer than CONTACT_EPSILON are touching already
+  pTime = gap <= CONTACT_EPSILON ? 0.0f : gap / std::abs(pDisplacement[axis]);
+  pAxis = axis;
+  return true;
+}
+
+// Rounds of pushing a body out of what it overlaps; each round may find new
+// colliders where the body was pushed to
+constexpr int MAX_DEPENETRATIONS = 4;
+
+// Finds the shortest way out of an overlap between two boxes: the axis with
+// the least penetration, and the signed distance to move box A along it.
+void min_penetration(const glm::vec3 &pAMin, const glm::vec3 &pAMax,
+                     const glm::vec3 &pBMin, const glm::vec3 &pBMax,
+                     int &pAxis, float &pDistance) {
+  pAxis = -1;
+  float best = 0.0f;
+  for (int axis = 0; axis < 3; axis += 1) {
+    float up = pBMax[axis] - pAMin[axis];
+    float down = pAMax[axis] - pBMin[axis];
+    float depth = std::min(up, down);
+    // Ties go to the vertical axis, so that a body sunk into the floor is
+    // lifted rather than pushed aside
+    if (pAxis < 0 || depth < best || (depth == best && axis == 1)) {
+      best = depth;
+      pAxis = axis;
+      pDistance = up <= down ? up : -down;
+    }
+  }
+}
+
+// Surfaces whose normal points up at least this much hold bodies up
+constexpr float GROUND_NORMAL_Y = 0.7f;
+
+world_shape box_shape(const glm::vec3 &pMin, const glm::vec3 &pMax) {
+  world_shape box;
+  box.center = (pMin + pMax) * 0.5f;
+  box.extent = (pMax - pMin) * 0.5f;
+  return box;
+}
+
+// Finds the shortest way to push the box out of the obstacle, given by its
+// box and its shapes, if they overlap by more than CONTACT_EPSILON. Boxes
+// are pushed along an axis, shapes along their normal.
+bool push_out(const glm::vec3 &pMin, const glm::vec3 &pMax,
+              const glm::vec3 &pTargetMin, const glm::vec3 &pTargetMax,
+              const std::vector<world_shape> *pShapes, glm::vec3 &pNormal,
+              float &pDistance) {
+  if (!overlaps_strictly(pMin, pMax, pTargetMin, pTargetMax)) {
+    return false;
+  }
+  if (pShapes == nullptr) {
+    int axis;
+    float distance;
+    min_penetration(pMin, pMax, pTargetMin, pTargetMax, axis, distance);
+    pNormal = glm::vec3(0.0f);
+    pNormal[axis] = distance > 0.0f ? 1.0f : -1.0f;
+    pDistance = std::abs(distance);
+    return true;
+  }
+  // Out of the deepest shape first, the others are left to the next rounds
+  world_shape box = box_shape(pMin, pMax);
+  bool found = false;
+  for (const auto &shape : *pShapes) {
+    glm::vec3 normal;
+    float depth;
+    if (penetration(box, shape, normal, depth) && depth > CONTACT_EPSILON &&
+        (!found || depth > pDistance)) {
+      pNormal = normal;
+      pDistance = depth;
+      found = true;
+    }
+  }
+  return found;
+}
+
+// Finds when the box, moving by pDisplacement, hits the obstacle as a
+// fraction of the displacement, along with the normal of the obstacle there.
+// Like sweep_box(), shapes touching the box only stop it if it moves into
+// them, and shapes overlapping it are left to push_out().
+bool sweep_obstacle(const glm::vec3 &pMin, const glm::vec3 &pMax,
+                    const glm::vec3 &pTargetMin, const glm::vec3 &pTargetMax,
+                    const std::vector<world_shape> *pShapes,
+                    const glm::vec3 &pDisplacement, float &pTime,
+                    glm::vec3 &pNormal) {
+  if (pShapes == nullptr) {
+    int axis;
+    if (!sweep_box(pMin, pMax, pTargetMin, pTargetMax, pDisplacement, pTime,
+                   axis)) {
+      return false;
+    }
+    pNormal = glm::vec3(0.0f);
+    pNormal[axis] = pDisplacement[axis] > 0.0f ? -1.0f : 1.0f;
+    return true;
+  }
+  if (!aabb_tree::overlaps(glm::min(pMin, pMin + pDisplacement),
+                           glm::max(pMax, pMax + pDisplacement), pTargetMin,
+                           pTargetMax)) {
+    return false;
+  }
+  world_shape box = box_shape(pMin, pMax);
+  // Moving along a surface after sliding on it leaves rounding errors in
+  // the direction of its normal, which aren't moving into it
+  float along = CONTACT_EPSILON * glm::length(pDisplacement);
+  bool found = false;
+  for (const auto &shape : *pShapes) {
+    float time;
+    glm::vec3 normal;
+    float depth;
+    if (penetration(box, shape, normal, depth)) {
+      if (depth > CONTACT_EPSILON ||
+          glm::dot(pDisplacement, normal) >= -along) {
+        continue;
+      }
+      time = 0.0f;
+    } else if (!sweep(box, shape, pDisplacement, time, normal)) {
+      continue;
+    }
+    if (!found || time < pTime) {
+      pTime = time;
+      pNormal = normal;
+      found = true;
+    }
+  }
+  return found;
+}
+} // namespace
+
 collision::collision(const glm::vec3 &pMin, const glm::vec3 &pMax)
     : mMin(pMin), mMax(pMax) {}
+collision::collision(std::vector<collision_shape> pShapes) {
+  this->shapes(std::move(pShapes));
+}
 
 glm::vec3 &collision::min() { return this->mMin; }
 void collision::min(const glm::vec3 &pValue) { this->mMin = pValue; }
@@ -21,79 +243,1296 @@ void collision::empty() {
   this->mMin = glm::vec3(0.0f);
   this->mMax = glm::vec3(0.0f);
 }
+const std::vector<collision_shape> &collision::shapes() const {
+  return this->mShapes;
+}
+void collision::shapes(std::vector<collision_shape> pShapes) {
+  this->mShapes = std::move(pShapes);
+  if (this->mShapes.empty()) {
+    return;
+  }
+  this->mShapes[0].bounds(this->mMin, this->mMax);
+  for (const auto &shape : this->mShapes) {
+    glm::vec3 shapeMin;
+    glm::vec3 shapeMax;
+    shape.bounds(shapeMin, shapeMax);
+    this->mMin = glm::min(this->mMin, shapeMin);
+    this->mMax = glm::max(this->mMax, shapeMax);
+  }
+}
+std::uint32_t collision::layer() const { return this->mLayer; }
+void collision::layer(std::uint32_t pValue) { this->mLayer = pValue; }
+std::uint32_t collision::mask() const { return this->mMask; }
+void collision::mask(std::uint32_t pValue) { this->mMask = pValue; }
+bool collision::trigger() const { return this->mTrigger; }
+void collision::trigger(bool pValue) { this->mTrigger = pValue; }
+const glm::vec3 &collision::world_min() const { return this->mWorldMin; }
+const glm::vec3 &collision::world_max() const { return this->mWorldMax; }
 
 glm::vec3 &physics::force() { return this->mForce; }
 glm::vec3 &physics::velocity() { return this->mVelocity; }
 int &physics::on_ground() { return this->mOnGround; }
+bool physics::sleeping() const { return this->mSleeping; }
 
 physics_system::physics_system()
     : mGravity(glm::vec3(0.0f, -20.0f, 0.0f)),
-      mFriction(glm::vec3(0.1f, 0.1f, 0.1f)) {}
+      mFriction(glm::vec3(0.1f, 0.1f, 0.1f)), mSleepVelocity(0.1f),
+      mSleepTicks(60) {}
+
+void physics_system::init(entt::registry &pRegistry) {
+  pRegistry.on_construct<collision>().connect<&physics_system::on_construct>(
+      *this);
+  pRegistry.on_update<collision>().connect<&physics_system::on_update>(*this);
+  pRegistry.on_destroy<collision>().connect<&physics_system::on_destroy>(
+      *this);
+  pRegistry.on_construct<physics>()
+      .connect<&physics_system::on_physics_construct>(*this);
+  pRegistry.on_destroy<physics>().connect<&physics_system::on_physics_destroy>(
+      *this);
+  // Also creates the storage, so that queries running on several threads
+  // only ever look it up
+  pRegistry.on_construct<heightfield>()
+      .connect<&physics_system::on_heightfield_change>(*this);
+  pRegistry.on_update<heightfield>()
+      .connect<&physics_system::on_heightfield_change>(*this);
+  pRegistry.on_destroy<heightfield>()
+      .connect<&physics_system::on_heightfield_change>(*this);
+  pRegistry.ctx()
+      .get<transform_system>()
+      .on_changed()
+      .connect<&physics_system::on_transform_changed>(*this);
+  for (auto entity : pRegistry.view<physics>()) {
+    pRegistry.get_or_emplace<transform_snapshot>(entity);
+  }
+}
+
+void physics_system::begin_teardown(entt::registry &pRegistry) {
+  pRegistry.on_destroy<collision>().disconnect<&physics_system::on_destroy>(
+      *this);
+  pRegistry.on_destroy<physics>()
+      .disconnect<&physics_system::on_physics_destroy>(*this);
+}
+
+void physics_system::end_teardown(entt::registry &pRegistry) {
+  this->mBroadphase.clear();
+  this->mStatics.clear();
+  this->mStaticsDirty = false;
+  this->mStaticChanges.clear();
+  this->mMovingStatics.clear();
+  this->mHeightfields.clear();
+  this->mHeightfieldsDirty = false;
+  this->mDirty.clear();
+  this->mBodies.clear();
+  this->mSweeps.clear();
+  this->mContacts.clear();
+  this->mTriggerContacts.clear();
+  this->mMovedTriggers.clear();
+  this->mTargets.clear();
+  this->mIslands.clear();
+  this->mFreeIslands.clear();
+  this->mIslandParents.clear();
+  this->mIslandOf.clear();
+  this->mSleepingContacts.clear();
+  // The bodies of the old scene neither enter nor leave anything anymore
+  this->mTriggerPairs.clear();
+  this->mPreviousTriggerPairs.clear();
+  // Time left over from the old scene would run extra ticks on the new one
+  this->mAccumulator = 0.0f;
+  this->mAlpha = 0.0f;
+  this->mTicks = 0;
+  this->mStats = physics_stats{};
+  pRegistry.on_destroy<collision>().connect<&physics_system::on_destroy>(
+      *this);
+  pRegistry.on_destroy<physics>().connect<&physics_system::on_physics_destroy>(
+      *this);
+}
+
+void physics_system::on_construct(entt::registry &pRegistry,
+                                  entt::entity pEntity) {
+  this->mark_dirty(pEntity, pRegistry.get<collision>(pEntity));
+}
+
+void physics_system::on_update(entt::registry &pRegistry,
+                               entt::entity pEntity) {
+  auto &collisionVal = pRegistry.get<collision>(pEntity);
+  // A resized static collision is baked again rather than treated as moving
+  if (collisionVal.mBaked) {
+    collisionVal.mBaked = false;
+    this->mark_statics_changed(collisionVal.mWorldMin, collisionVal.mWorldMax);
+  }
+  this->mark_dirty(pEntity, collisionVal);
+}
+
+void physics_system::on_destroy(entt::registry &pRegistry,
+                                entt::entity pEntity) {
+  auto &collisionVal = pRegistry.get<collision>(pEntity);
+  if (collisionVal.mBaked) {
+    this->mark_statics_changed(collisionVal.mWorldMin, collisionVal.mWorldMax);
+  }
+  if (collisionVal.mMoving) {
+    std::erase(this->mMovingStatics, pEntity);
+  }
+  this->remove_proxy(collisionVal);
+}
+
+void physics_system::on_heightfield_change(entt::registry &, entt::entity) {
+  // Bodies resting on the field are woken up by the next tick
+  this->mHeightfieldsDirty = true;
+}
+
+void physics_system::on_physics_construct(entt::registry &pRegistry,
+                                          entt::entity pEntity) {
+  // Bodies only move once per tick, so they are drawn from their snapshots
+  pRegistry.get_or_emplace<transform_snapshot>(pEntity);
+  auto collisionVal = pRegistry.try_get<collision>(pEntity);
+  if (collisionVal == nullptr) {
+    return;
+  }
+  if (collisionVal->mBaked) {
+    collisionVal->mBaked = false;
+    this->mark_statics_changed(collisionVal->mWorldMin,
+                               collisionVal->mWorldMax);
+  }
+  // Its proxy stays in the broadphase, now as a body's
+  if (collisionVal->mMoving) {
+    collisionVal->mMoving = false;
+    std::erase(this->mMovingStatics, pEntity);
+  }
+  this->mark_dirty(pEntity, *collisionVal);
+}
+
+void physics_system::on_physics_destroy(entt::registry &pRegistry,
+                                        entt::entity pEntity) {
+  // Whatever rested on the body has lost its support
+  this->wake(pRegistry, pEntity);
+  auto collisionVal = pRegistry.try_get<collision>(pEntity);
+  if (collisionVal == nullptr) {
+    return;
+  }
+  // The collision becomes static once the physics is gone
+  this->remove_proxy(*collisionVal);
+  this->mark_dirty(pEntity, *collisionVal);
+}
+
+void physics_system::on_transform_changed(
+    entt::registry &pRegistry, const std::vector<entt::entity> &pEntities) {
+  for (auto entity : pEntities) {
+    auto collisionVal = pRegistry.try_get<collision>(entity);
+    if (collisionVal != nullptr) {
+      this->mark_dirty(entity, *collisionVal);
+    }
+  }
+}
+
+void physics_system::mark_dirty(entt::entity pEntity,
+                                collision &pCollision) {
+  if (!pCollision.mWorldDirty) {
+    pCollision.mWorldDirty = true;
+    this->mDirty.push_back(pEntity);
+  }
+}
+
+void physics_system::update_bounds(entt::registry &pRegistry) {
+  for (auto entity : this->mDirty) {
+    auto collisionVal = pRegistry.try_get<collision>(entity);
+    if (collisionVal == nullptr) {
+      continue;
+    }
+    auto transformVal = pRegistry.try_get<transform>(entity);
+    if (transformVal == nullptr) {
+      // It is queued again once the transform is attached and propagated
+      collisionVal->mWorldDirty = false;
+      continue;
+    }
+    this->refresh_bounds(pRegistry, entity, *transformVal, *collisionVal);
+  }
+  this->mDirty.clear();
+}
+
+void physics_system::refresh_bounds(entt::registry &pRegistry,
+                                    entt::entity pEntity,
+                                    transform &pTransform,
+                                    collision &pCollision) {
+  const glm::mat4 &matrix = pTransform.matrix_world(pRegistry);
+  glm::vec3 previousMin = pCollision.mWorldMin;
+  glm::vec3 previousMax = pCollision.mWorldMax;
+  pCollision.mWorldShapes.clear();
+  if (pCollision.mShapes.empty()) {
+    world_bounds(matrix, pCollision.mMin, pCollision.mMax,
+                 pCollision.mWorldMin, pCollision.mWorldMax);
+    pCollision.mWorldShapes.push_back(
+        collision_shape::box(pCollision.mMin, pCollision.mMax)
+            .to_world(matrix));
+  } else {
+    for (const auto &shape : pCollision.mShapes) {
+      pCollision.mWorldShapes.push_back(shape.to_world(matrix));
+    }
+    pCollision.mWorldShapes[0].bounds(pCollision.mWorldMin,
+                                      pCollision.mWorldMax);
+    for (const auto &shape : pCollision.mWorldShapes) {
+      glm::vec3 shapeMin;
+      glm::vec3 shapeMax;
+      shape.bounds(shapeMin, shapeMax);
+      pCollision.mWorldMin = glm::min(pCollision.mWorldMin, shapeMin);
+      pCollision.mWorldMax = glm::max(pCollision.mWorldMax, shapeMax);
+    }
+  }
+  pCollision.mAligned = pCollision.mWorldShapes.size() == 1 &&
+                        pCollision.mWorldShapes[0].aligned();
+  pCollision.mWorldDirty = false;
+  if (pCollision.mTrigger) {
+    this->mMovedTriggers.push_back(pEntity);
+  }
+  if (!pCollision.mMoving && !pRegistry.all_of<physics>(pEntity)) {
+    if (!pCollision.mBaked) {
+      // Nothing rests on a trigger, so placing one doesn't wake anything
+      if (pCollision.mTrigger) {
+        this->mStaticsDirty = true;
+      } else {
+        this->mark_statics_changed(pCollision.mWorldMin,
+                                   pCollision.mWorldMax);
+      }
+      return;
+    }
+    // Baking the grid again on every move would be too slow, so the
+    // collision is treated like a physics entity until it stays in place.
+    // The bodies it moves into are woken below.
+    pCollision.mMoving = true;
+    this->mMovingStatics.push_back(pEntity);
+    this->mStaticsDirty = true;
+  }
+  if (pCollision.mMoving) {
+    pCollision.mStillTicks = 0;
+  }
+  if (pCollision.mMoving && !pCollision.mTrigger) {
+    // Both what it moved away from and what it moved into
+    this->wake_touching(pRegistry, previousMin, previousMax);
+    this->wake_touching(pRegistry, pCollision.mWorldMin, pCollision.mWorldMax);
+  }
+  // Moving a proxy is cheap while it stays inside its enlarged box
+  if (pCollision.mProxy == aabb_tree::null_node) {
+    pCollision.mProxy =
+        this->mBroadphase.insert(pEntity, pCollision.mWorldMin,
+                                 pCollision.mWorldMax, pCollision.mLayer);
+  } else {
+    this->mBroadphase.move(pCollision.mProxy, pCollision.mWorldMin,
+                           pCollision.mWorldMax);
+    this->mBroadphase.layers(pCollision.mProxy, pCollision.mLayer);
+  }
+}
+
+void physics_system::remove_proxy(collision &pCollision) {
+  if (pCollision.mProxy != aabb_tree::null_node) {
+    this->mBroadphase.remove(pCollision.mProxy);
+    pCollision.mProxy = aabb_tree::null_node;
+  }
+}
+
+void physics_system::rebuild_statics(entt::registry &pRegistry) {
+  std::vector<static_grid::entry> entries;
+  auto view =
+      pRegistry.view<transform, collision>(entt::exclude<physics>);
+  for (auto [entity, transformVal, collisionVal] : view.each()) {
+    collisionVal.mBaked = !collisionVal.mMoving && !collisionVal.mWorldDirty;
+    if (collisionVal.mBaked) {
+      entries.push_back({entity, collisionVal.mWorldMin,
+                         collisionVal.mWorldMax, collisionVal.mLayer});
+    }
+  }
+  this->mStatics.build(std::move(entries));
+  this->mStaticsDirty = false;
+  // Static collisions may have been removed from under sleeping bodies
+  for (auto [changeMin, changeMax] : this->mStaticChanges) {
+    this->wake_touching(pRegistry, changeMin, changeMax);
+  }
+  this->mStaticChanges.clear();
+}
+
+void physics_system::mark_statics_changed(const glm::vec3 &pMin,
+                                          const glm::vec3 &pMax) {
+  this->mStaticsDirty = true;
+  this->mStaticChanges.push_back({pMin, pMax});
+}
+
+void physics_system::settle_statics(entt::registry &pRegistry) {
+  std::erase_if(this->mMovingStatics, [&](entt::entity pEntity) {
+    auto &collisionVal = pRegistry.get<collision>(pEntity);
+    collisionVal.mStillTicks += 1;
+    if (collisionVal.mStillTicks < this->mSleepTicks) {
+      return false;
+    }
+    // Nothing changes for the bodies around it, so none are woken
+    this->remove_proxy(collisionVal);
+    collisionVal.mMoving = false;
+    this->mStaticsDirty = true;
+    return true;
+  });
+}
+
+thread_pool *physics_system::pool() const { return this->mPool; }
+
+void physics_system::pool(thread_pool *pPool) { this->mPool = pPool; }
+
+float physics_system::tick_rate() const { return this->mTickRate; }
 
-void physics_system::update(game &pGame, float pDelta) {
+void physics_system::tick_rate(float pValue) { this->mTickRate = pValue; }
+
+int physics_system::max_substeps() const { return this->mMaxSubsteps; }
+
+void physics_system::max_substeps(int pValue) { this->mMaxSubsteps = pValue; }
+
+float physics_system::alpha() const { return this->mAlpha; }
+
+int physics_system::ticks() const { return this->mTicks; }
+const physics_stats &physics_system::stats() const { return this->mStats; }
+
+entt::sink<physics_system::trigger_signal> physics_system::on_trigger_enter() {
+  return entt::sink<trigger_signal>{this->mTriggerEnter};
+}
+
+entt::sink<physics_system::trigger_signal> physics_system::on_trigger_exit() {
+  return entt::sink<trigger_signal>{this->mTriggerExit};
+}
+
+void physics_system::update(entt::registry &pRegistry, float pDelta) {
+  auto &transformSys = pRegistry.ctx().get<transform_system>();
+  float tickDelta = 1.0f / this->mTickRate;
+  this->mAccumulator += pDelta;
+  this->mTicks = 0;
+  while (this->mAccumulator >= tickDelta && this->mTicks < this->mMaxSubsteps) {
+    this->step(pRegistry, tickDelta);
+    transformSys.record_snapshots(pRegistry);
+    this->mAccumulator -= tickDelta;
+    this->mTicks += 1;
+  }
+  // When falling behind, drop the time that couldn't be simulated rather than
+  // spending even longer on the next frame catching up
+  if (this->mAccumulator >= tickDelta) {
+    this->mAccumulator = std::fmod(this->mAccumulator, tickDelta);
+  }
+  this->mAlpha = this->mAccumulator / tickDelta;
+}
+
+void physics_system::step(entt::registry &pRegistry, float pDelta) {
   // Update all entities with physics, collision, transform, while testing for
   // collisions with collision, transform entities
-  auto &registry = pGame.registry();
-  auto physicsView = registry.view<transform, collision, physics>();
-  auto collisionView = registry.view<transform, collision>();
+  auto physicsView = pRegistry.view<transform, collision, physics>();
 
   // Update force, velocity of objects first
   for (auto entity : physicsView) {
-    auto &physicsVal = registry.get<physics>(entity);
-    auto &transformVal = registry.get<transform>(entity);
+    auto &physicsVal = pRegistry.get<physics>(entity);
     auto &velocity = physicsVal.velocity();
     auto &force = physicsVal.force();
+    if (physicsVal.mSleeping) {
+      if (force == glm::vec3(0.0f) && velocity == glm::vec3(0.0f)) {
+        continue;
+      }
+      this->wake(pRegistry, entity);
+    }
     force += this->mGravity * pDelta;
     force -=
         glm::sign(velocity) * velocity * velocity * this->mFriction * pDelta;
     velocity += force;
     force = glm::vec3(0.0f);
     physicsVal.on_ground() += 1;
-    // FIXME: This should operate on world positions
-    transformVal.translate(physicsVal.velocity() * pDelta);
   }
 
-  // Check for collisions and resolve it
-  for (auto entity : physicsView) {
-    auto &physicsVal = registry.get<physics>(entity);
-    auto &transformVal = registry.get<transform>(entity);
-    auto &collisionVal = registry.get<collision>(entity);
-    glm::vec3 aPoint = transformVal.matrix_world(registry) *
-                       glm::vec4(collisionVal.min(), 1.0f);
-    glm::vec3 bPoint = transformVal.matrix_world(registry) *
-                       glm::vec4(collisionVal.max(), 1.0f);
-    glm::vec3 minPoint = glm::min(aPoint, bPoint);
-    glm::vec3 maxPoint = glm::max(aPoint, bPoint);
-
-    for (auto target : collisionView) {
-      if (entity == target) {
+  // Bring the world boxes of everything that moved since the last tick up to
+  // date
+  pRegistry.ctx().get<transform_system>().propagate(pRegistry);
+  this->update_bounds(pRegistry);
+  this->settle_statics(pRegistry);
+  if (this->mStaticsDirty) {
+    this->rebuild_statics(pRegistry);
+  }
+  this->mHeightfields.clear();
+  for (auto entity : pRegistry.view<heightfield>()) {
+    this->mHeightfields.push_back(entity);
+  }
+  if (this->mHeightfieldsDirty) {
+    this->wake_all(pRegistry);
+    this->mHeightfieldsDirty = false;
+  }
+
+  this->find_contacts(pRegistry, pDelta);
+  this->resolve_contacts(pRegistry, pDelta);
+  this->update_triggers(pRegistry);
+  this->update_islands(pRegistry);
+}
+
+void physics_system::find_contacts(entt::registry &pRegistry, float pDelta) {
+  // Bodies are always handled in the order of their entity, so the results
+  // don't depend on the storage order or the number of threads.
+  this->mBodies.clear();
+  for (auto entity : pRegistry.view<transform, collision, physics>()) {
+    if (!pRegistry.get<physics>(entity).mSleeping) {
+      this->mBodies.push_back(entity);
+    }
+  }
+  std::sort(this->mBodies.begin(), this->mBodies.end());
+  int numBodies = this->mBodies.size();
+
+  // Enlarge the proxy of each body to cover its whole way, so that two bodies
+  // whose ways cross find each other.
+  this->mSweeps.resize(numBodies);
+  for (int i = 0; i < numBodies; i += 1) {
+    auto &physicsVal = pRegistry.get<physics>(this->mBodies[i]);
+    auto &collisionVal = pRegistry.get<collision>(this->mBodies[i]);
+    glm::vec3 displacement = physicsVal.velocity() * pDelta;
+    auto &sweep = this->mSweeps[i];
+    sweep.first = glm::min(collisionVal.world_min(),
+                           collisionVal.world_min() + displacement);
+    sweep.second = glm::max(collisionVal.world_max(),
+                            collisionVal.world_max() + displacement);
+    if (collisionVal.mProxy != aabb_tree::null_node) {
+      this->mBroadphase.move(collisionVal.mProxy, sweep.first, sweep.second);
+    }
+  }
+
+  // Only the broadphase structures are read from here, so the bodies can be
+  // split across threads, each writing to its own contact buffer.
+  int numBatches = 1;
+  if (this->mPool != nullptr && numBodies >= PARALLEL_THRESHOLD) {
+    numBatches = std::min(this->mPool->size() * 4,
+                          (numBodies + MIN_BATCH_SIZE - 1) / MIN_BATCH_SIZE);
+  }
+  if (static_cast<int>(this->mContactBuffers.size()) < numBatches) {
+    this->mContactBuffers.resize(numBatches);
+  }
+  const auto &collisions = pRegistry.storage<collision>();
+  const auto &bodies = pRegistry.storage<physics>();
+  const auto &fields = pRegistry.storage<heightfield>();
+  auto find_batch = [&](int pBatch) {
+    auto &buffer = this->mContactBuffers[pBatch];
+    buffer.contacts.clear();
+    buffer.triggers.clear();
+    buffer.pairs = 0;
+    int start = static_cast<long long>(numBodies) * pBatch / numBatches;
+    int end = static_cast<long long>(numBodies) * (pBatch + 1) / numBatches;
+    for (int i = start; i < end; i += 1) {
+      entt::entity body = this->mBodies[i];
+      const auto &bodyVal = collisions.get(body);
+      // Triggers with physics move without colliding with anything
+      if (bodyVal.mTrigger) {
         continue;
       }
-      // FIXME: Couldn't it be calculated beforehand? It's expensive
-      auto &transformTarget = registry.get<transform>(target);
-      auto &collisionTarget = registry.get<collision>(target);
-      glm::vec3 aTarget = transformTarget.matrix_world(registry) *
-                          glm::vec4(collisionTarget.min(), 1.0f);
-      glm::vec3 bTarget = transformTarget.matrix_world(registry) *
-                          glm::vec4(collisionTarget.max(), 1.0f);
-      glm::vec3 minTarget = glm::min(aTarget, bTarget);
-      glm::vec3 maxTarget = glm::max(aTarget, bTarget);
-
-      bool collided = true;
-      for (int i = 0; i < 3; ++i) {
-        if (minTarget[i] > maxPoint[i] || minPoint[i] > maxTarget[i]) {
-          collided = false;
-          break;
+      const auto &sweep = this->mSweeps[i];
+      buffer.candidates.clear();
+      // Colliders on layers outside the mask of the body are skipped by the
+      // queries themselves, the other way round is checked here
+      auto add_candidate = [&](entt::entity pTarget) {
+        if (pTarget != body &&
+            (collisions.get(pTarget).mMask & bodyVal.mLayer) != 0) {
+          buffer.candidates.push_back(pTarget);
+        }
+      };
+      this->mStatics.query(sweep.first, sweep.second, bodyVal.mMask,
+                           add_candidate);
+      this->mBroadphase.query(sweep.first, sweep.second, bodyVal.mMask,
+                              add_candidate);
+      buffer.pairs += buffer.candidates.size();
+
+      // Other bodies move during the tick, so only the shapes of colliders
+      // without physics can rule a contact out. Aligned boxes are already
+      // exact, the rest are tested together in the batch.
+      buffer.shapes.clear();
+      buffer.owners.clear();
+      for (int k = 0; k < static_cast<int>(buffer.candidates.size());
+           k += 1) {
+        entt::entity target = buffer.candidates[k];
+        const auto &targetVal = collisions.get(target);
+        if (targetVal.mTrigger) {
+          buffer.triggers.push_back({i, target});
+        } else if (bodies.contains(target)) {
+          buffer.contacts.push_back({i, target});
+        } else if (!aabb_tree::overlaps(targetVal.mWorldMin,
+                                        targetVal.mWorldMax, sweep.first,
+                                        sweep.second)) {
+          continue;
+        } else if (targetVal.mAligned) {
+          buffer.contacts.push_back({i, target});
+        } else {
+          for (const auto &shape : targetVal.mWorldShapes) {
+            buffer.shapes.add(shape, k);
+          }
+        }
+      }
+      buffer.shapes.overlapping(sweep.first, sweep.second, buffer.owners);
+      std::sort(buffer.owners.begin(), buffer.owners.end());
+      buffer.owners.erase(
+          std::unique(buffer.owners.begin(), buffer.owners.end()),
+          buffer.owners.end());
+      for (int owner : buffer.owners) {
+        buffer.contacts.push_back({i, buffer.candidates[owner]});
+      }
+      // The columns are only looked up when resolving
+      for (auto field : this->mHeightfields) {
+        const auto &fieldVal = fields.get(field);
+        if ((fieldVal.layer() & bodyVal.mMask) != 0 &&
+            (fieldVal.mask() & bodyVal.mLayer) != 0 &&
+            aabb_tree::overlaps(fieldVal.min(), fieldVal.max(), sweep.first,
+                                sweep.second)) {
+          buffer.pairs += 1;
+          buffer.contacts.push_back({i, field});
         }
       }
-      if (!collided) {
+    }
+  };
+  if (numBatches > 1) {
+    this->mPool->parallel_for(numBatches, find_batch);
+  } else {
+    find_batch(0);
+  }
+
+  this->mContacts.clear();
+  this->mTriggerContacts.clear();
+  this->mStats.bodies = numBodies;
+  this->mStats.pairs = 0;
+  for (int i = 0; i < numBatches; i += 1) {
+    auto &buffer = this->mContactBuffers[i];
+    this->mStats.pairs += buffer.pairs;
+    this->mContacts.insert(this->mContacts.end(), buffer.contacts.begin(),
+                           buffer.contacts.end());
+    this->mTriggerContacts.insert(this->mTriggerContacts.end(),
+                                  buffer.triggers.begin(),
+                                  buffer.triggers.end());
+  }
+  std::sort(this->mContacts.begin(), this->mContacts.end(),
+            [](const contact &pA, const contact &pB) {
+              if (pA.body != pB.body) {
+                return pA.body < pB.body;
+              }
+              return pA.target < pB.target;
+            });
+  this->mStats.contacts = this->mContacts.size();
+}
+
+void physics_system::resolve_contacts(entt::registry &pRegistry,
+                                      float pDelta) {
+  // Bodies are moved one by one, each seeing where the previous ones ended up
+  std::size_t next = 0;
+  for (int i = 0; i < static_cast<int>(this->mBodies.size()); i += 1) {
+    this->mTargets.clear();
+    for (; next < this->mContacts.size() && this->mContacts[next].body == i;
+         next += 1) {
+      entt::entity target = this->mContacts[next].target;
+      auto collisionTarget = pRegistry.try_get<collision>(target);
+      if (collisionTarget != nullptr && pRegistry.all_of<transform>(target)) {
+        this->mTargets.push_back(
+            {target, collisionTarget->world_min(),
+             collisionTarget->world_max(), pRegistry.try_get<physics>(target),
+             collisionTarget->mAligned ? nullptr
+                                       : &collisionTarget->mWorldShapes});
+      } else if (auto fieldVal = pRegistry.try_get<heightfield>(target)) {
+        const auto &sweep = this->mSweeps[i];
+        fieldVal->query(sweep.first, sweep.second,
+                        [&](const glm::vec3 &pMin, const glm::vec3 &pMax) {
+                          this->mTargets.push_back(
+                              {target, pMin, pMax, nullptr});
+                        });
+      }
+    }
+    this->move_body(pRegistry, this->mBodies[i], pDelta);
+  }
+}
+
+void physics_system::move_body(entt::registry &pRegistry, entt::entity pEntity,
+                               float pDelta) {
+  auto &physicsVal = pRegistry.get<physics>(pEntity);
+  auto &transformVal = pRegistry.get<transform>(pEntity);
+  auto &collisionVal = pRegistry.get<collision>(pEntity);
+  glm::vec3 &velocity = physicsVal.velocity();
+  glm::vec3 displacement = velocity * pDelta;
+  glm::vec3 minPoint = collisionVal.world_min();
+  glm::vec3 maxPoint = collisionVal.world_max();
+
+  glm::vec3 offset(0.0f);
+  // Already overlapping something, e.g. when spawned or squeezed inside it;
+  // as there is no direction it came from, push the body out the shortest
+  // way and stop it from moving further in.
+  // Sleeping bodies are only woken up by something moving into them, not by
+  // bodies resting on them.
+  bool moving = physicsVal.mRestTicks == 0;
+  for (int round = 0; round < MAX_DEPENETRATIONS; round += 1) {
+    glm::vec3 roundMin = minPoint;
+    glm::vec3 roundMax = maxPoint;
+    for (auto &target : this->mTargets) {
+      glm::vec3 normal;
+      float distance = 0.0f;
+      if (!push_out(minPoint, maxPoint, target.min, target.max, target.shapes,
+                    normal, distance)) {
+        continue;
+      }
+      if (moving && target.physicsVal != nullptr) {
+        this->wake(pRegistry, target.entity);
+      }
+      minPoint += normal * distance;
+      maxPoint += normal * distance;
+      velocity -= normal * std::min(glm::dot(velocity, normal), 0.0f);
+      displacement -= normal * std::min(glm::dot(displacement, normal), 0.0f);
+      if (normal.y >= GROUND_NORMAL_Y) {
+        physicsVal.on_ground() = 0;
+      }
+    }
+    if (minPoint == roundMin) {
+      break;
+    }
+    offset += minPoint - roundMin;
+    // The candidates only cover the way of the body, not where it was pushed
+    this->query_targets(pRegistry, pEntity, glm::min(roundMin, minPoint),
+                        glm::max(roundMax, maxPoint));
+  }
+
+  // Move to the earliest hit among all targets, then slide the rest of the
+  // way along it. Each hit takes away the part of the way into the surface,
+  // so three rounds are enough for a corner between three of them.
+  glm::vec3 remaining = displacement;
+  for (int round = 0; round < 3 && remaining != glm::vec3(0.0f); round += 1) {
+    float time = 1.0f;
+    glm::vec3 normal(0.0f);
+    entt::entity hit = entt::null;
+    physics *hitPhysics = nullptr;
+    for (auto &target : this->mTargets) {
+      float targetTime;
+      glm::vec3 targetNormal;
+      if (!sweep_obstacle(minPoint, maxPoint, target.min, target.max,
+                          target.shapes, remaining, targetTime,
+                          targetNormal)) {
         continue;
       }
-      // Collision occurred
-      physicsVal.velocity() = glm::vec3(0.0f);
+      // Ties go to the most vertical surface, so that bodies walking over
+      // the seams between floor tiles don't catch on their sides
+      if (targetTime < time ||
+          (targetTime == time &&
+           std::abs(targetNormal.y) > std::abs(normal.y))) {
+        time = targetTime;
+        normal = targetNormal;
+        hit = target.entity;
+        hitPhysics = target.physicsVal;
+      }
+    }
+    glm::vec3 step = remaining * time;
+    minPoint += step;
+    maxPoint += step;
+    offset += step;
+    if (hit == entt::null) {
+      break;
+    }
+    if (moving && hitPhysics != nullptr) {
+      this->wake(pRegistry, hit);
+    }
+    if (normal.y >= GROUND_NORMAL_Y) {
       physicsVal.on_ground() = 0;
-      float offset = maxTarget.y - minPoint.y;
-      transformVal.translate(glm::vec3(0.0f, offset, 0.0f));
     }
+    remaining -= step;
+    remaining -= normal * glm::dot(remaining, normal);
+    velocity -= normal * glm::dot(velocity, normal);
+  }
+
+  if (glm::length(offset) < this->mSleepVelocity * pDelta) {
+    physicsVal.mRestTicks += 1;
+  } else {
+    physicsVal.mRestTicks = 0;
+  }
+  if (offset != glm::vec3(0.0f)) {
+    // FIXME: This should operate on world positions
+    transformVal.translate(offset);
+  }
+  // Also shrinks the proxy back from the swept box
+  this->refresh_bounds(pRegistry, pEntity, transformVal, collisionVal);
+}
+
+void physics_system::query_targets(entt::registry &pRegistry,
+                                   entt::entity pEntity, const glm::vec3 &pMin,
+                                   const glm::vec3 &pMax) {
+  const auto &bodyVal = pRegistry.get<collision>(pEntity);
+  auto add_target = [&](entt::entity pTarget) {
+    if (pTarget == pEntity) {
+      return;
+    }
+    const auto &targetVal = pRegistry.get<collision>(pTarget);
+    if (targetVal.mTrigger || (targetVal.mMask & bodyVal.mLayer) == 0) {
+      return;
+    }
+    for (const auto &target : this->mTargets) {
+      if (target.entity == pTarget) {
+        return;
+      }
+    }
+    this->mTargets.push_back(
+        {pTarget, targetVal.world_min(), targetVal.world_max(),
+         pRegistry.try_get<physics>(pTarget),
+         targetVal.mAligned ? nullptr : &targetVal.mWorldShapes});
+  };
+  this->mStatics.query(pMin, pMax, bodyVal.mMask, add_target);
+  this->mBroadphase.query(pMin, pMax, bodyVal.mMask, add_target);
+  for (auto field : this->mHeightfields) {
+    const auto &fieldVal = pRegistry.get<heightfield>(field);
+    if ((fieldVal.layer() & bodyVal.mMask) == 0 ||
+        (fieldVal.mask() & bodyVal.mLayer) == 0) {
+      continue;
+    }
+    fieldVal.query(pMin, pMax,
+                   [&](const glm::vec3 &pColumnMin,
+                       const glm::vec3 &pColumnMax) {
+                     this->mTargets.push_back(
+                         {field, pColumnMin, pColumnMax, nullptr});
+                   });
+  }
+}
+
+void physics_system::update_triggers(entt::registry &pRegistry) {
+  std::swap(this->mPreviousTriggerPairs, this->mTriggerPairs);
+  auto &pairs = this->mTriggerPairs;
+  const auto &previous = this->mPreviousTriggerPairs;
+  pairs.clear();
+  auto touches = [](const collision &pBody, const collision &pTrigger) {
+    if (!aabb_tree::overlaps(pBody.world_min(), pBody.world_max(),
+                             pTrigger.world_min(), pTrigger.world_max())) {
+      return false;
+    }
+    // The boxes are exact when both are single aligned boxes
+    if (pBody.mAligned && pTrigger.mAligned) {
+      return true;
+    }
+    for (const auto &bodyShape : pBody.mWorldShapes) {
+      for (const auto &triggerShape : pTrigger.mWorldShapes) {
+        if (overlaps(bodyShape, triggerShape)) {
+          return true;
+        }
+      }
+    }
+    return false;
+  };
+  for (const auto &contactVal : this->mTriggerContacts) {
+    entt::entity body = this->mBodies[contactVal.body];
+    if (touches(pRegistry.get<collision>(body),
+                pRegistry.get<collision>(contactVal.target))) {
+      pairs.push_back({contactVal.target, body});
+    }
+  }
+  // Sleeping bodies are tested against the triggers that moved or appeared
+  // during the tick
+  auto &moved = this->mMovedTriggers;
+  std::sort(moved.begin(), moved.end());
+  moved.erase(std::unique(moved.begin(), moved.end()), moved.end());
+  for (auto trigger : moved) {
+    auto triggerVal = pRegistry.try_get<collision>(trigger);
+    if (triggerVal == nullptr || !triggerVal->mTrigger) {
+      continue;
+    }
+    this->mBroadphase.query(
+        triggerVal->world_min(), triggerVal->world_max(), triggerVal->mMask,
+        [&](entt::entity pBody) {
+          auto physicsVal = pRegistry.try_get<physics>(pBody);
+          if (physicsVal == nullptr || !physicsVal->mSleeping) {
+            return;
+          }
+          const auto &bodyVal = pRegistry.get<collision>(pBody);
+          if (!bodyVal.mTrigger && (bodyVal.mMask & triggerVal->mLayer) != 0 &&
+              touches(bodyVal, *triggerVal)) {
+            pairs.push_back({trigger, pBody});
+          }
+        });
+  }
+  // Other bodies that weren't simulated stay where they were
+  for (const auto &pair : previous) {
+    if (std::binary_search(this->mBodies.begin(), this->mBodies.end(),
+                           pair.second) ||
+        std::binary_search(moved.begin(), moved.end(), pair.first) ||
+        !pRegistry.valid(pair.first) || !pRegistry.valid(pair.second) ||
+        !pRegistry.all_of<collision>(pair.first) ||
+        !pRegistry.get<collision>(pair.first).mTrigger ||
+        !pRegistry.all_of<collision, physics>(pair.second)) {
+      continue;
+    }
+    pairs.push_back(pair);
+  }
+  moved.clear();
+  std::sort(pairs.begin(), pairs.end());
+  pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+  // Both lists are sorted, so one merge finds the pairs only in either
+  std::size_t current = 0;
+  std::size_t old = 0;
+  while (current < pairs.size() || old < previous.size()) {
+    if (old == previous.size() ||
+        (current < pairs.size() && pairs[current] < previous[old])) {
+      this->mTriggerEnter.publish(pRegistry, pairs[current].first,
+                                  pairs[current].second);
+      current += 1;
+    } else if (current == pairs.size() || previous[old] < pairs[current]) {
+      const auto &pair = previous[old];
+      if (pRegistry.valid(pair.first) && pRegistry.valid(pair.second)) {
+        this->mTriggerExit.publish(pRegistry, pair.first, pair.second);
+      }
+      old += 1;
+    } else {
+      current += 1;
+      old += 1;
+    }
+  }
+}
+
+void physics_system::update_islands(entt::registry &pRegistry) {
+  int numBodies = this->mBodies.size();
+  auto &parents = this->mIslandParents;
+  parents.resize(numBodies);
+  for (int i = 0; i < numBodies; i += 1) {
+    parents[i] = i;
+  }
+  auto find = [&](int pIndex) {
+    while (parents[pIndex] != pIndex) {
+      parents[pIndex] = parents[parents[pIndex]];
+      pIndex = parents[pIndex];
+    }
+    return pIndex;
+  };
+
+  // Bodies still touching after moving belong to the same island
+  this->mSleepingContacts.clear();
+  for (const auto &contactVal : this->mContacts) {
+    auto physicsTarget = pRegistry.try_get<physics>(contactVal.target);
+    auto collisionTarget = pRegistry.try_get<collision>(contactVal.target);
+    if (physicsTarget == nullptr || collisionTarget == nullptr) {
+      continue;
+    }
+    auto &collisionVal =
+        pRegistry.get<collision>(this->mBodies[contactVal.body]);
+    if (!aabb_tree::overlaps(
+            collisionVal.world_min() - glm::vec3(ISLAND_MARGIN),
+            collisionVal.world_max() + glm::vec3(ISLAND_MARGIN),
+            collisionTarget->world_min(), collisionTarget->world_max())) {
+      continue;
+    }
+    if (physicsTarget->mSleeping) {
+      this->mSleepingContacts.push_back({contactVal.body, contactVal.target});
+      continue;
+    }
+    auto iter = std::lower_bound(this->mBodies.begin(), this->mBodies.end(),
+                                 contactVal.target);
+    // Bodies woken up during this tick have not been simulated yet
+    if (iter == this->mBodies.end() || *iter != contactVal.target) {
+      continue;
+    }
+    parents[find(contactVal.body)] = find(iter - this->mBodies.begin());
+  }
+
+  // An island may only sleep if all of its bodies rest; mIslandOf holds the
+  // sleeping island of each root, -1 if not sleeping, or -2 if not resting.
+  auto &islandOf = this->mIslandOf;
+  islandOf.assign(numBodies, -1);
+  for (int i = 0; i < numBodies; i += 1) {
+    auto &physicsVal = pRegistry.get<physics>(this->mBodies[i]);
+    if (physicsVal.mRestTicks < this->mSleepTicks) {
+      islandOf[find(i)] = -2;
+    }
+  }
+  for (int i = 0; i < numBodies; i += 1) {
+    int root = find(i);
+    if (islandOf[root] == -2) {
+      continue;
+    }
+    if (islandOf[root] == -1) {
+      if (this->mFreeIslands.empty()) {
+        islandOf[root] = this->mIslands.size();
+        this->mIslands.emplace_back();
+      } else {
+        islandOf[root] = this->mFreeIslands.back();
+        this->mFreeIslands.pop_back();
+      }
+    }
+    auto &physicsVal = pRegistry.get<physics>(this->mBodies[i]);
+    physicsVal.mSleeping = true;
+    physicsVal.mIsland = islandOf[root];
+    physicsVal.mVelocity = glm::vec3(0.0f);
+    this->mIslands[islandOf[root]].push_back(this->mBodies[i]);
+  }
+
+  // Islands falling asleep on top of sleeping ones are merged with them, so
+  // that waking either wakes both.
+  for (const auto &[body, target] : this->mSleepingContacts) {
+    int island = islandOf[find(body)];
+    if (island < 0) {
+      continue;
+    }
+    int other = pRegistry.get<physics>(target).mIsland;
+    if (other == island) {
+      continue;
+    }
+    for (auto entity : this->mIslands[other]) {
+      auto physicsVal = pRegistry.try_get<physics>(entity);
+      if (physicsVal != nullptr && physicsVal->mIsland == other) {
+        physicsVal->mIsland = island;
+        this->mIslands[island].push_back(entity);
+      }
+    }
+    this->mIslands[other].clear();
+    this->mFreeIslands.push_back(other);
+  }
+}
+
+void physics_system::wake(entt::registry &pRegistry, entt::entity pEntity) {
+  auto physicsVal = pRegistry.try_get<physics>(pEntity);
+  if (physicsVal != nullptr && physicsVal->mSleeping) {
+    this->wake_island(pRegistry, physicsVal->mIsland);
+  }
+}
+
+void physics_system::wake_island(entt::registry &pRegistry, int pIsland) {
+  // Destroyed bodies may still be listed, so only wake those still in it
+  for (auto entity : this->mIslands[pIsland]) {
+    auto physicsVal = pRegistry.try_get<physics>(entity);
+    if (physicsVal != nullptr && physicsVal->mIsland == pIsland) {
+      physicsVal->mSleeping = false;
+      physicsVal->mRestTicks = 0;
+      physicsVal->mIsland = -1;
+    }
+  }
+  this->mIslands[pIsland].clear();
+  this->mFreeIslands.push_back(pIsland);
+}
+
+void physics_system::wake_touching(entt::registry &pRegistry,
+                                   const glm::vec3 &pMin,
+                                   const glm::vec3 &pMax) {
+  this->mBroadphase.query(pMin - glm::vec3(ISLAND_MARGIN),
+                          pMax + glm::vec3(ISLAND_MARGIN),
+                          [&](entt::entity pTarget) {
+                            this->wake(pRegistry, pTarget);
+                          });
+}
+
+void physics_system::wake_all(entt::registry &pRegistry) {
+  for (int i = 0; i < static_cast<int>(this->mIslands.size()); i += 1) {
+    if (!this->mIslands[i].empty()) {
+      this->wake_island(pRegistry, i);
+    }
+  }
+}
+
+bool physics_system::cast_shapes(const collision &pTarget,
+                                 const glm::vec3 &pA, const glm::vec3 &pB,
+                                 float pRadius, const glm::vec3 &pDirection,
+                                 float pMaxDistance, float &pDistance,
+                                 glm::vec3 &pNormal) {
+  // The world box bounds the shapes, and is exact for a single aligned box
+  glm::vec3 extent = glm::abs(pB - pA) * 0.5f + glm::vec3(pRadius);
+  if (!cast_against(pTarget.mWorldMin, pTarget.mWorldMax, (pA + pB) * 0.5f,
+                    pDirection, extent, pMaxDistance, pDistance, pNormal)) {
+    return false;
+  }
+  if (pTarget.mAligned && pA == pB && pRadius == 0.0f) {
+    return true;
+  }
+  float distance = pMaxDistance;
+  glm::vec3 normal;
+  bool hit = false;
+  for (const auto &shape : pTarget.mWorldShapes) {
+    float shapeDistance;
+    glm::vec3 shapeNormal;
+    if (cast_capsule(shape, pA, pB, pRadius, pDirection, distance,
+                     shapeDistance, shapeNormal) &&
+        (!hit || shapeDistance < distance)) {
+      distance = shapeDistance;
+      normal = shapeNormal;
+      hit = true;
+    }
+  }
+  if (!hit) {
+    return false;
+  }
+  pDistance = distance;
+  pNormal = normal;
+  return true;
+}
+
+bool physics_system::raycast(entt::registry &pRegistry,
+                             const glm::vec3 &pOrigin,
+                             const glm::vec3 &pDirection, float pMaxDistance,
+                             raycast_hit &pHit, entt::entity pIgnore,
+                             std::uint32_t pMask) {
+  float length = glm::length(pDirection);
+  if (length == 0.0f) {
+    return false;
+  }
+  glm::vec3 direction = pDirection / length;
+  const auto &collisions = pRegistry.storage<collision>();
+  pHit.entity = entt::null;
+  auto test = [&](entt::entity pTarget, float pMax) {
+    if (pTarget == pIgnore || !collisions.contains(pTarget)) {
+      return pMax;
+    }
+    const auto &target = collisions.get(pTarget);
+    if (target.mTrigger || (target.mLayer & pMask) == 0) {
+      return pMax;
+    }
+    float distance;
+    glm::vec3 normal;
+    if (cast_shapes(target, pOrigin, pOrigin, 0.0f, direction, pMax, distance,
+                    normal) &&
+        (pHit.entity == entt::null || distance < pMax)) {
+      pHit.entity = pTarget;
+      pHit.distance = distance;
+      pHit.normal = normal;
+      return distance;
+    }
+    return pMax;
+  };
+  this->mStatics.raycast(pOrigin, direction, pMaxDistance, test);
+  float maxDistance =
+      pHit.entity == entt::null ? pMaxDistance : pHit.distance;
+  this->mBroadphase.raycast(pOrigin, direction, maxDistance, test);
+  this->raycast_heightfields(pRegistry, pOrigin, direction, pMaxDistance, pHit,
+                             pIgnore, pMask);
+  if (pHit.entity == entt::null) {
+    return false;
+  }
+  pHit.point = pOrigin + direction * pHit.distance;
+  return true;
+}
+
+void physics_system::raycast(entt::registry &pRegistry,
+                             const std::vector<ray> &pRays,
+                             std::vector<raycast_hit> &pHits) {
+  int numRays = pRays.size();
+  pHits.assign(numRays, raycast_hit());
+  int numPackets = (numRays + RAY_PACKET_SIZE - 1) / RAY_PACKET_SIZE;
+  auto cast_packet = [&](int pPacket) {
+    int start = pPacket * RAY_PACKET_SIZE;
+    this->raycast_batch(pRegistry, pRays, pHits, start,
+                        std::min(start + RAY_PACKET_SIZE, numRays));
+  };
+  if (this->mPool != nullptr && numPackets > 1) {
+    this->mPool->parallel_for(numPackets, cast_packet);
+  } else {
+    for (int i = 0; i < numPackets; i += 1) {
+      cast_packet(i);
+    }
+  }
+}
+
+void physics_system::raycast_batch(entt::registry &pRegistry,
+                                   const std::vector<ray> &pRays,
+                                   std::vector<raycast_hit> &pHits, int pStart,
+                                   int pEnd) {
+  // Gather the collisions around all the rays once, then test each ray
+  // against them; rays far apart are cast one by one instead.
+  glm::vec3 boundsMin(std::numeric_limits<float>::infinity());
+  glm::vec3 boundsMax(-std::numeric_limits<float>::infinity());
+  std::uint32_t mask = 0;
+  bool bounded = true;
+  for (int i = pStart; i < pEnd; i += 1) {
+    const auto &rayVal = pRays[i];
+    float length = glm::length(rayVal.direction);
+    if (!std::isfinite(rayVal.maxDistance) || length == 0.0f) {
+      bounded = false;
+      break;
+    }
+    glm::vec3 end =
+        rayVal.origin + rayVal.direction / length * rayVal.maxDistance;
+    boundsMin = glm::min(boundsMin, glm::min(rayVal.origin, end));
+    boundsMax = glm::max(boundsMax, glm::max(rayVal.origin, end));
+    mask |= rayVal.mask;
+  }
+  const auto &collisions = pRegistry.storage<collision>();
+  std::vector<entt::entity> candidates;
+  std::size_t maxCandidates = (pEnd - pStart) * 16;
+  if (bounded) {
+    auto add_candidate = [&](entt::entity pTarget) {
+      if (!collisions.get(pTarget).mTrigger) {
+        candidates.push_back(pTarget);
+      }
+    };
+    this->mStatics.query(boundsMin, boundsMax, mask, add_candidate);
+    if (candidates.size() <= maxCandidates) {
+      this->mBroadphase.query(boundsMin, boundsMax, mask, add_candidate);
+    }
+  }
+  if (!bounded || candidates.size() > maxCandidates) {
+    for (int i = pStart; i < pEnd; i += 1) {
+      this->raycast(pRegistry, pRays[i].origin, pRays[i].direction,
+                    pRays[i].maxDistance, pHits[i], pRays[i].ignore,
+                    pRays[i].mask);
+    }
+    return;
+  }
+
+  for (int i = pStart; i < pEnd; i += 1) {
+    const auto &rayVal = pRays[i];
+    auto &hit = pHits[i];
+    glm::vec3 direction = glm::normalize(rayVal.direction);
+    float maxDistance = rayVal.maxDistance;
+    for (auto target : candidates) {
+      if (target == rayVal.ignore || !collisions.contains(target)) {
+        continue;
+      }
+      const auto &targetVal = collisions.get(target);
+      if ((targetVal.mLayer & rayVal.mask) == 0) {
+        continue;
+      }
+      float distance;
+      glm::vec3 normal;
+      if (cast_shapes(targetVal, rayVal.origin, rayVal.origin, 0.0f,
+                      direction, maxDistance, distance, normal) &&
+          (hit.entity == entt::null || distance < maxDistance)) {
+        hit.entity = target;
+        hit.distance = distance;
+        hit.normal = normal;
+        maxDistance = distance;
+      }
+    }
+    this->raycast_heightfields(pRegistry, rayVal.origin, direction,
+                               rayVal.maxDistance, hit, rayVal.ignore,
+                               rayVal.mask);
+    if (hit.entity != entt::null) {
+      hit.point = rayVal.origin + direction * hit.distance;
+    }
+  }
+}
+
+void physics_system::overlap(entt::registry &pRegistry, const glm::vec3 &pMin,
+                             const glm::vec3 &pMax,
+                             std::vector<entt::entity> &pResult) {
+  const auto &collisions = pRegistry.storage<collision>();
+  world_shape box;
+  box.center = (pMin + pMax) * 0.5f;
+  box.extent = (pMax - pMin) * 0.5f;
+  auto add_result = [&](entt::entity pTarget) {
+    // The broadphase only knows the enlarged boxes
+    if (!collisions.contains(pTarget)) {
+      return;
+    }
+    const auto &collisionVal = collisions.get(pTarget);
+    if (!aabb_tree::overlaps(collisionVal.world_min(),
+                             collisionVal.world_max(), pMin, pMax)) {
+      return;
+    }
+    bool touching = collisionVal.mAligned;
+    for (const auto &shape : collisionVal.mWorldShapes) {
+      touching = touching || overlaps(box, shape);
+    }
+    if (touching) {
+      pResult.push_back(pTarget);
+    }
+  };
+  this->mStatics.query(pMin, pMax, add_result);
+  this->mBroadphase.query(pMin, pMax, add_result);
+  for (auto [entity, fieldVal] : pRegistry.view<heightfield>().each()) {
+    bool touched = false;
+    fieldVal.query(pMin, pMax, [&](const glm::vec3 &, const glm::vec3 &) {
+      touched = true;
+    });
+    if (touched) {
+      pResult.push_back(entity);
+    }
+  }
+}
+
+void physics_system::raycast_heightfields(entt::registry &pRegistry,
+                                          const glm::vec3 &pOrigin,
+                                          const glm::vec3 &pDirection,
+                                          float pMaxDistance,
+                                          raycast_hit &pHit,
+                                          entt::entity pIgnore,
+                                          std::uint32_t pMask) {
+  // Only closer hits than the one found so far matter
+  float maxDistance =
+      pHit.entity == entt::null ? pMaxDistance : pHit.distance;
+  for (auto [entity, fieldVal] : pRegistry.view<heightfield>().each()) {
+    float distance;
+    glm::vec3 normal;
+    if (entity != pIgnore && (fieldVal.layer() & pMask) != 0 &&
+        fieldVal.raycast(pOrigin, pDirection, maxDistance, distance,
+                         normal) &&
+        (pHit.entity == entt::null || distance < maxDistance)) {
+      pHit.entity = entity;
+      pHit.distance = distance;
+      pHit.normal = normal;
+      maxDistance = distance;
+    }
+  }
+}
+
+bool physics_system::sphere_cast(entt::registry &pRegistry,
+                                 const glm::vec3 &pCenter, float pRadius,
+                                 const glm::vec3 &pDirection,
+                                 float pMaxDistance, raycast_hit &pHit,
+                                 entt::entity pIgnore, std::uint32_t pMask) {
+  return this->shape_cast(pRegistry, pCenter, pCenter, pRadius, pDirection,
+                          pMaxDistance, pHit, pIgnore, pMask);
+}
+
+bool physics_system::capsule_cast(entt::registry &pRegistry,
+                                  const glm::vec3 &pA, const glm::vec3 &pB,
+                                  float pRadius, const glm::vec3 &pDirection,
+                                  float pMaxDistance, raycast_hit &pHit,
+                                  entt::entity pIgnore, std::uint32_t pMask) {
+  return this->shape_cast(pRegistry, pA, pB, pRadius, pDirection,
+                          pMaxDistance, pHit, pIgnore, pMask);
+}
+
+bool physics_system::shape_cast(entt::registry &pRegistry,
+                                const glm::vec3 &pA, const glm::vec3 &pB,
+                                float pRadius, const glm::vec3 &pDirection,
+                                float pMaxDistance, raycast_hit &pHit,
+                                entt::entity pIgnore, std::uint32_t pMask) {
+  float length = glm::length(pDirection);
+  if (length == 0.0f || !std::isfinite(pMaxDistance)) {
+    return false;
+  }
+  glm::vec3 direction = pDirection / length;
+  glm::vec3 offset = direction * pMaxDistance;
+  glm::vec3 sweptMin = glm::min(glm::min(pA, pB), glm::min(pA, pB) + offset) -
+                       glm::vec3(pRadius);
+  glm::vec3 sweptMax = glm::max(glm::max(pA, pB), glm::max(pA, pB) + offset) +
+                       glm::vec3(pRadius);
+  const auto &collisions = pRegistry.storage<collision>();
+  pHit.entity = entt::null;
+  float maxDistance = pMaxDistance;
+  auto keep = [&](entt::entity pTarget, float pDistance,
+                  const glm::vec3 &pNormal) {
+    if (pHit.entity == entt::null || pDistance < maxDistance) {
+      pHit.entity = pTarget;
+      pHit.distance = pDistance;
+      pHit.normal = pNormal;
+      maxDistance = pDistance;
+    }
+  };
+  auto test = [&](entt::entity pTarget) {
+    if (pTarget == pIgnore || !collisions.contains(pTarget) ||
+        collisions.get(pTarget).mTrigger) {
+      return;
+    }
+    float distance;
+    glm::vec3 normal;
+    if (cast_shapes(collisions.get(pTarget), pA, pB, pRadius, direction,
+                    maxDistance, distance, normal)) {
+      keep(pTarget, distance, normal);
+    }
+  };
+  this->mStatics.query(sweptMin, sweptMax, pMask, test);
+  this->mBroadphase.query(sweptMin, sweptMax, pMask, test);
+  for (auto [entity, fieldVal] : pRegistry.view<heightfield>().each()) {
+    if (entity == pIgnore || (fieldVal.layer() & pMask) == 0) {
+      continue;
+    }
+    fieldVal.query(sweptMin, sweptMax,
+                   [&](const glm::vec3 &pMin, const glm::vec3 &pMax) {
+                     world_shape column;
+                     column.center = (pMin + pMax) * 0.5f;
+                     column.extent = (pMax - pMin) * 0.5f;
+                     float distance;
+                     glm::vec3 normal;
+                     if (cast_capsule(column, pA, pB, pRadius, direction,
+                                      maxDistance, distance, normal)) {
+                       keep(entity, distance, normal);
+                     }
+                   });
+  }
+  if (pHit.entity == entt::null) {
+    return false;
   }
+  pHit.point = (pA + pB) * 0.5f + direction * pHit.distance;
+  return true;
 }
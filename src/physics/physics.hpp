@@ -1,14 +1,27 @@
 #ifndef __PHYSICS_HPP__
 #define __PHYSICS_HPP__
 
+#include "entt/entity/fwd.hpp"
+#include "physics/aabb_tree.hpp"
+#include "physics/heightfield.hpp"
+#include "physics/narrowphase.hpp"
+#include "physics/static_grid.hpp"
+#include "util/thread_pool.hpp"
+#include <cstdint>
+#include <entt/entt.hpp>
 #include <glm/glm.hpp>
+#include <utility>
+#include <vector>
 
 namespace platformer {
-class game;
+class transform;
+class physics_system;
 class collision {
 public:
   collision(){};
   collision(const glm::vec3 &pMin, const glm::vec3 &pMax);
+  // A compound of the given shapes, bounded by the local box around them
+  collision(std::vector<collision_shape> pShapes);
 
   glm::vec3 &min();
   void min(const glm::vec3 &pValue);
@@ -18,9 +31,90 @@ public:
   void expand(glm::vec3 &pValue);
   void empty();
 
+  /**
+   * @brief The exact shapes of the collision. Without any, the local box is
+   * the shape.
+   */
+  const std::vector<collision_shape> &shapes() const;
+  // Replaces the shapes and fits the local box around them
+  void shapes(std::vector<collision_shape> pShapes);
+
+  /**
+   * @brief Layer bits of the collision. Two collisions only interact if each
+   * one's layer shares a bit with the other one's mask.
+   */
+  std::uint32_t layer() const;
+  void layer(std::uint32_t pValue);
+  // Layers the collision interacts with, all of them by default
+  std::uint32_t mask() const;
+  void mask(std::uint32_t pValue);
+  /**
+   * @brief Whether the collision is a trigger volume. Bodies pass through
+   * triggers, which only report them entering and leaving.
+   */
+  bool trigger() const;
+  void trigger(bool pValue);
+
+  /**
+   * @brief The box in world space, cached by physics_system whenever the
+   * transform changes.
+   * @note Call registry.patch<collision>() after changing the local box or
+   * the layers so that the cache is refreshed.
+   */
+  const glm::vec3 &world_min() const;
+  const glm::vec3 &world_max() const;
+
 private:
   glm::vec3 mMin = glm::vec3(-1.0f);
   glm::vec3 mMax = glm::vec3(1.0f);
+  glm::vec3 mWorldMin = glm::vec3(0.0f);
+  glm::vec3 mWorldMax = glm::vec3(0.0f);
+  std::vector<collision_shape> mShapes;
+  // The shapes in world space, cached along with the world box
+  std::vector<world_shape> mWorldShapes;
+  // Whether the world box is exactly the shape, so the narrowphase is skipped
+  bool mAligned = true;
+  std::uint32_t mLayer = 1;
+  std::uint32_t mMask = aabb_tree::all_layers;
+  bool mTrigger = false;
+  // Whether the collision is queued for refreshing its world box
+  bool mWorldDirty = false;
+  // Whether the collision is baked into the static grid
+  bool mBaked = false;
+  // Whether the collision moved even though it has no physics; such
+  // collisions are kept in the broadphase instead of the static grid until
+  // they stay in place for physics_system::mSleepTicks ticks
+  bool mMoving = false;
+  int mStillTicks = 0;
+  // Proxy of the collision in the broadphase, or -1 if not inserted yet
+  int mProxy = aabb_tree::null_node;
+
+  friend physics_system;
+};
+struct ray {
+  glm::vec3 origin;
+  glm::vec3 direction;
+  float maxDistance;
+  entt::entity ignore = entt::null;
+  // Layers the ray hits, like collision::mask()
+  std::uint32_t mask = aabb_tree::all_layers;
+};
+// The closest collision hit by a ray or a shape cast
+struct raycast_hit {
+  entt::entity entity = entt::null;
+  float distance = 0.0f;
+  // Where the ray hit, or where the centre of the cast shape was at the time
+  glm::vec3 point = glm::vec3(0.0f);
+  glm::vec3 normal = glm::vec3(0.0f);
+};
+// Work done by the last tick, for profiling
+struct physics_stats {
+  // Bodies simulated, i.e. awake
+  int bodies = 0;
+  // Pairs of a body and a collider found by the broadphase
+  int pairs = 0;
+  // Pairs kept by the narrowphase and handed to the resolver
+  int contacts = 0;
 };
 class physics {
 public:
@@ -28,6 +122,8 @@ public:
   glm::vec3 &force();
   glm::vec3 &velocity();
   int &on_ground();
+  // Whether the body is at rest and skipped by the simulation
+  bool sleeping() const;
 
 private:
   glm::vec3 mForce = glm::vec3(0.0f);
@@ -35,13 +131,292 @@ private:
   // 0 means on ground, other values means number of frames since the entity
   // started floating
   int mOnGround = 0;
+  // Number of ticks the body has barely moved
+  int mRestTicks = 0;
+  bool mSleeping = false;
+  // Island the body sleeps in, or -1 while awake
+  int mIsland = -1;
+
+  friend physics_system;
 };
+/**
+ * @brief Moves entities with physics and resolves their collisions.
+ *
+ * Collisions without physics are considered static and baked into a uniform
+ * grid. Changes are batched into at most one rebuild per tick, which only
+ * wakes the bodies around the collisions that were added, removed or resized.
+ * A static collision that moves anyway is moved to the broadphase, along with
+ * the collisions of physics entities, and baked again once it stays in place.
+ *
+ * The simulation advances in fixed ticks, however long the frames are. Every
+ * entity with physics gets a transform_snapshot, whose world matrix is
+ * recorded after every tick, so rendering can blend between the last two
+ * ticks using alpha().
+ *
+ * Candidates from the broadphase that have no physics are checked against
+ * their exact shapes before the bodies move, dropping those whose oriented
+ * boxes, spheres or capsules don't actually reach the way of the body.
+ * The body itself is its world box, which is swept against the kept shapes
+ * and slides along their normals, so it rolls off spheres and down the
+ * faces of turned boxes.
+ *
+ * Entities with a heightfield are ground made of many columns. Bodies are
+ * resolved against the columns their way crosses, found by indexing the
+ * field instead of going through the broadphase.
+ *
+ * Collisions are only paired when their layers and masks match, which the
+ * grid and the broadphase check before testing any box. Bodies overlapping a
+ * trigger at the end of a tick are reported through on_trigger_enter() and
+ * on_trigger_exit() instead of being resolved.
+ *
+ * Bodies touching each other form islands, which fall asleep once all their
+ * bodies have rested for mSleepTicks ticks. A sleeping island wakes up when
+ * any of its bodies gets a force or velocity, or is hit by something moving.
+ */
 class physics_system {
 public:
+  // Called with the trigger and the body entering or leaving it
+  typedef entt::sigh<void(entt::registry &, entt::entity, entt::entity)>
+      trigger_signal;
+
   physics_system();
-  void update(game &pGame, float pDelta);
+  void init(entt::registry &pRegistry);
+  /**
+   * @brief Runs as many ticks as the time accumulated so far allows, up to
+   * max_substeps(). Only needs a transform_system in the context of the
+   * registry, so the simulation also runs headless in tests and benchmarks.
+   */
+  void update(entt::registry &pRegistry, float pDelta);
+  // Number of ticks per second
+  float tick_rate() const;
+  void tick_rate(float pValue);
+  /**
+   * @brief The most ticks run by one update(). Time beyond that is dropped,
+   * slowing the simulation down instead of stalling the game.
+   */
+  int max_substeps() const;
+  void max_substeps(int pValue);
+  // How far the accumulated time is into the next tick, from 0 to 1
+  float alpha() const;
+  // Number of ticks run by the last update()
+  int ticks() const;
+  const physics_stats &stats() const;
+  thread_pool *pool() const;
+  /**
+   * @brief Sets the thread pool used to find contacts in parallel, or nullptr
+   * to find them on the calling thread. The results are the same either way.
+   */
+  void pool(thread_pool *pPool);
+  // Wakes the body up, along with every body in its island
+  void wake(entt::registry &pRegistry, entt::entity pEntity);
+  /**
+   * @brief Signal published after a tick that moved a body into a trigger.
+   * Bodies already inside a trigger when either is created also enter it,
+   * and sleeping bodies enter triggers moving onto them without waking up.
+   */
+  entt::sink<trigger_signal> on_trigger_enter();
+  /**
+   * @brief Signal published after a tick that moved a body out of a trigger.
+   * Destroying either of them doesn't publish it.
+   */
+  entt::sink<trigger_signal> on_trigger_exit();
+
+  /**
+   * @brief Finds the closest collision hit by the ray, ignoring pIgnore,
+   * triggers and collisions whose layer isn't in pMask. Collisions are hit
+   * by their shapes. The direction doesn't need to be normalized.
+   * @returns Whether anything was hit.
+   */
+  bool raycast(entt::registry &pRegistry, const glm::vec3 &pOrigin,
+               const glm::vec3 &pDirection, float pMaxDistance,
+               raycast_hit &pHit, entt::entity pIgnore = entt::null,
+               std::uint32_t pMask = aabb_tree::all_layers);
+  /**
+   * @brief Casts many rays at once, filling pHits with one hit per ray; rays
+   * that hit nothing get a null entity. Each ray skips its own ignored
+   * entity and layers like raycast() does. Nearby rays share the broadphase
+   * traversal, and large batches are split across the thread pool.
+   */
+  void raycast(entt::registry &pRegistry, const std::vector<ray> &pRays,
+               std::vector<raycast_hit> &pHits);
+  /**
+   * @brief Collects every collision whose shapes overlap the box, triggers
+   * included.
+   */
+  void overlap(entt::registry &pRegistry, const glm::vec3 &pMin,
+               const glm::vec3 &pMax, std::vector<entt::entity> &pResult);
+  /**
+   * @brief Moves a sphere along the direction, finding the first collision
+   * it hits, with the same filtering as raycast(). The sphere is swept
+   * against the exact shapes, so it slides past the corners of boxes.
+   */
+  bool sphere_cast(entt::registry &pRegistry, const glm::vec3 &pCenter,
+                   float pRadius, const glm::vec3 &pDirection,
+                   float pMaxDistance, raycast_hit &pHit,
+                   entt::entity pIgnore = entt::null,
+                   std::uint32_t pMask = aabb_tree::all_layers);
+  // Same as sphere_cast() for a capsule between pA and pB
+  bool capsule_cast(entt::registry &pRegistry, const glm::vec3 &pA,
+                    const glm::vec3 &pB, float pRadius,
+                    const glm::vec3 &pDirection, float pMaxDistance,
+                    raycast_hit &pHit, entt::entity pIgnore = entt::null,
+                    std::uint32_t pMask = aabb_tree::all_layers);
+  /**
+   * @brief Stops maintaining the broadphase while every collision is
+   * destroyed at once.
+   * @note Must be followed by end_teardown() once the collisions are gone.
+   */
+  void begin_teardown(entt::registry &pRegistry);
+  void end_teardown(entt::registry &pRegistry);
   glm::vec3 mGravity;
   glm::vec3 mFriction;
+  // Bodies moving slower than this, in units per second, are resting
+  float mSleepVelocity;
+  int mSleepTicks;
+
+private:
+  // Below this many bodies, contacts are found on the calling thread
+  static constexpr int PARALLEL_THRESHOLD = 512;
+  static constexpr int MIN_BATCH_SIZE = 64;
+  // Number of rays sharing one broadphase traversal in batched raycasts
+  static constexpr int RAY_PACKET_SIZE = 64;
+
+  // A collider that a body may hit during the tick
+  struct contact {
+    // Index of the body in mBodies
+    int body;
+    entt::entity target;
+  };
+  // Per batch results and scratch of find_contacts()
+  struct contact_buffer {
+    std::vector<contact> contacts;
+    std::vector<contact> triggers;
+    int pairs = 0;
+    std::vector<entt::entity> candidates;
+    shape_batch shapes;
+    std::vector<int> owners;
+  };
+  // A box a body may hit, either a collision or a column of a heightfield
+  struct obstacle {
+    entt::entity entity;
+    glm::vec3 min;
+    glm::vec3 max;
+    // nullptr if the obstacle has no physics
+    physics *physicsVal;
+    // The exact shapes, or nullptr if the box is exact
+    const std::vector<world_shape> *shapes = nullptr;
+  };
+
+  void step(entt::registry &pRegistry, float pDelta);
+  /**
+   * @brief Collects the colliders each body may hit during the tick, in
+   * parallel if a thread pool is set.
+   */
+  void find_contacts(entt::registry &pRegistry, float pDelta);
+  // Moves the bodies one by one in a fixed order, using the found contacts
+  void resolve_contacts(entt::registry &pRegistry, float pDelta);
+  // Publishes the bodies that entered or left triggers during the tick
+  void update_triggers(entt::registry &pRegistry);
+  /**
+   * @brief Moves the body by its velocity up to the earliest time its box
+   * hits the shapes of one of mTargets, then slides the rest of the way
+   * along it, so that it can neither tunnel through thin colliders nor cut
+   * corners.
+   */
+  void move_body(entt::registry &pRegistry, entt::entity pEntity,
+                 float pDelta);
+  // Adds the colliders the body may hit within the box to mTargets
+  void query_targets(entt::registry &pRegistry, entt::entity pEntity,
+                     const glm::vec3 &pMin, const glm::vec3 &pMax);
+  // Puts the islands whose bodies all rest to sleep
+  void update_islands(entt::registry &pRegistry);
+  void wake_island(entt::registry &pRegistry, int pIsland);
+  void wake_touching(entt::registry &pRegistry, const glm::vec3 &pMin,
+                     const glm::vec3 &pMax);
+  void wake_all(entt::registry &pRegistry);
+  /**
+   * @brief Casts the capsule from pA to pB against the shapes of the
+   * collision. It is a sphere when both are the same point, and a ray when
+   * the radius is 0 too.
+   */
+  static bool cast_shapes(const collision &pTarget, const glm::vec3 &pA,
+                          const glm::vec3 &pB, float pRadius,
+                          const glm::vec3 &pDirection, float pMaxDistance,
+                          float &pDistance, glm::vec3 &pNormal);
+  bool shape_cast(entt::registry &pRegistry, const glm::vec3 &pA,
+                  const glm::vec3 &pB, float pRadius,
+                  const glm::vec3 &pDirection, float pMaxDistance,
+                  raycast_hit &pHit, entt::entity pIgnore,
+                  std::uint32_t pMask);
+  void raycast_batch(entt::registry &pRegistry, const std::vector<ray> &pRays,
+                     std::vector<raycast_hit> &pHits, int pStart, int pEnd);
+  // Tests the ray against every heightfield, keeping pHit unless one is closer
+  void raycast_heightfields(entt::registry &pRegistry,
+                            const glm::vec3 &pOrigin,
+                            const glm::vec3 &pDirection, float pMaxDistance,
+                            raycast_hit &pHit, entt::entity pIgnore,
+                            std::uint32_t pMask);
+  void on_construct(entt::registry &pRegistry, entt::entity pEntity);
+  void on_update(entt::registry &pRegistry, entt::entity pEntity);
+  void on_destroy(entt::registry &pRegistry, entt::entity pEntity);
+  void on_physics_construct(entt::registry &pRegistry, entt::entity pEntity);
+  void on_physics_destroy(entt::registry &pRegistry, entt::entity pEntity);
+  void on_heightfield_change(entt::registry &pRegistry, entt::entity pEntity);
+  void on_transform_changed(entt::registry &pRegistry,
+                            const std::vector<entt::entity> &pEntities);
+  void mark_dirty(entt::entity pEntity, collision &pCollision);
+  void update_bounds(entt::registry &pRegistry);
+  void refresh_bounds(entt::registry &pRegistry, entt::entity pEntity,
+                      transform &pTransform, collision &pCollision);
+  void remove_proxy(collision &pCollision);
+  void rebuild_statics(entt::registry &pRegistry);
+  // Queues a rebuild of the grid, waking the bodies in the box once it is done
+  void mark_statics_changed(const glm::vec3 &pMin, const glm::vec3 &pMax);
+  // Bakes the moving collisions that stayed in place long enough back
+  void settle_statics(entt::registry &pRegistry);
+
+  aabb_tree mBroadphase;
+  static_grid mStatics;
+  bool mStaticsDirty = false;
+  // Where static collisions were added, removed or resized since the grid
+  // was last built
+  std::vector<std::pair<glm::vec3, glm::vec3>> mStaticChanges;
+  // Collisions without physics that are currently moving
+  std::vector<entt::entity> mMovingStatics;
+  std::vector<entt::entity> mHeightfields;
+  // Whether a heightfield changed since the last tick
+  bool mHeightfieldsDirty = false;
+  // Collisions whose world box needs to be refreshed
+  std::vector<entt::entity> mDirty;
+  std::vector<entt::entity> mBodies;
+  // Box covering the whole way of each body during the tick
+  std::vector<std::pair<glm::vec3, glm::vec3>> mSweeps;
+  std::vector<contact_buffer> mContactBuffers;
+  std::vector<contact> mContacts;
+  // Triggers each body may overlap by the end of the tick
+  std::vector<contact> mTriggerContacts;
+  // Triggers whose world box was refreshed since the last tick. Sleeping
+  // bodies don't look for triggers, so these look for them instead.
+  std::vector<entt::entity> mMovedTriggers;
+  // Triggers and the bodies inside them, sorted
+  std::vector<std::pair<entt::entity, entt::entity>> mTriggerPairs;
+  std::vector<std::pair<entt::entity, entt::entity>> mPreviousTriggerPairs;
+  trigger_signal mTriggerEnter;
+  trigger_signal mTriggerExit;
+  std::vector<obstacle> mTargets;
+  // Members of each sleeping island; unused islands are empty
+  std::vector<std::vector<entt::entity>> mIslands;
+  std::vector<int> mFreeIslands;
+  std::vector<int> mIslandParents;
+  std::vector<int> mIslandOf;
+  std::vector<std::pair<int, entt::entity>> mSleepingContacts;
+  thread_pool *mPool = nullptr;
+  float mTickRate = 60.0f;
+  int mMaxSubsteps = 8;
+  float mAccumulator = 0.0f;
+  float mAlpha = 0.0f;
+  int mTicks = 0;
+  physics_stats mStats;
 };
 } // namespace platformer
 
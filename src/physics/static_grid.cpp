@@ -0,0 +1,95 @@
+#include "physics/static_grid.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace platformer;
+
+namespace {
+// Upper bound of cells, so that a few huge or far apart boxes cannot blow up
+// the memory used by the grid
+constexpr long long MAX_CELLS = 1 << 22;
+} // namespace
+
+void static_grid::build(std::vector<entry> pEntries) {
+  this->mEntries = std::move(pEntries);
+  this->mCellStarts.clear();
+  this->mCellEntries.clear();
+  if (this->mEntries.empty()) {
+    this->mDims = glm::ivec3(0);
+    return;
+  }
+
+  // Cells about twice the size of an average box keep each box in a handful
+  // of cells while keeping the cells sparse.
+  glm::vec3 boundsMin = this->mEntries[0].min;
+  glm::vec3 boundsMax = this->mEntries[0].max;
+  float totalSize = 0.0f;
+  for (const auto &entryVal : this->mEntries) {
+    boundsMin = glm::min(boundsMin, entryVal.min);
+    boundsMax = glm::max(boundsMax, entryVal.max);
+    glm::vec3 size = entryVal.max - entryVal.min;
+    totalSize += std::max(size.x, std::max(size.y, size.z));
+  }
+  float cellSize = std::max(
+      2.0f * totalSize / static_cast<float>(this->mEntries.size()), 0.01f);
+  glm::vec3 extent = boundsMax - boundsMin;
+  glm::ivec3 dims;
+  while (true) {
+    for (int i = 0; i < 3; i += 1) {
+      dims[i] = std::max(1, static_cast<int>(std::ceil(extent[i] / cellSize)));
+    }
+    if (static_cast<long long>(dims.x) * dims.y * dims.z <= MAX_CELLS) {
+      break;
+    }
+    cellSize *= 2.0f;
+  }
+  this->mOrigin = boundsMin;
+  this->mCellSize = cellSize;
+  this->mDims = dims;
+
+  // Count the entries of each cell, then fill them in one pass
+  int numCells = dims.x * dims.y * dims.z;
+  this->mCellStarts.assign(numCells + 1, 0);
+  auto for_each_cell = [&](const entry &pEntry, auto &&pCallback) {
+    glm::ivec3 minCell = this->cell_of(pEntry.min);
+    glm::ivec3 maxCell = this->cell_of(pEntry.max);
+    for (int z = minCell.z; z <= maxCell.z; z += 1) {
+      for (int y = minCell.y; y <= maxCell.y; y += 1) {
+        for (int x = minCell.x; x <= maxCell.x; x += 1) {
+          pCallback((z * dims.y + y) * dims.x + x);
+        }
+      }
+    }
+  };
+  for (const auto &entryVal : this->mEntries) {
+    for_each_cell(entryVal,
+                  [&](int pCell) { this->mCellStarts[pCell + 1] += 1; });
+  }
+  for (int i = 0; i < numCells; i += 1) {
+    this->mCellStarts[i + 1] += this->mCellStarts[i];
+  }
+  this->mCellEntries.resize(this->mCellStarts[numCells]);
+  std::vector<int> cursors(this->mCellStarts.begin(),
+                           this->mCellStarts.end() - 1);
+  for (int i = 0; i < static_cast<int>(this->mEntries.size()); i += 1) {
+    for_each_cell(this->mEntries[i], [&](int pCell) {
+      this->mCellEntries[cursors[pCell]] = i;
+      cursors[pCell] += 1;
+    });
+  }
+}
+
+void static_grid::clear() { this->build({}); }
+
+std::size_t static_grid::size() const { return this->mEntries.size(); }
+
+glm::ivec3 static_grid::cell_of(const glm::vec3 &pPoint) const {
+  glm::ivec3 cell;
+  for (int i = 0; i < 3; i += 1) {
+    // Clamped before converting, as far away points may not fit in an int
+    float value = std::floor((pPoint[i] - this->mOrigin[i]) / this->mCellSize);
+    cell[i] = static_cast<int>(
+        std::clamp(value, 0.0f, static_cast<float>(this->mDims[i] - 1)));
+  }
+  return cell;
+}
@@ -0,0 +1,165 @@
+#ifndef __STATIC_GRID_HPP__
+#define __STATIC_GRID_HPP__
+
+#include "entt/entity/fwd.hpp"
+#include "physics/aabb_tree.hpp"
+#include <entt/entt.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+#include <vector>
+
+namespace platformer {
+/**
+ * @brief An immutable uniform grid over boxes that never move. It is built
+ * once from every box and must be rebuilt to add or remove any of them, in
+ * exchange for queries that only look at the cells they touch.
+ */
+class static_grid {
+public:
+  struct entry {
+    entt::entity entity;
+    glm::vec3 min;
+    glm::vec3 max;
+    std::uint32_t layers = aabb_tree::all_layers;
+  };
+
+  /**
+   * @brief Replaces the contents of the grid. The cell size is derived from
+   * the size of the boxes.
+   */
+  void build(std::vector<entry> pEntries);
+  void clear();
+  std::size_t size() const;
+
+  /**
+   * @brief Calls pCallback(entity) once for every box that overlaps the given
+   * box. Safe to call from several threads at once.
+   */
+  template <typename Callback>
+  void query(const glm::vec3 &pMin, const glm::vec3 &pMax,
+             Callback &&pCallback) const {
+    this->query(pMin, pMax, aabb_tree::all_layers, pCallback);
+  }
+
+  // Same as above, only for boxes sharing a layer bit with pMask
+  template <typename Callback>
+  void query(const glm::vec3 &pMin, const glm::vec3 &pMax, std::uint32_t pMask,
+             Callback &&pCallback) const {
+    if (this->mEntries.empty()) {
+      return;
+    }
+    glm::ivec3 minCell = this->cell_of(pMin);
+    glm::ivec3 maxCell = this->cell_of(pMax);
+    for (int z = minCell.z; z <= maxCell.z; z += 1) {
+      for (int y = minCell.y; y <= maxCell.y; y += 1) {
+        for (int x = minCell.x; x <= maxCell.x; x += 1) {
+          int cell = (z * this->mDims.y + y) * this->mDims.x + x;
+          for (int i = this->mCellStarts[cell];
+               i < this->mCellStarts[cell + 1]; i += 1) {
+            const auto &entryVal = this->mEntries[this->mCellEntries[i]];
+            if ((entryVal.layers & pMask) == 0 ||
+                !aabb_tree::overlaps(entryVal.min, entryVal.max, pMin, pMax)) {
+              continue;
+            }
+            // Entries spanning several cells are only reported from the
+            // first cell they share with the query
+            glm::ivec3 firstCell = this->cell_of(entryVal.min);
+            if (std::max(firstCell.x, minCell.x) == x &&
+                std::max(firstCell.y, minCell.y) == y &&
+                std::max(firstCell.z, minCell.z) == z) {
+              pCallback(entryVal.entity);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief Walks the cells along the ray in order, calling
+   * pCallback(entity, maxDistance) for each box in them. The callback returns
+   * the new maximum distance, and the walk stops at cells farther than it.
+   * A box spanning several cells may be visited more than once.
+   */
+  template <typename Callback>
+  void raycast(const glm::vec3 &pOrigin, const glm::vec3 &pDirection,
+               float pMaxDistance, Callback &&pCallback) const {
+    if (this->mEntries.empty()) {
+      return;
+    }
+    glm::vec3 gridMax =
+        this->mOrigin + glm::vec3(this->mDims) * this->mCellSize;
+    float enter;
+    int enterAxis;
+    if (!aabb_tree::intersects_ray(pOrigin, pDirection, this->mOrigin,
+                                   gridMax, pMaxDistance, enter, enterAxis)) {
+      return;
+    }
+    // Step from cell to cell through the grid, tracking the distance at
+    // which the ray crosses into the next cell on each axis
+    glm::ivec3 cell = this->cell_of(pOrigin + pDirection * enter);
+    glm::ivec3 step;
+    glm::vec3 next;
+    glm::vec3 delta;
+    for (int i = 0; i < 3; i += 1) {
+      if (pDirection[i] > 0.0f) {
+        step[i] = 1;
+        next[i] = (this->mOrigin[i] + (cell[i] + 1) * this->mCellSize -
+                   pOrigin[i]) /
+                  pDirection[i];
+        delta[i] = this->mCellSize / pDirection[i];
+      } else if (pDirection[i] < 0.0f) {
+        step[i] = -1;
+        next[i] =
+            (this->mOrigin[i] + cell[i] * this->mCellSize - pOrigin[i]) /
+            pDirection[i];
+        delta[i] = -this->mCellSize / pDirection[i];
+      } else {
+        step[i] = 0;
+        next[i] = std::numeric_limits<float>::infinity();
+        delta[i] = std::numeric_limits<float>::infinity();
+      }
+    }
+    float maxDistance = pMaxDistance;
+    while (true) {
+      int index = (cell.z * this->mDims.y + cell.y) * this->mDims.x + cell.x;
+      for (int i = this->mCellStarts[index]; i < this->mCellStarts[index + 1];
+           i += 1) {
+        const auto &entryVal = this->mEntries[this->mCellEntries[i]];
+        maxDistance = pCallback(entryVal.entity, maxDistance);
+      }
+      int axis = 0;
+      if (next[1] < next[axis]) {
+        axis = 1;
+      }
+      if (next[2] < next[axis]) {
+        axis = 2;
+      }
+      if (next[axis] > maxDistance) {
+        break;
+      }
+      cell[axis] += step[axis];
+      if (cell[axis] < 0 || cell[axis] >= this->mDims[axis]) {
+        break;
+      }
+      next[axis] += delta[axis];
+    }
+  }
+
+private:
+  // Returns the cell containing the point, clamped to the grid
+  glm::ivec3 cell_of(const glm::vec3 &pPoint) const;
+
+  std::vector<entry> mEntries;
+  // Entries of each cell are mCellEntries[mCellStarts[i], mCellStarts[i + 1])
+  std::vector<int> mCellStarts;
+  std::vector<int> mCellEntries;
+  glm::vec3 mOrigin{0.0f};
+  float mCellSize = 1.0f;
+  glm::ivec3 mDims{0};
+};
+} // namespace platformer
+
+#endif // __STATIC_GRID_HPP__
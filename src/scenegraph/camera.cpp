@@ -28,8 +28,13 @@ camera_handle::camera_handle(renderer &pRenderer) : mRenderer(pRenderer) {
   }
 }
 
+// The camera is drawn from the same in-between pose as the meshes, in case it
+// is attached to a simulated body
 glm::mat4 camera_handle::view() {
-  return this->mTransform->matrix_world_inverse(this->mRenderer.registry());
+  auto &registry = this->mRenderer.registry();
+  auto &transformSys = registry.ctx().get<transform_system>();
+  return transformSys.matrix_world_interpolated_inverse(
+      registry, this->mRenderer.camera());
 }
 
 glm::mat4 camera_handle::projection() {
@@ -39,7 +44,8 @@ glm::mat4 camera_handle::projection() {
 }
 
 glm::mat4 camera_handle::inverse_view() {
-  return this->mTransform->matrix_world(this->mRenderer.registry());
+  return this->mTransform->matrix_world_interpolated(
+      this->mRenderer.registry());
 }
 
 glm::mat4 camera_handle::inverse_projection() {
@@ -47,5 +53,7 @@ glm::mat4 camera_handle::inverse_projection() {
 }
 
 glm::vec3 camera_handle::view_pos() {
-  return this->mTransform->position_world(this->mRenderer.registry());
+  return glm::vec3(
+      this->mTransform->matrix_world_interpolated(this->mRenderer.registry())
+          [3]);
 }
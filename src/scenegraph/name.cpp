@@ -12,6 +12,15 @@ void name_system::init(entt::registry &pRegistry) {
   pRegistry.on_destroy<name>().connect<&name_system::on_destroy>(*this);
 }
 
+void name_system::begin_teardown(entt::registry &pRegistry) {
+  pRegistry.on_destroy<name>().disconnect<&name_system::on_destroy>(*this);
+}
+
+void name_system::end_teardown(entt::registry &pRegistry) {
+  this->mMap.clear();
+  pRegistry.on_destroy<name>().connect<&name_system::on_destroy>(*this);
+}
+
 entt::entity name_system::get(const std::string &pName) {
   auto &list = this->get_all(pName);
   if (list.size() == 0) {
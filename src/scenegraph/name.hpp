@@ -12,6 +12,12 @@ public:
   void init(entt::registry &pRegistry);
   entt::entity get(const std::string &pName);
   const std::vector<entt::entity> &get_all(const std::string &pName);
+  /**
+   * @brief Stops maintaining the index while every name is destroyed at once.
+   * @note Must be followed by end_teardown() once the names are gone.
+   */
+  void begin_teardown(entt::registry &pRegistry);
+  void end_teardown(entt::registry &pRegistry);
 
 private:
   void on_construct(entt::registry &pRegistry, entt::entity pEntity);
@@ -2,6 +2,7 @@
 #define GLM_ENABLE_EXPERIMENTAL
 #include "entt/entity/fwd.hpp"
 #include "scenegraph/transform.hpp"
+#include "util/simd.hpp"
 #include <cmath>
 #include <glm/ext/matrix_transform.hpp>
 #include <glm/ext/quaternion_common.hpp>
@@ -12,9 +13,130 @@
 #include <glm/gtx/matrix_decompose.hpp>
 #include <glm/matrix.hpp>
 #include <optional>
+#include <type_traits>
 
 using namespace platformer;
 
+// EnTT's paged storage never moves a transform once it is placed, so this
+// isn't needed for stable slots. It keeps transforms safe to copy out as plain
+// bytes, e.g. when uploading them by slot.
+static_assert(std::is_trivially_copyable_v<transform>);
+static_assert(std::is_trivially_copyable_v<transform_node>);
+
+namespace {
+bool is_affine(const glm::mat4 &pMatrix) {
+  return pMatrix[0][3] == 0.0f && pMatrix[1][3] == 0.0f &&
+         pMatrix[2][3] == 0.0f && pMatrix[3][3] == 1.0f;
+}
+
+// Inverts an affine matrix through its upper 3x3 part only. When the columns
+// are orthogonal (rotation and scale without shear), the inverse of that part
+// is its transpose with each row divided by the squared column length.
+glm::mat4 affine_inverse(const glm::mat4 &pMatrix) {
+  glm::mat3 linear(pMatrix);
+  float xx = glm::dot(linear[0], linear[0]);
+  float yy = glm::dot(linear[1], linear[1]);
+  float zz = glm::dot(linear[2], linear[2]);
+  float xy = glm::dot(linear[0], linear[1]);
+  float xz = glm::dot(linear[0], linear[2]);
+  float yz = glm::dot(linear[1], linear[2]);
+  const float epsilon = 1e-5f;
+  glm::mat3 inverse;
+  if (xx > 0.0f && yy > 0.0f && zz > 0.0f &&
+      xy * xy <= epsilon * epsilon * xx * yy &&
+      xz * xz <= epsilon * epsilon * xx * zz &&
+      yz * yz <= epsilon * epsilon * yy * zz) {
+    inverse = glm::transpose(linear);
+    for (int col = 0; col < 3; col += 1) {
+      inverse[col][0] /= xx;
+      inverse[col][1] /= yy;
+      inverse[col][2] /= zz;
+    }
+  } else {
+    inverse = glm::inverse(linear);
+  }
+  glm::mat4 result(inverse);
+  result[3] = glm::vec4(-(inverse * glm::vec3(pMatrix[3])), 1.0f);
+  return result;
+}
+
+// Decomposes an affine matrix into translation, rotation and scale, skipping
+// the perspective and skew handling of glm::decompose.
+void decompose_affine(const glm::mat4 &pMatrix, glm::vec3 &pPosition,
+                      glm::quat &pRotation, glm::vec3 &pScale) {
+  pPosition = glm::vec3(pMatrix[3]);
+  glm::vec3 x = glm::vec3(pMatrix[0]);
+  glm::vec3 y = glm::vec3(pMatrix[1]);
+  glm::vec3 z = glm::vec3(pMatrix[2]);
+  pScale = glm::vec3(glm::length(x), glm::length(y), glm::length(z));
+  if (pScale.x == 0.0f || pScale.y == 0.0f || pScale.z == 0.0f) {
+    pRotation = glm::identity<glm::quat>();
+    return;
+  }
+  // Mirrored matrices are handled like glm::decompose, by negating the scale
+  if (glm::dot(glm::cross(x, y), z) < 0.0f) {
+    pScale = -pScale;
+  }
+  x /= pScale.x;
+  y /= pScale.y;
+  // Re-orthogonalize, in case the parent chain introduced a shear
+  y = glm::normalize(y - x * glm::dot(x, y));
+  pRotation = glm::quat_cast(glm::mat3(x, y, glm::cross(x, y)));
+}
+} // namespace
+
+transform_child_iterator::transform_child_iterator() {}
+transform_child_iterator::transform_child_iterator(entt::registry *pRegistry,
+                                                   entt::entity pEntity)
+    : mRegistry(pRegistry), mEntity(pEntity) {}
+
+transform_child_iterator::reference
+transform_child_iterator::operator*() const {
+  return this->mEntity;
+}
+
+transform_child_iterator::pointer transform_child_iterator::operator->() const {
+  return &this->mEntity;
+}
+
+transform_child_iterator &transform_child_iterator::operator++() {
+  this->mEntity =
+      this->mRegistry->get<transform>(this->mEntity).mNode->mNextSibling;
+  return *this;
+}
+
+transform_child_iterator transform_child_iterator::operator++(int) {
+  auto prev = *this;
+  ++(*this);
+  return prev;
+}
+
+bool transform_child_iterator::operator==(
+    const transform_child_iterator &pOther) const {
+  return this->mEntity == pOther.mEntity;
+}
+
+bool transform_child_iterator::operator!=(
+    const transform_child_iterator &pOther) const {
+  return this->mEntity != pOther.mEntity;
+}
+
+transform_children::transform_children(entt::registry *pRegistry,
+                                       entt::entity pFirst, int pSize)
+    : mRegistry(pRegistry), mFirst(pFirst), mSize(pSize) {}
+
+transform_child_iterator transform_children::begin() const {
+  return transform_child_iterator(this->mRegistry, this->mFirst);
+}
+
+transform_child_iterator transform_children::end() const {
+  return transform_child_iterator(this->mRegistry, entt::null);
+}
+
+std::size_t transform_children::size() const { return this->mSize; }
+
+bool transform_children::empty() const { return this->mSize == 0; }
+
 void transform_system::init(entt::registry &pRegistry) {
   pRegistry.on_construct<transform>().connect<&transform_system::on_construct>(
       *this);
@@ -23,15 +145,560 @@ void transform_system::init(entt::registry &pRegistry) {
       *this);
 };
 
-int transform_system::global_version() const { return this->mGlobalVersion; }
+void transform_system::propagate(entt::registry &pRegistry) {
+  if (this->mOrderDirty) {
+    this->rebuild_order(pRegistry);
+  } else if (this->mPacked) {
+    this->sync_local_matrices();
+  }
+  // Collect the range of each dirty subtree; nested ranges are skipped as
+  // their ancestor's range already covers them.
+  std::vector<int> starts;
+  starts.reserve(this->mDirtyRoots.size());
+  for (auto entity : this->mDirtyRoots) {
+    auto transformVal = pRegistry.try_get<transform>(entity);
+    if (transformVal != nullptr && transformVal->mOrderIndex >= 0) {
+      starts.push_back(transformVal->mOrderIndex);
+    }
+  }
+  this->mDirtyRoots.clear();
+  std::sort(starts.begin(), starts.end());
+  std::vector<std::pair<int, int>> ranges;
+  int coveredEnd = 0;
+  for (auto start : starts) {
+    if (start < coveredEnd) {
+      continue;
+    }
+    int end = start + this->mOrderSizes[start];
+    ranges.push_back({start, end});
+    coveredEnd = end;
+  }
+  if (this->mPool != nullptr && this->mPool->size() > 1) {
+    this->propagate_parallel(ranges);
+  } else {
+    for (auto [start, end] : ranges) {
+      this->propagate_range(start, end);
+    }
+  }
+  // Every transform inside a dirty subtree has changed since the last call,
+  // either here or through a lazy update in between. The ranges are sorted
+  // and disjoint, so the list comes out in hierarchy order without
+  // duplicates.
+  this->mChanged.clear();
+  for (auto [start, end] : ranges) {
+    this->mChanged.insert(this->mChanged.end(),
+                          this->mOrderEntities.begin() + start,
+                          this->mOrderEntities.begin() + end);
+  }
+  if (!this->mChanged.empty()) {
+    this->mChangedSignal.publish(pRegistry, this->mChanged);
+  }
+}
+
+const std::vector<entt::entity> &transform_system::changed() const {
+  return this->mChanged;
+}
+
+entt::sink<transform_system::changed_signal> transform_system::on_changed() {
+  return entt::sink<changed_signal>{this->mChangedSignal};
+}
+
+void transform_system::propagate_range(int pStart, int pEnd) {
+  if (this->mPacked) {
+    this->propagate_packed(pStart, pEnd);
+    return;
+  }
+  // Same as update_world_matrix_from(), without going through the nodes to
+  // find out where the world matrices are stored
+  for (int i = pStart; i < pEnd; i += 1) {
+    auto transformVal = this->mOrder[i];
+    if (!transformVal->mWorldDirty) {
+      continue;
+    }
+    transformVal->update_matrix();
+    int parentIndex = this->mOrderParents[i];
+    if (parentIndex >= 0) {
+      auto parentVal = this->mOrder[parentIndex];
+      mat4_multiply(parentVal->mMatrixWorld, transformVal->mMatrix,
+                    transformVal->mMatrixWorld);
+      transformVal->mWorldAffine =
+          parentVal->mWorldAffine && transformVal->mAffine;
+    } else {
+      transformVal->mMatrixWorld = transformVal->mMatrix;
+      transformVal->mWorldAffine = transformVal->mAffine;
+    }
+    transformVal->mWorldDirty = false;
+    transformVal->mWorldInverseDirty = true;
+    transformVal->mWorldDecompositionDirty = true;
+  }
+}
+
+void transform_system::propagate_packed(int pStart, int pEnd) {
+  // Parents come first, so their world matrices are final by the time the
+  // children read them. The transforms themselves are not touched.
+  const int *parents = this->mOrderParents.data();
+  const glm::mat4 *locals = this->mLocalMatrices.data();
+  glm::mat4 *worlds = this->mWorldMatrices.data();
+  std::uint8_t *flags = this->mOrderFlags.data();
+  for (int i = pStart; i < pEnd; i += 1) {
+    if ((flags[i] & WORLD_DIRTY) == 0) {
+      continue;
+    }
+    std::uint8_t affine = (flags[i] & LOCAL_AFFINE) != 0 ? WORLD_AFFINE : 0;
+    int parentIndex = parents[i];
+    if (parentIndex >= 0) {
+      mat4_multiply(worlds[parentIndex], locals[i], worlds[i]);
+      affine &= flags[parentIndex];
+    } else {
+      worlds[i] = locals[i];
+    }
+    flags[i] = (flags[i] & LOCAL_AFFINE) | affine | INVERSE_DIRTY |
+               DECOMPOSITION_DIRTY;
+  }
+}
+
+void transform_system::sync_local_matrices() {
+  for (auto index : this->mLocalChanged) {
+    auto transformVal = this->mOrder[index];
+    transformVal->update_matrix();
+    transformVal->mLocalQueued = false;
+    this->mLocalMatrices[index] = transformVal->mMatrix;
+    if (transformVal->mAffine) {
+      this->mOrderFlags[index] |= LOCAL_AFFINE;
+    } else {
+      this->mOrderFlags[index] &= ~LOCAL_AFFINE;
+    }
+  }
+  this->mLocalChanged.clear();
+}
 
-void transform_system::update_global_version() { this->mGlobalVersion += 1; }
+void transform_system::propagate_parallel(
+    const std::vector<std::pair<int, int>> &pRanges) {
+  int total = 0;
+  for (auto [start, end] : pRanges) {
+    total += end - start;
+  }
+  if (total < PARALLEL_THRESHOLD) {
+    for (auto [start, end] : pRanges) {
+      this->propagate_range(start, end);
+    }
+    return;
+  }
+  int batchSize = std::max(MIN_BATCH_SIZE, total / (this->mPool->size() * 4));
+  // Subtrees larger than a batch are split into their root, which is updated
+  // right away, and the subtrees of its children. Every piece is then
+  // independent of the others, so the result does not depend on scheduling.
+  std::vector<std::pair<int, int>> pieces;
+  std::vector<std::pair<int, int>> stack(pRanges.rbegin(), pRanges.rend());
+  while (!stack.empty()) {
+    auto [start, end] = stack.back();
+    stack.pop_back();
+    if (end - start <= batchSize) {
+      pieces.push_back({start, end});
+      continue;
+    }
+    this->propagate_range(start, start + 1);
+    for (int child = start + 1; child < end; child += this->mOrderSizes[child]) {
+      stack.push_back({child, child + this->mOrderSizes[child]});
+    }
+  }
+  // Group small pieces together so each task has roughly a batch of work
+  std::vector<int> batches;
+  int accumulated = 0;
+  for (int i = 0; i < static_cast<int>(pieces.size()); i += 1) {
+    if (accumulated == 0) {
+      batches.push_back(i);
+    }
+    accumulated += pieces[i].second - pieces[i].first;
+    if (accumulated >= batchSize) {
+      accumulated = 0;
+    }
+  }
+  batches.push_back(pieces.size());
+  this->mPool->parallel_for(batches.size() - 1, [&](int pBatch) {
+    for (int i = batches[pBatch]; i < batches[pBatch + 1]; i += 1) {
+      this->propagate_range(pieces[i].first, pieces[i].second);
+    }
+  });
+}
+
+thread_pool *transform_system::pool() const { return this->mPool; }
+
+void transform_system::pool(thread_pool *pPool) { this->mPool = pPool; }
+
+void transform_system::reserve(entt::registry &pRegistry,
+                               std::size_t pCapacity) {
+  pRegistry.storage<transform>().reserve(pCapacity);
+  if (this->mNodes.size() < pCapacity) {
+    this->mNodes.resize(pCapacity);
+  }
+}
+
+std::size_t transform_system::slot(entt::registry &pRegistry,
+                                   entt::entity pEntity) const {
+  return pRegistry.storage<transform>().index(pEntity);
+}
+
+void transform_system::record_history(entt::registry &pRegistry) {
+  auto view = pRegistry.view<transform, transform_history>();
+  for (auto [entity, transformVal, history] : view.each()) {
+    auto &world = transformVal.matrix_world(pRegistry);
+    history.mPrevious = history.mRecorded ? history.mCurrent : world;
+    history.mCurrent = world;
+    history.mRecorded = true;
+  }
+}
+
+void transform_system::record_snapshots(entt::registry &pRegistry) {
+  auto view = pRegistry.view<transform, transform_snapshot>();
+  for (auto [entity, transformVal, snapshot] : view.each()) {
+    auto &world = transformVal.matrix_world(pRegistry);
+    snapshot.mPrevious = snapshot.mRecorded ? snapshot.mCurrent : world;
+    snapshot.mCurrent = world;
+    snapshot.mRecorded = true;
+  }
+}
+
+void transform_system::interpolate_snapshots(entt::registry &pRegistry,
+                                             float pAlpha) {
+  if (this->mOrderDirty) {
+    this->rebuild_order(pRegistry);
+  }
+  // Bumping the frame invalidates every matrix of the last call at once
+  this->mInterpolationFrame += 1;
+  std::size_t numSlots = pRegistry.storage<transform>().size();
+  if (this->mInterpolated.size() < numSlots) {
+    this->mInterpolated.resize(numSlots);
+    this->mInterpolatedFrames.resize(numSlots, 0);
+  }
+  this->mSnapshotMarks.assign(this->mOrder.size(), 0);
+  std::vector<int> starts;
+  auto view = pRegistry.view<transform, transform_snapshot>();
+  for (auto [entity, transformVal, snapshot] : view.each()) {
+    int index = transformVal.mOrderIndex;
+    auto slot = this->mOrderSlots[index];
+    // Nothing to blend until the first record
+    this->mInterpolated[slot] = snapshot.mRecorded
+                                    ? snapshot.interpolate(pAlpha)
+                                    : transformVal.matrix_world(pRegistry);
+    this->mInterpolatedFrames[slot] = this->mInterpolationFrame;
+    this->mSnapshotMarks[index] = 1;
+    starts.push_back(index);
+  }
+  // The descendants move rigidly along with the snapshot above them. Parents
+  // come first in the order, so theirs is ready by the time it is read.
+  std::sort(starts.begin(), starts.end());
+  int coveredEnd = 0;
+  for (auto start : starts) {
+    if (start < coveredEnd) {
+      continue;
+    }
+    int end = start + this->mOrderSizes[start];
+    for (int i = start + 1; i < end; i += 1) {
+      if (this->mSnapshotMarks[i] != 0) {
+        continue;
+      }
+      auto slot = this->mOrderSlots[i];
+      auto parentSlot = this->mOrderSlots[this->mOrderParents[i]];
+      mat4_multiply(this->mInterpolated[parentSlot],
+                    this->mOrder[i]->matrix_local(), this->mInterpolated[slot]);
+      this->mInterpolatedFrames[slot] = this->mInterpolationFrame;
+    }
+    coveredEnd = end;
+  }
+}
+
+const glm::mat4 &
+transform_system::matrix_world_interpolated(entt::registry &pRegistry,
+                                            entt::entity pEntity) {
+  auto slot = this->slot(pRegistry, pEntity);
+  if (slot < this->mInterpolatedFrames.size() &&
+      this->mInterpolatedFrames[slot] == this->mInterpolationFrame) {
+    return this->mInterpolated[slot];
+  }
+  return pRegistry.get<transform>(pEntity).matrix_world(pRegistry);
+}
+
+glm::mat4
+transform_system::matrix_world_interpolated_inverse(entt::registry &pRegistry,
+                                                    entt::entity pEntity) {
+  auto slot = this->slot(pRegistry, pEntity);
+  if (slot < this->mInterpolatedFrames.size() &&
+      this->mInterpolatedFrames[slot] == this->mInterpolationFrame) {
+    auto &matrix = this->mInterpolated[slot];
+    return is_affine(matrix) ? affine_inverse(matrix) : glm::inverse(matrix);
+  }
+  // Cached by the transform
+  return pRegistry.get<transform>(pEntity).matrix_world_inverse(pRegistry);
+}
+
+void transform_system::begin_teardown(entt::registry &pRegistry) {
+  // Unlinking each transform from its parent is pointless if all of them are
+  // going away.
+  pRegistry.on_destroy<transform>().disconnect<&transform_system::on_destroy>(
+      *this);
+}
+
+void transform_system::end_teardown(entt::registry &pRegistry) {
+  this->mOrder.clear();
+  this->mOrderEntities.clear();
+  this->mChanged.clear();
+  this->mOrderParents.clear();
+  this->mOrderSizes.clear();
+  this->mDirtyRoots.clear();
+  this->mOrphans.clear();
+  this->mWorldMatrices.clear();
+  this->mLocalMatrices.clear();
+  this->mOrderFlags.clear();
+  this->mLocalChanged.clear();
+  this->mNodes.clear();
+  this->mOrderSlots.clear();
+  this->mInterpolated.clear();
+  this->mInterpolatedFrames.clear();
+  this->mSnapshotMarks.clear();
+  this->mOrderDirty = true;
+  pRegistry.on_destroy<transform>().connect<&transform_system::on_destroy>(
+      *this);
+}
+
+bool transform_system::packed() const { return this->mPacked; }
+
+void transform_system::packed(entt::registry &pRegistry, bool pValue) {
+  if (this->mPacked == pValue) {
+    return;
+  }
+  this->unpack(pRegistry);
+  this->mPacked = pValue;
+  this->mOrderDirty = true;
+}
+
+void transform_system::unpack(entt::registry &pRegistry) {
+  // Move the packed world matrices and flags back into each transform, as
+  // the indices are about to change.
+  for (auto entity : pRegistry.view<transform>()) {
+    auto &transformVal = pRegistry.get<transform>(entity);
+    auto flags = transformVal.packed_flags();
+    if (flags != nullptr) {
+      transformVal.mMatrixWorld =
+          this->mWorldMatrices[transformVal.mOrderIndex];
+      transformVal.mWorldDirty = (*flags & WORLD_DIRTY) != 0;
+      transformVal.mWorldAffine = (*flags & WORLD_AFFINE) != 0;
+      transformVal.mWorldInverseDirty = (*flags & INVERSE_DIRTY) != 0;
+      transformVal.mWorldDecompositionDirty =
+          (*flags & DECOMPOSITION_DIRTY) != 0;
+    }
+    transformVal.mOrderIndex = -1;
+    transformVal.mLocalQueued = false;
+  }
+  this->mWorldMatrices.clear();
+  this->mLocalMatrices.clear();
+  this->mOrderFlags.clear();
+  this->mLocalChanged.clear();
+}
+
+void transform_system::rebuild_order(entt::registry &pRegistry) {
+  auto view = pRegistry.view<transform>();
+  this->unpack(pRegistry);
+  this->mOrder.clear();
+  this->mOrderParents.clear();
+  this->mOrderSizes.clear();
+  this->mOrderEntities.clear();
+  this->mOrderSlots.clear();
+  this->mOrder.reserve(view.size_hint());
+  this->mOrderEntities.reserve(view.size_hint());
+  this->mOrderParents.reserve(view.size_hint());
+  // Walk each root's subtree depth-first; the stack holds (entity, index of
+  // its parent within mOrder).
+  std::vector<std::pair<entt::entity, int>> stack;
+  for (auto entity : view) {
+    auto &transformVal = view.get<transform>(entity);
+    auto &parent = transformVal.parent();
+    if (parent != std::nullopt &&
+        pRegistry.try_get<transform>(parent.value()) != nullptr) {
+      continue;
+    }
+    stack.push_back({entity, -1});
+    while (!stack.empty()) {
+      auto [current, parentIndex] = stack.back();
+      stack.pop_back();
+      auto &currentVal = pRegistry.get<transform>(current);
+      int index = this->mOrder.size();
+      currentVal.mOrderIndex = index;
+      this->mOrder.push_back(&currentVal);
+      this->mOrderEntities.push_back(current);
+      this->mOrderSlots.push_back(this->slot(pRegistry, current));
+      this->mOrderParents.push_back(parentIndex);
+      // Push the children last to first, so that they are popped in order
+      auto child = currentVal.mNode->mLastChild;
+      while (child != entt::null) {
+        stack.push_back({child, index});
+        child = this->node(pRegistry, child).mPrevSibling;
+      }
+    }
+  }
+  // Accumulate subtree sizes from the leaves up; a subtree starting at i
+  // spans [i, i + mOrderSizes[i]).
+  int numTransforms = this->mOrder.size();
+  this->mOrderSizes.assign(numTransforms, 1);
+  for (int i = numTransforms - 1; i > 0; i -= 1) {
+    int parentIndex = this->mOrderParents[i];
+    if (parentIndex >= 0) {
+      this->mOrderSizes[parentIndex] += this->mOrderSizes[i];
+    }
+  }
+  if (this->mPacked) {
+    this->mWorldMatrices.resize(numTransforms);
+    this->mLocalMatrices.resize(numTransforms);
+    this->mOrderFlags.resize(numTransforms);
+    for (int i = 0; i < numTransforms; i += 1) {
+      auto transformVal = this->mOrder[i];
+      transformVal->update_matrix();
+      this->mWorldMatrices[i] = transformVal->mMatrixWorld;
+      this->mLocalMatrices[i] = transformVal->mMatrix;
+      this->mOrderFlags[i] = (transformVal->mWorldDirty ? WORLD_DIRTY : 0) |
+                             (transformVal->mAffine ? LOCAL_AFFINE : 0) |
+                             (transformVal->mWorldAffine ? WORLD_AFFINE : 0) |
+                             (transformVal->mWorldInverseDirty ? INVERSE_DIRTY
+                                                               : 0) |
+                             (transformVal->mWorldDecompositionDirty
+                                  ? DECOMPOSITION_DIRTY
+                                  : 0);
+    }
+  }
+  this->mOrderDirty = false;
+}
+
+void transform_system::mark_dirty(transform &pTransform) {
+  if (pTransform.world_dirty()) {
+    // Already covered by the subtree of a dirty ancestor (or itself)
+    return;
+  }
+  this->mark_subtree_dirty(*pTransform.mNode->mRegistry, pTransform);
+  this->mDirtyRoots.push_back(pTransform.mNode->mEntity);
+}
+
+void transform_system::mark_subtree_dirty(entt::registry &pRegistry,
+                                          transform &pTransform) {
+  int index = pTransform.mOrderIndex;
+  if (this->mPacked && !this->mOrderDirty && index >= 0) {
+    // The subtree is a contiguous range of the order, so there is no need
+    // to chase the child links
+    auto flags = this->mOrderFlags.data();
+    for (int i = index; i < index + this->mOrderSizes[index]; i += 1) {
+      flags[i] |= WORLD_DIRTY;
+    }
+    return;
+  }
+  pTransform.mark_world_dirty();
+  auto child = pTransform.mNode->mFirstChild;
+  while (child != entt::null) {
+    auto &childTransform = pRegistry.get<transform>(child);
+    if (!childTransform.world_dirty()) {
+      this->mark_subtree_dirty(pRegistry, childTransform);
+    }
+    child = childTransform.mNode->mNextSibling;
+  }
+}
+
+void transform_system::mark_local_changed(transform &pTransform) {
+  // Until the order is rebuilt, which copies every local matrix, indices
+  // may be stale
+  if (!this->mPacked || this->mOrderDirty || pTransform.mOrderIndex < 0 ||
+      pTransform.mLocalQueued) {
+    return;
+  }
+  pTransform.mLocalQueued = true;
+  this->mLocalChanged.push_back(pTransform.mOrderIndex);
+}
+
+void transform_system::link_child(entt::registry &pRegistry,
+                                  transform_node &pParent,
+                                  transform_node &pChild) {
+  auto entity = pChild.mEntity;
+  pChild.mPrevSibling = pParent.mLastChild;
+  pChild.mNextSibling = entt::null;
+  if (pParent.mLastChild != entt::null) {
+    this->node(pRegistry, pParent.mLastChild).mNextSibling = entity;
+  } else {
+    pParent.mFirstChild = entity;
+  }
+  pParent.mLastChild = entity;
+  pParent.mNumChildren += 1;
+}
+
+void transform_system::unlink_child(entt::registry &pRegistry,
+                                    transform_node &pParent,
+                                    transform_node &pChild) {
+  if (pChild.mPrevSibling != entt::null) {
+    this->node(pRegistry, pChild.mPrevSibling).mNextSibling =
+        pChild.mNextSibling;
+  } else {
+    pParent.mFirstChild = pChild.mNextSibling;
+  }
+  if (pChild.mNextSibling != entt::null) {
+    this->node(pRegistry, pChild.mNextSibling).mPrevSibling =
+        pChild.mPrevSibling;
+  } else {
+    pParent.mLastChild = pChild.mPrevSibling;
+  }
+  pChild.mPrevSibling = entt::null;
+  pChild.mNextSibling = entt::null;
+  pParent.mNumChildren -= 1;
+}
+
+void transform_system::adopt_orphans(entt::registry &pRegistry,
+                                     transform &pParent) {
+  std::erase_if(this->mOrphans, [&](entt::entity pOrphan) {
+    auto orphanVal = pRegistry.try_get<transform>(pOrphan);
+    if (orphanVal == nullptr || !orphanVal->mNode->mOrphaned) {
+      return true;
+    }
+    if (orphanVal->mNode->mParent != pParent.mNode->mEntity) {
+      return false;
+    }
+    this->link_child(pRegistry, *pParent.mNode, *orphanVal->mNode);
+    orphanVal->mNode->mOrphaned = false;
+    this->mark_subtree_dirty(pRegistry, *orphanVal);
+    this->mDirtyRoots.push_back(pOrphan);
+    return true;
+  });
+}
+
+transform_node &transform_system::node(entt::registry &pRegistry,
+                                       entt::entity pEntity) {
+  return *pRegistry.get<transform>(pEntity).mNode;
+}
 
 void transform_system::on_construct(entt::registry &pRegistry,
                                     entt::entity pEntity) {
   auto &transformVal = pRegistry.get<transform>(pEntity);
-  transformVal.register_registry(&pRegistry);
+  // Read before pointing the transform to its node, in case it was copied
+  // from one that already had a node
+  auto parent = transformVal.parent();
+  std::size_t slot = this->slot(pRegistry, pEntity);
+  if (this->mNodes.size() <= slot) {
+    this->mNodes.resize(slot + 1);
+  }
+  auto &nodeVal = this->mNodes[slot];
+  nodeVal = transform_node{};
+  nodeVal.mParent = parent;
+  nodeVal.mRegistry = &pRegistry;
+  nodeVal.mSystem = this;
+  nodeVal.mEntity = pEntity;
+  transformVal.mNode = &nodeVal;
+  transformVal.mDetachedParent = std::nullopt;
+  // The slot may still hold the interpolated matrix of its last transform
+  if (slot < this->mInterpolatedFrames.size()) {
+    this->mInterpolatedFrames[slot] = 0;
+  }
+  this->mOrderDirty = true;
+  this->mDirtyRoots.push_back(pEntity);
   this->handle_change(pRegistry, pEntity);
+  // Children may have been given this entity as their parent before it had
+  // a transform
+  if (!this->mOrphans.empty()) {
+    this->adopt_orphans(pRegistry, transformVal);
+  }
 }
 void transform_system::on_update(entt::registry &pRegistry,
                                  entt::entity pEntity) {
@@ -39,40 +706,71 @@ void transform_system::on_update(entt::registry &pRegistry,
 }
 void transform_system::on_destroy(entt::registry &pRegistry,
                                   entt::entity pEntity) {
-  auto &transformVal = pRegistry.get<transform>(pEntity);
-  transformVal.mParent = std::nullopt;
+  auto &nodeVal = this->node(pRegistry, pEntity);
+  nodeVal.mParent = std::nullopt;
+  this->mOrderDirty = true;
   this->handle_change(pRegistry, pEntity);
+  // The children become roots of their own, so their world matrices change.
+  // They keep their parent and are linked again if it gets a new transform.
+  auto child = nodeVal.mFirstChild;
+  while (child != entt::null) {
+    auto &childTransform = pRegistry.get<transform>(child);
+    auto &childNode = *childTransform.mNode;
+    auto next = childNode.mNextSibling;
+    childNode.mPrevSibling = entt::null;
+    childNode.mNextSibling = entt::null;
+    childNode.mOrphaned = true;
+    this->mOrphans.push_back(child);
+    this->mark_subtree_dirty(pRegistry, childTransform);
+    this->mDirtyRoots.push_back(child);
+    child = next;
+  }
+  nodeVal.mFirstChild = entt::null;
+  nodeVal.mLastChild = entt::null;
+  nodeVal.mNumChildren = 0;
 }
 void transform_system::handle_change(entt::registry &pRegistry,
                                      entt::entity pEntity) {
   auto &transformVal = pRegistry.get<transform>(pEntity);
-  auto prev_parent = transformVal.mPreviousParent;
-  auto parent = transformVal.parent();
+  auto &nodeVal = *transformVal.mNode;
+  auto prev_parent = nodeVal.mPreviousParent;
+  auto parent = nodeVal.mParent;
   if (prev_parent != parent) {
-    if (prev_parent != std::nullopt) {
+    if (nodeVal.mOrphaned) {
+      // Not linked anywhere; its entry in mOrphans is dropped later
+      nodeVal.mOrphaned = false;
+    } else if (prev_parent != std::nullopt) {
       auto prevTransform = pRegistry.try_get<transform>(prev_parent.value());
       if (prevTransform != nullptr) {
-        prevTransform->mChildren.erase(
-            std::remove(prevTransform->mChildren.begin(),
-                        prevTransform->mChildren.end(), pEntity));
+        this->unlink_child(pRegistry, *prevTransform->mNode, nodeVal);
       }
     }
     if (parent != std::nullopt) {
       auto parentTransform = pRegistry.try_get<transform>(parent.value());
       if (parentTransform != nullptr) {
-        parentTransform->mChildren.push_back(pEntity);
+        this->link_child(pRegistry, *parentTransform->mNode, nodeVal);
+      } else {
+        nodeVal.mOrphaned = true;
+        this->mOrphans.push_back(pEntity);
       }
     }
-    transformVal.mark_parent_indexed();
+    nodeVal.mPreviousParent = parent;
+    // The subtree moves to a different place in the order, so it has to be
+    // listed on its own even if it was already dirty.
+    this->mark_subtree_dirty(pRegistry, transformVal);
+    this->mDirtyRoots.push_back(pEntity);
+    this->mOrderDirty = true;
   }
 }
 
 transform::transform() {};
-transform::transform(const entt::entity &pParent) : mParent(pParent) {};
+transform::transform(const entt::entity &pParent)
+    : mDetachedParent(pParent) {};
 transform::transform(const entt::entity &pParent, const glm::mat4 &pMatrix)
-    : mParent(pParent), mMatrix(pMatrix), mMatrixVersion(1) {};
+    : mMatrix(pMatrix), mMatrixVersion(1), mAffine(is_affine(pMatrix)),
+      mDetachedParent(pParent) {};
 transform::transform(const glm::mat4 &pMatrix)
-    : mMatrix(pMatrix), mMatrixVersion(1) {};
+    : mMatrix(pMatrix), mMatrixVersion(1), mAffine(is_affine(pMatrix)) {};
 
 const glm::vec3 &transform::position() {
   this->update_component();
@@ -116,26 +814,37 @@ void transform::matrix_local(const glm::mat4 &pValue) {
   // TODO: This is unnecessary, as it doesn't need to recalculate matrix values
   this->update_matrix();
   this->mMatrix = pValue;
+  this->mAffine = is_affine(pValue);
   this->mark_matrix_changed();
 }
 
 const std::optional<entt::entity> &transform::parent() const {
-  return this->mParent;
+  if (this->mNode != nullptr) {
+    return this->mNode->mParent;
+  }
+  return this->mDetachedParent;
 }
 
 void transform::parent(const std::optional<entt::entity> &pParent) {
-  this->mParent = pParent;
-  // Reset parent versions to force invalidation
-  this->mWorldParentVersion = -1;
+  if (this->mNode != nullptr) {
+    this->mNode->mParent = pParent;
+  } else {
+    this->mDetachedParent = pParent;
+  }
+  this->mark_world_changed();
 }
 
-const std::vector<entt::entity> &transform::children() const {
-  return this->mChildren;
+transform_children transform::children() const {
+  if (this->mNode == nullptr) {
+    return transform_children(nullptr, entt::null, 0);
+  }
+  return transform_children(this->mNode->mRegistry, this->mNode->mFirstChild,
+                            this->mNode->mNumChildren);
 }
 
 const glm::mat4 &transform::matrix_world(entt::registry &pRegistry) {
   this->update_world_matrix(pRegistry);
-  return this->mMatrixWorld;
+  return this->world_storage();
 }
 
 void transform::matrix_world(entt::registry &pRegistry,
@@ -146,15 +855,7 @@ void transform::matrix_world(entt::registry &pRegistry,
 
 glm::vec3 transform::position_world(entt::registry &pRegistry) {
   this->update_world_matrix(pRegistry);
-  // TODO: This could be optimized.
-  glm::vec3 scale;
-  glm::quat rotation;
-  glm::vec3 position;
-  glm::vec3 skew;
-  glm::vec4 perspective;
-  glm::decompose(this->mMatrixWorld, scale, rotation, position, skew,
-                 perspective);
-  return position;
+  return glm::vec3(this->world_storage()[3]);
 }
 
 void transform::position_world(entt::registry &pRegistry,
@@ -166,15 +867,8 @@ void transform::position_world(entt::registry &pRegistry,
 
 glm::vec3 transform::scale_world(entt::registry &pRegistry) {
   this->update_world_matrix(pRegistry);
-  // TODO: This could be optimized.
-  glm::vec3 scale;
-  glm::quat rotation;
-  glm::vec3 position;
-  glm::vec3 skew;
-  glm::vec4 perspective;
-  glm::decompose(this->mMatrixWorld, scale, rotation, position, skew,
-                 perspective);
-  return scale;
+  this->update_world_decomposition();
+  return this->mScaleWorld;
 }
 
 void transform::scale_world(entt::registry &pRegistry,
@@ -186,15 +880,8 @@ void transform::scale_world(entt::registry &pRegistry,
 
 glm::quat transform::rotation_world(entt::registry &pRegistry) {
   this->update_world_matrix(pRegistry);
-  // TODO: This could be optimized.
-  glm::vec3 scale;
-  glm::quat rotation;
-  glm::vec3 position;
-  glm::vec3 skew;
-  glm::vec4 perspective;
-  glm::decompose(this->mMatrixWorld, scale, rotation, position, skew,
-                 perspective);
-  return rotation;
+  this->update_world_decomposition();
+  return this->mRotationWorld;
 }
 
 void transform::rotation_world(entt::registry &pRegistry,
@@ -217,9 +904,19 @@ void transform::matrix_world_inverse(entt::registry &pRegistry,
   this->matrix_local(parentMat * glm::inverse(pValue));
 }
 
+const glm::mat4 &
+transform::matrix_world_interpolated(entt::registry &pRegistry) {
+  if (this->mNode == nullptr) {
+    return this->matrix_world(pRegistry);
+  }
+  return this->mNode->mSystem->matrix_world_interpolated(pRegistry,
+                                                         this->mNode->mEntity);
+}
+
 void transform::apply_matrix(const glm::mat4 &pValue) {
   this->update_matrix();
   this->mMatrix = pValue * this->mMatrix;
+  this->mAffine = this->mAffine && is_affine(pValue);
   this->mark_matrix_changed();
 }
 
@@ -285,8 +982,9 @@ glm::mat4 MAT4_IDENTITY;
 
 const glm::mat4 &transform::matrix_world_parent(entt::registry &pRegistry) {
   transform *parent = nullptr;
-  if (this->mParent != std::nullopt) {
-    parent = pRegistry.try_get<transform>(this->mParent.value());
+  auto &parentEntity = this->parent();
+  if (parentEntity != std::nullopt) {
+    parent = pRegistry.try_get<transform>(parentEntity.value());
   }
   if (parent != nullptr) {
     return parent->matrix_world(pRegistry);
@@ -298,8 +996,9 @@ const glm::mat4 &transform::matrix_world_parent(entt::registry &pRegistry) {
 const glm::mat4 &
 transform::matrix_world_inverse_parent(entt::registry &pRegistry) {
   transform *parent = nullptr;
-  if (this->mParent != std::nullopt) {
-    parent = pRegistry.try_get<transform>(this->mParent.value());
+  auto &parentEntity = this->parent();
+  if (parentEntity != std::nullopt) {
+    parent = pRegistry.try_get<transform>(parentEntity.value());
   }
   if (parent != nullptr) {
     return parent->matrix_world_inverse(pRegistry);
@@ -310,11 +1009,16 @@ transform::matrix_world_inverse_parent(entt::registry &pRegistry) {
 
 void transform::update_component() {
   if (this->mComponentVersion < this->mMatrixVersion) {
-    glm::vec3 skew;
-    glm::vec4 perspective;
-    glm::decompose(this->mMatrix, this->mScale, this->mRotation,
-                   this->mPosition, skew, perspective);
-    this->mRotation = glm::conjugate(this->mRotation);
+    if (this->mAffine) {
+      decompose_affine(this->mMatrix, this->mPosition, this->mRotation,
+                       this->mScale);
+    } else {
+      glm::vec3 skew;
+      glm::vec4 perspective;
+      glm::decompose(this->mMatrix, this->mScale, this->mRotation,
+                     this->mPosition, skew, perspective);
+      this->mRotation = glm::conjugate(this->mRotation);
+    }
     this->mComponentVersion = this->mMatrixVersion;
   }
 }
@@ -324,70 +1028,181 @@ void transform::update_matrix() {
     this->mMatrix = glm::translate(this->mPosition) *
                     glm::mat4_cast(this->mRotation) * glm::scale(this->mScale);
     this->mMatrixVersion = this->mComponentVersion;
+    this->mAffine = true;
   }
 }
 
 void transform::update_world_matrix(entt::registry &pRegistry) {
-  auto &transformSys = pRegistry.ctx().get<transform_system>();
-  if (transformSys.global_version() == this->mGlobalVersion) {
+  if (!this->world_dirty()) {
     return;
   }
-  this->update_matrix();
   transform *parent = nullptr;
-  if (this->mParent != std::nullopt) {
-    parent = pRegistry.try_get<transform>(this->mParent.value());
+  auto &parentEntity = this->parent();
+  if (parentEntity != std::nullopt) {
+    parent = pRegistry.try_get<transform>(parentEntity.value());
   }
   if (parent != nullptr) {
-    auto &target_matrix = parent->matrix_world(pRegistry);
-    auto &target_version = parent->mWorldVersion;
-    if (this->mMatrixVersion != this->mWorldMatrixVersion ||
-        this->mWorldParentVersion != target_version) {
-      this->mMatrixWorld = target_matrix * this->mMatrix;
-      this->mWorldMatrixVersion = this->mMatrixVersion;
-      this->mWorldParentVersion = target_version;
-      this->mWorldVersion += 1;
-    }
-    this->mGlobalVersion = transformSys.global_version();
+    parent->update_world_matrix(pRegistry);
+  }
+  this->update_world_matrix_from(parent);
+}
+
+void transform::update_world_matrix_from(transform *pParent) {
+  this->update_matrix();
+  auto &world = this->world_storage();
+  bool affine = this->mAffine;
+  if (pParent != nullptr) {
+    mat4_multiply(pParent->world_storage(), this->mMatrix, world);
+    affine = affine && pParent->world_affine();
   } else {
-    if (this->mMatrixVersion != this->mWorldMatrixVersion ||
-        this->mWorldParentVersion != 0) {
-      this->mMatrixWorld = this->mMatrix;
-      this->mWorldMatrixVersion = this->mMatrixVersion;
-      this->mWorldParentVersion = 0;
-      this->mWorldVersion += 1;
-    }
-    this->mGlobalVersion = transformSys.global_version();
+    world = this->mMatrix;
+  }
+  auto flags = this->packed_flags();
+  if (flags != nullptr) {
+    *flags = (*flags & transform_system::LOCAL_AFFINE) |
+             (affine ? transform_system::WORLD_AFFINE : 0) |
+             transform_system::INVERSE_DIRTY |
+             transform_system::DECOMPOSITION_DIRTY;
+  } else {
+    this->mWorldAffine = affine;
+    this->mWorldDirty = false;
+    this->mWorldInverseDirty = true;
+    this->mWorldDecompositionDirty = true;
   }
 }
 
 void transform::update_world_inverse_matrix(entt::registry &pRegistry) {
   this->update_world_matrix(pRegistry);
-  if (this->mWorldVersion != this->mWorldInverseVersion) {
-    this->mMatrixWorldInverse = glm::inverse(this->mMatrixWorld);
-    this->mWorldInverseVersion = this->mWorldVersion;
+  if (this->packed_flag(transform_system::INVERSE_DIRTY,
+                        this->mWorldInverseDirty)) {
+    if (this->world_affine()) {
+      this->mMatrixWorldInverse = affine_inverse(this->world_storage());
+    } else {
+      this->mMatrixWorldInverse = glm::inverse(this->world_storage());
+    }
+    this->set_packed_flag(transform_system::INVERSE_DIRTY,
+                          this->mWorldInverseDirty, false);
+  }
+}
+
+void transform::update_world_decomposition() {
+  if (!this->packed_flag(transform_system::DECOMPOSITION_DIRTY,
+                         this->mWorldDecompositionDirty)) {
+    return;
+  }
+  if (this->world_affine()) {
+    glm::vec3 position;
+    decompose_affine(this->world_storage(), position, this->mRotationWorld,
+                     this->mScaleWorld);
+  } else {
+    glm::vec3 position;
+    glm::vec3 skew;
+    glm::vec4 perspective;
+    glm::decompose(this->world_storage(), this->mScaleWorld,
+                   this->mRotationWorld, position, skew, perspective);
+    this->mRotationWorld = glm::conjugate(this->mRotationWorld);
   }
+  this->set_packed_flag(transform_system::DECOMPOSITION_DIRTY,
+                        this->mWorldDecompositionDirty, false);
+}
+
+glm::mat4 &transform::world_storage() {
+  auto system = this->mNode != nullptr ? this->mNode->mSystem : nullptr;
+  if (system != nullptr && system->mPacked && this->mOrderIndex >= 0) {
+    return system->mWorldMatrices[this->mOrderIndex];
+  }
+  return this->mMatrixWorld;
+}
+
+std::uint8_t *transform::packed_flags() {
+  auto system = this->mNode != nullptr ? this->mNode->mSystem : nullptr;
+  if (system != nullptr && system->mPacked && this->mOrderIndex >= 0) {
+    return &system->mOrderFlags[this->mOrderIndex];
+  }
+  return nullptr;
+}
+
+bool transform::packed_flag(std::uint8_t pBit, bool pUnpacked) {
+  auto flags = this->packed_flags();
+  if (flags != nullptr) {
+    return (*flags & pBit) != 0;
+  }
+  return pUnpacked;
+}
+
+void transform::set_packed_flag(std::uint8_t pBit, bool &pUnpacked,
+                                bool pValue) {
+  auto flags = this->packed_flags();
+  if (flags == nullptr) {
+    pUnpacked = pValue;
+  } else if (pValue) {
+    *flags |= pBit;
+  } else {
+    *flags &= ~pBit;
+  }
+}
+
+bool transform::world_dirty() {
+  return this->packed_flag(transform_system::WORLD_DIRTY, this->mWorldDirty);
+}
+
+bool transform::world_affine() {
+  return this->packed_flag(transform_system::WORLD_AFFINE,
+                           this->mWorldAffine);
+}
+
+void transform::mark_world_dirty() {
+  // The inverse and decomposition go stale when the world matrix is
+  // recomputed, which the packed sweep records in the flags
+  this->set_packed_flag(transform_system::WORLD_DIRTY, this->mWorldDirty,
+                        true);
 }
 
 void transform::mark_component_changed() {
   this->mComponentVersion += 1;
-  auto registry = this->mRegistry;
-  if (registry != nullptr) {
-    auto &transformSys = registry->ctx().get<transform_system>();
-    transformSys.update_global_version();
+  if (this->mNode != nullptr) {
+    this->mNode->mSystem->mark_local_changed(*this);
   }
+  this->mark_world_changed();
 }
 
 void transform::mark_matrix_changed() {
   this->mMatrixVersion += 1;
-  auto registry = this->mRegistry;
-  if (registry != nullptr) {
-    auto &transformSys = registry->ctx().get<transform_system>();
-    transformSys.update_global_version();
+  if (this->mNode != nullptr) {
+    this->mNode->mSystem->mark_local_changed(*this);
+  }
+  this->mark_world_changed();
+}
+
+void transform::mark_world_changed() {
+  if (this->mNode != nullptr) {
+    this->mNode->mSystem->mark_dirty(*this);
+  } else {
+    this->mark_world_dirty();
   }
 }
 
-void transform::mark_parent_indexed() { this->mPreviousParent = this->mParent; }
+const glm::mat4 &transform_history::previous() const { return this->mPrevious; }
+
+const glm::mat4 &transform_history::current() const { return this->mCurrent; }
 
-void transform::register_registry(entt::registry *pRegistry) {
-  this->mRegistry = pRegistry;
+glm::mat4 transform_history::interpolate(float pAlpha) const {
+  if (pAlpha >= 1.0f || this->mPrevious == this->mCurrent) {
+    return this->mCurrent;
+  }
+  if (pAlpha <= 0.0f) {
+    return this->mPrevious;
+  }
+  if (!is_affine(this->mPrevious) || !is_affine(this->mCurrent)) {
+    return this->mCurrent;
+  }
+  // Blending the matrices directly would shear rotations, so blend the
+  // decomposed parts instead.
+  glm::vec3 prevPosition, nextPosition, prevScale, nextScale;
+  glm::quat prevRotation, nextRotation;
+  decompose_affine(this->mPrevious, prevPosition, prevRotation, prevScale);
+  decompose_affine(this->mCurrent, nextPosition, nextRotation, nextScale);
+  return glm::translate(glm::mix(prevPosition, nextPosition, pAlpha)) *
+         glm::mat4_cast(glm::slerp(prevRotation, nextRotation, pAlpha)) *
+         glm::scale(glm::mix(prevScale, nextScale, pAlpha));
 }
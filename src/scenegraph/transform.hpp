@@ -2,32 +2,264 @@
 #define __TRANSFORM_HPP__
 
 #include "entt/entity/fwd.hpp"
+#include "util/simd.hpp"
+#include "util/thread_pool.hpp"
 #include <entt/entt.hpp>
 #include <glm/fwd.hpp>
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
+#include <cstdint>
+#include <deque>
+#include <iterator>
 #include <optional>
 #include <vector>
 
 namespace platformer {
 class transform;
+class transform_child_iterator {
+public:
+  typedef std::forward_iterator_tag iterator_category;
+  typedef entt::entity value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef const entt::entity *pointer;
+  typedef const entt::entity &reference;
+
+  transform_child_iterator();
+  transform_child_iterator(entt::registry *pRegistry, entt::entity pEntity);
+
+  reference operator*() const;
+  pointer operator->() const;
+  transform_child_iterator &operator++();
+  transform_child_iterator operator++(int);
+  bool operator==(const transform_child_iterator &pOther) const;
+  bool operator!=(const transform_child_iterator &pOther) const;
+
+private:
+  entt::registry *mRegistry = nullptr;
+  entt::entity mEntity = entt::null;
+};
+// Range over the children of a transform, in the order they were attached.
+class transform_children {
+public:
+  transform_children(entt::registry *pRegistry, entt::entity pFirst,
+                     int pSize);
+
+  transform_child_iterator begin() const;
+  transform_child_iterator end() const;
+  std::size_t size() const;
+  bool empty() const;
+
+private:
+  entt::registry *mRegistry;
+  entt::entity mFirst;
+  int mSize;
+};
+class transform_system;
+/**
+ * @brief Hierarchy bookkeeping of a transform: its parent, its place among its
+ * siblings and what it belongs to. Only touched when the hierarchy changes, so
+ * it lives apart from the transform, in the transform_system at the same slot.
+ */
+class transform_node {
+private:
+  friend transform;
+  friend transform_system;
+  friend transform_child_iterator;
+  std::optional<entt::entity> mParent = std::nullopt;
+  std::optional<entt::entity> mPreviousParent = std::nullopt;
+  // The children form a doubly linked list through their sibling links, so
+  // that reparenting needs neither allocation nor searching.
+  entt::entity mFirstChild = entt::null;
+  entt::entity mLastChild = entt::null;
+  entt::entity mPrevSibling = entt::null;
+  entt::entity mNextSibling = entt::null;
+  int mNumChildren = 0;
+  // Whether mParent is set but has no transform to link to, in which case
+  // this transform is listed in transform_system::mOrphans
+  bool mOrphaned = false;
+  entt::registry *mRegistry = nullptr;
+  transform_system *mSystem = nullptr;
+  entt::entity mEntity = entt::null;
+};
 class transform_system {
 public:
+  typedef entt::sigh<void(entt::registry &, const std::vector<entt::entity> &)>
+      changed_signal;
+
   void init(entt::registry &pRegistry);
+  /**
+   * @brief Updates the world matrix of every transform in one linear sweep,
+   * visiting parents before their children.
+   * Only the subtrees that were marked dirty since the last call are
+   * visited.
+   * @note This is meant to run once per frame. matrix_world() still resolves
+   * the parent chain lazily if a transform is modified after the sweep.
+   */
+  void propagate(entt::registry &pRegistry);
+
+  /**
+   * @brief Entities whose world matrix changed before the last propagate(),
+   * in hierarchy order (parents before children) and without duplicates.
+   */
+  const std::vector<entt::entity> &changed() const;
+  /**
+   * @brief Signal published at the end of propagate() with the changed()
+   * list, if it is not empty.
+   */
+  entt::sink<changed_signal> on_changed();
 
-  int global_version() const;
-  void update_global_version();
+  bool packed() const;
+  /**
+   * @brief Switches the storage of world matrices. When packed, the world
+   * matrices live in one contiguous, aligned array in hierarchy order instead
+   * of inside each transform.
+   */
+  void packed(entt::registry &pRegistry, bool pValue);
+
+  thread_pool *pool() const;
+  /**
+   * @brief Sets the thread pool used to update disjoint subtrees in parallel,
+   * or nullptr to update everything on the calling thread.
+   */
+  void pool(thread_pool *pPool);
+
+  /**
+   * @brief Preallocates storage for the given number of transforms, so that
+   * spawning up to that many never reallocates.
+   */
+  void reserve(entt::registry &pRegistry, std::size_t pCapacity);
+  /**
+   * @brief Returns the slot of the entity's transform in the storage. Slots
+   * stay the same for as long as the transform exists, so they can be used to
+   * index per-transform data elsewhere, e.g. GPU buffers.
+   * @note The transform storage only holds the local and world state, so its
+   * pages can be read by slot as they are.
+   */
+  std::size_t slot(entt::registry &pRegistry, entt::entity pEntity) const;
+
+  /**
+   * @brief Stops maintaining the hierarchy while every transform is destroyed
+   * at once, e.g. by `registry.clear()`.
+   * @note Must be followed by end_teardown() once the transforms are gone.
+   */
+  void begin_teardown(entt::registry &pRegistry);
+  /**
+   * @brief Drops all hierarchy indexes in one go and resumes maintaining
+   * them.
+   */
+  void end_teardown(entt::registry &pRegistry);
+
+  /**
+   * @brief Shifts the world matrix of each transform with a
+   * transform_history into its history. Call it once per frame, after
+   * propagate().
+   */
+  void record_history(entt::registry &pRegistry);
+  /**
+   * @brief Same as record_history(), for each transform with a
+   * transform_snapshot. Call it once per simulation tick, after propagate().
+   */
+  void record_snapshots(entt::registry &pRegistry);
+  /**
+   * @brief Computes the world matrix to draw each transform with in between
+   * simulation ticks: its transform_snapshot blended by pAlpha, or the one of
+   * its closest ancestor with its own local matrices applied on top, so that
+   * attached children follow along. Call it once per frame, after propagate()
+   * and before rendering.
+   */
+  void interpolate_snapshots(entt::registry &pRegistry, float pAlpha);
+  /**
+   * @brief Result of the last interpolate_snapshots() for the entity, read by
+   * slot. Transforms that follow no snapshot, or were added since, give their
+   * world matrix.
+   */
+  const glm::mat4 &matrix_world_interpolated(entt::registry &pRegistry,
+                                             entt::entity pEntity);
+  /**
+   * @brief Inverse of matrix_world_interpolated(), e.g. for a view matrix.
+   */
+  glm::mat4 matrix_world_interpolated_inverse(entt::registry &pRegistry,
+                                              entt::entity pEntity);
 
 private:
+  // Below this many transforms to update, propagate() stays single threaded
+  static constexpr int PARALLEL_THRESHOLD = 4096;
+  static constexpr int MIN_BATCH_SIZE = 256;
+  // Bits of mOrderFlags
+  static constexpr std::uint8_t WORLD_DIRTY = 1;
+  static constexpr std::uint8_t LOCAL_AFFINE = 2;
+  static constexpr std::uint8_t WORLD_AFFINE = 4;
+  static constexpr std::uint8_t INVERSE_DIRTY = 8;
+  static constexpr std::uint8_t DECOMPOSITION_DIRTY = 16;
+
+  friend transform;
   void on_construct(entt::registry &pRegistry, entt::entity pEntity);
   void on_update(entt::registry &pRegistry, entt::entity pEntity);
   void on_destroy(entt::registry &pRegistry, entt::entity pEntity);
   void handle_change(entt::registry &pRegistry, entt::entity pEntity);
+  void rebuild_order(entt::registry &pRegistry);
+  void propagate_range(int pStart, int pEnd);
+  void propagate_packed(int pStart, int pEnd);
+  void propagate_parallel(const std::vector<std::pair<int, int>> &pRanges);
+  void unpack(entt::registry &pRegistry);
+  void mark_dirty(transform &pTransform);
+  void mark_local_changed(transform &pTransform);
+  void sync_local_matrices();
+  void mark_subtree_dirty(entt::registry &pRegistry, transform &pTransform);
+  void link_child(entt::registry &pRegistry, transform_node &pParent,
+                  transform_node &pChild);
+  void unlink_child(entt::registry &pRegistry, transform_node &pParent,
+                    transform_node &pChild);
+  void adopt_orphans(entt::registry &pRegistry, transform &pParent);
+  transform_node &node(entt::registry &pRegistry, entt::entity pEntity);
 
-  int mGlobalVersion = 0;
+  // Transforms sorted in depth-first order, so that the parent always comes
+  // before its children and each subtree occupies a contiguous range.
+  // Rebuilt whenever the hierarchy changes.
+  std::vector<transform *> mOrder;
+  std::vector<entt::entity> mOrderEntities;
+  std::vector<std::size_t> mOrderSlots;
+  std::vector<int> mOrderParents;
+  std::vector<int> mOrderSizes;
+  bool mOrderDirty = true;
+  // Topmost entities of the subtrees marked dirty since the last propagate().
+  std::vector<entt::entity> mDirtyRoots;
+  // Transforms whose parent entity has no transform yet, or lost it. They
+  // are linked to the parent once it gets one; entries whose transform is no
+  // longer orphaned are dropped along the way.
+  std::vector<entt::entity> mOrphans;
+  std::vector<entt::entity> mChanged;
+  changed_signal mChangedSignal;
+  bool mPacked = false;
+  // When packed, the propagation works on these arrays only, in hierarchy
+  // order next to mOrderParents: each world matrix is the parent's world
+  // matrix times the local matrix at the same index. They hold the world
+  // matrix and flags of every indexed transform; the local matrices are
+  // copies, refreshed before each sweep from the transforms listed in
+  // mLocalChanged (by index).
+  std::vector<glm::mat4, aligned_allocator<glm::mat4, 32>> mWorldMatrices;
+  std::vector<glm::mat4, aligned_allocator<glm::mat4, 32>> mLocalMatrices;
+  std::vector<std::uint8_t> mOrderFlags;
+  std::vector<int> mLocalChanged;
+  // Indexed by slot. A deque so that growing it keeps the nodes in place, as
+  // each transform points to its own.
+  std::deque<transform_node> mNodes;
+  // Indexed by slot. An interpolated matrix is only valid if its frame is
+  // the current mInterpolationFrame; the rest follow no snapshot.
+  std::vector<glm::mat4> mInterpolated;
+  std::vector<unsigned int> mInterpolatedFrames;
+  unsigned int mInterpolationFrame = 0;
+  // Indexed like mOrder, set for transforms with a snapshot of their own
+  std::vector<std::uint8_t> mSnapshotMarks;
+  thread_pool *mPool = nullptr;
 };
 class transform {
 public:
+  // Destroying a transform leaves a hole in the storage that the next one
+  // fills, instead of moving the last transform into it. This keeps pointers
+  // and slots stable for the entity's lifetime.
+  static constexpr auto in_place_delete = true;
+
   transform();
   transform(const entt::entity &pParent);
   transform(const entt::entity &pParent, const glm::mat4 &pMatrix);
@@ -46,11 +278,13 @@ public:
    * @brief Updates the entity's parent to the new parent, or none.
    * @note You're responsible for calling `registry.patch<transform>(entity)`
    * after calling this method, and the transform_system must be
-   * present to use children().
+   * present to use children(). While the parent entity has no transform,
+   * e.g. before it gets one or after it is removed, this transform is a root
+   * and is linked to the parent's next transform.
    * @param pParent The new parent to set.
    */
   void parent(const std::optional<entt::entity> &pParent);
-  const std::vector<entt::entity> &children() const;
+  transform_children children() const;
   // FIXME: Is this a good idea? Arguably this is better than storing a pointer
   // to the registry.
   const glm::mat4 &matrix_world(entt::registry &pRegistry);
@@ -63,6 +297,12 @@ public:
   void rotation_world(entt::registry &pRegistry, const glm::quat &pValue);
   const glm::mat4 &matrix_world_inverse(entt::registry &pRegistry);
   void matrix_world_inverse(entt::registry &pRegistry, const glm::mat4 &pValue);
+  /**
+   * @brief The world matrix to draw the transform with in between simulation
+   * ticks.
+   * @note Reflects the last transform_system::interpolate_snapshots().
+   */
+  const glm::mat4 &matrix_world_interpolated(entt::registry &pRegistry);
 
   void apply_matrix(const glm::mat4 &pValue);
   void translate(const glm::vec3 &pValue);
@@ -76,16 +316,25 @@ public:
 
 protected:
   friend transform_system;
-  void mark_parent_indexed();
-  void register_registry(entt::registry *pRegistry);
+  friend transform_child_iterator;
 
 private:
   void update_component();
   void update_matrix();
   void update_world_matrix(entt::registry &pRegistry);
+  void update_world_matrix_from(transform *pParent);
+  void update_world_decomposition();
+  glm::mat4 &world_storage();
+  std::uint8_t *packed_flags();
+  bool packed_flag(std::uint8_t pBit, bool pUnpacked);
+  void set_packed_flag(std::uint8_t pBit, bool &pUnpacked, bool pValue);
+  bool world_dirty();
+  bool world_affine();
+  void mark_world_dirty();
   void update_world_inverse_matrix(entt::registry &pRegistry);
   void mark_component_changed();
   void mark_matrix_changed();
+  void mark_world_changed();
   const glm::mat4 &matrix_world_parent(entt::registry &pRegistry);
   const glm::mat4 &matrix_world_inverse_parent(entt::registry &pRegistry);
 
@@ -97,21 +346,55 @@ private:
   // version, acting like a dirty flag
   int mComponentVersion = 0;
   int mMatrixVersion = 0;
-  // Since the world matrix has two things to follow (local matrix, parent),
-  // it needs to track both two versions, and manage its own version.
-  // TODO: A simple signal-object could be helpful.
-  int mWorldMatrixVersion = 0;
-  int mWorldParentVersion = 0;
-  int mWorldVersion = 0;
-  int mWorldInverseVersion = 0;
-  int mGlobalVersion = 0;
+  // Whether the matrix has no projective part, which enables cheaper inverse
+  // and decomposition. Matrices built from components always are.
+  bool mAffine = true;
+  bool mWorldAffine = true;
+  // The world matrix is dirty whenever the transform or any of its ancestors
+  // has changed; a dirty transform always has dirty descendants. When packed,
+  // the system's arrays hold the world matrix and the flags below instead.
+  bool mWorldDirty = true;
+  bool mWorldInverseDirty = true;
+  bool mWorldDecompositionDirty = true;
+  // Whether the index is in transform_system::mLocalChanged
+  bool mLocalQueued = false;
+  int mOrderIndex = -1;
   glm::mat4 mMatrixWorld{1.0};
   glm::mat4 mMatrixWorldInverse{1.0};
-  std::optional<entt::entity> mPreviousParent = std::nullopt;
-  std::optional<entt::entity> mParent = std::nullopt;
-  std::vector<entt::entity> mChildren{};
-  entt::registry *mRegistry;
+  glm::vec3 mScaleWorld{1.0};
+  glm::quat mRotationWorld{1.0, 0.0, 0.0, 0.0};
+  // Hierarchy bookkeeping, set once the transform_system picks the transform
+  // up. Until then, the parent is kept here.
+  transform_node *mNode = nullptr;
+  std::optional<entt::entity> mDetachedParent = std::nullopt;
+};
+/**
+ * @brief Opt-in record of an entity's world matrix as of the last two calls
+ * to transform_system::record_history(), i.e. the last two frames, for motion
+ * vectors.
+ */
+class transform_history {
+public:
+  const glm::mat4 &previous() const;
+  const glm::mat4 &current() const;
+  /**
+   * @brief Blends the previous and the current world matrix.
+   * @param pAlpha 0 returns the previous state, 1 the current one.
+   */
+  glm::mat4 interpolate(float pAlpha) const;
+
+private:
+  friend transform_system;
+  glm::mat4 mPrevious{1.0};
+  glm::mat4 mCurrent{1.0};
+  bool mRecorded = false;
 };
+/**
+ * @brief Same record as transform_history, taken by
+ * transform_system::record_snapshots() once per simulation tick, for
+ * rendering in between ticks.
+ */
+class transform_snapshot : public transform_history {};
 } // namespace platformer
 
 #endif // __TRANSFORM_HPP__
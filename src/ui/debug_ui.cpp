@@ -51,5 +51,6 @@ void debug_ui_system::update(game &pGame, float pDelta) {
 
   ImGui::Begin("Perf");
   ImGui::Text("FPS: %.2f", this->mFps);
+  ImGui::Text("Scene change: %.2f ms", pGame.scene_change_time());
   ImGui::End();
 }
@@ -0,0 +1,82 @@
+#include "util/simd.hpp"
+#include <glm/gtc/type_ptr.hpp>
+#if defined(__AVX__) || defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+using namespace platformer;
+
+void platformer::mat4_multiply_scalar(const glm::mat4 &pA, const glm::mat4 &pB,
+                                      glm::mat4 &pOut) {
+  const float *a = glm::value_ptr(pA);
+  const float *b = glm::value_ptr(pB);
+  float result[16];
+  for (int col = 0; col < 4; col += 1) {
+    for (int row = 0; row < 4; row += 1) {
+      result[col * 4 + row] =
+          a[row] * b[col * 4] + a[4 + row] * b[col * 4 + 1] +
+          a[8 + row] * b[col * 4 + 2] + a[12 + row] * b[col * 4 + 3];
+    }
+  }
+  float *out = glm::value_ptr(pOut);
+  for (int i = 0; i < 16; i += 1) {
+    out[i] = result[i];
+  }
+}
+
+#if defined(__AVX__)
+void platformer::mat4_multiply(const glm::mat4 &pA, const glm::mat4 &pB,
+                               glm::mat4 &pOut) {
+  const float *a = glm::value_ptr(pA);
+  const float *b = glm::value_ptr(pB);
+  float *out = glm::value_ptr(pOut);
+  // Each column of A is duplicated in both 128-bit lanes, so that two
+  // columns of the result are computed at once.
+  __m256 a0 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a));
+  __m256 a1 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a + 4));
+  __m256 a2 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a + 8));
+  __m256 a3 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a + 12));
+  __m256 b01 = _mm256_loadu_ps(b);
+  __m256 b23 = _mm256_loadu_ps(b + 8);
+  __m256 r01 = _mm256_mul_ps(a0, _mm256_permute_ps(b01, 0x00));
+  r01 = _mm256_add_ps(r01, _mm256_mul_ps(a1, _mm256_permute_ps(b01, 0x55)));
+  r01 = _mm256_add_ps(r01, _mm256_mul_ps(a2, _mm256_permute_ps(b01, 0xAA)));
+  r01 = _mm256_add_ps(r01, _mm256_mul_ps(a3, _mm256_permute_ps(b01, 0xFF)));
+  __m256 r23 = _mm256_mul_ps(a0, _mm256_permute_ps(b23, 0x00));
+  r23 = _mm256_add_ps(r23, _mm256_mul_ps(a1, _mm256_permute_ps(b23, 0x55)));
+  r23 = _mm256_add_ps(r23, _mm256_mul_ps(a2, _mm256_permute_ps(b23, 0xAA)));
+  r23 = _mm256_add_ps(r23, _mm256_mul_ps(a3, _mm256_permute_ps(b23, 0xFF)));
+  _mm256_storeu_ps(out, r01);
+  _mm256_storeu_ps(out + 8, r23);
+}
+#elif defined(__SSE__)
+void platformer::mat4_multiply(const glm::mat4 &pA, const glm::mat4 &pB,
+                               glm::mat4 &pOut) {
+  const float *a = glm::value_ptr(pA);
+  const float *b = glm::value_ptr(pB);
+  float *out = glm::value_ptr(pOut);
+  __m128 a0 = _mm_loadu_ps(a);
+  __m128 a1 = _mm_loadu_ps(a + 4);
+  __m128 a2 = _mm_loadu_ps(a + 8);
+  __m128 a3 = _mm_loadu_ps(a + 12);
+  // Columns of B are all loaded before storing, as pOut may alias pB
+  __m128 b0 = _mm_loadu_ps(b);
+  __m128 b1 = _mm_loadu_ps(b + 4);
+  __m128 b2 = _mm_loadu_ps(b + 8);
+  __m128 b3 = _mm_loadu_ps(b + 12);
+  __m128 cols[4] = {b0, b1, b2, b3};
+  for (int i = 0; i < 4; i += 1) {
+    __m128 col = cols[i];
+    __m128 r = _mm_mul_ps(a0, _mm_shuffle_ps(col, col, 0x00));
+    r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(col, col, 0x55)));
+    r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(col, col, 0xAA)));
+    r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_shuffle_ps(col, col, 0xFF)));
+    _mm_storeu_ps(out + i * 4, r);
+  }
+}
+#else
+void platformer::mat4_multiply(const glm::mat4 &pA, const glm::mat4 &pB,
+                               glm::mat4 &pOut) {
+  platformer::mat4_multiply_scalar(pA, pB, pOut);
+}
+#endif
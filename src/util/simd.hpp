@@ -0,0 +1,50 @@
+#ifndef __SIMD_HPP__
+#define __SIMD_HPP__
+
+#include <cstddef>
+#include <glm/glm.hpp>
+#include <new>
+
+namespace platformer {
+// Multiplies two column-major 4x4 matrices (pOut = pA * pB), using AVX or SSE
+// when the build targets it. pOut may alias pB, but not pA.
+void mat4_multiply(const glm::mat4 &pA, const glm::mat4 &pB, glm::mat4 &pOut);
+
+// Plain scalar implementation, kept for comparison and for targets without
+// SIMD support.
+void mat4_multiply_scalar(const glm::mat4 &pA, const glm::mat4 &pB,
+                          glm::mat4 &pOut);
+
+// Allocator returning memory aligned to pAlign bytes, so that packed matrix
+// arrays can be loaded with full-width vector loads.
+template <typename T, std::size_t pAlign> class aligned_allocator {
+public:
+  typedef T value_type;
+  template <typename U> struct rebind {
+    typedef aligned_allocator<U, pAlign> other;
+  };
+
+  aligned_allocator() noexcept {}
+  template <typename U>
+  aligned_allocator(const aligned_allocator<U, pAlign> &) noexcept {}
+
+  T *allocate(std::size_t pSize) {
+    return static_cast<T *>(
+        ::operator new(pSize * sizeof(T), std::align_val_t(pAlign)));
+  }
+  void deallocate(T *pPointer, std::size_t) noexcept {
+    ::operator delete(pPointer, std::align_val_t(pAlign));
+  }
+
+  template <typename U>
+  bool operator==(const aligned_allocator<U, pAlign> &) const noexcept {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const aligned_allocator<U, pAlign> &) const noexcept {
+    return false;
+  }
+};
+} // namespace platformer
+
+#endif // __SIMD_HPP__
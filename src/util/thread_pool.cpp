@@ -0,0 +1,103 @@
+#include "util/thread_pool.hpp"
+#include <algorithm>
+
+using namespace platformer;
+
+thread_pool::thread_pool(int pThreads) {
+  if (pThreads <= 0) {
+    pThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+  }
+  // Queue 0 belongs to the calling thread
+  for (int i = 0; i <= pThreads; i += 1) {
+    this->mQueues.push_back(std::make_unique<task_queue>());
+  }
+  for (int i = 1; i <= pThreads; i += 1) {
+    this->mThreads.emplace_back(&thread_pool::worker_loop, this, i);
+  }
+}
+
+thread_pool::~thread_pool() {
+  {
+    std::lock_guard<std::mutex> lock(this->mMutex);
+    this->mStopping = true;
+  }
+  this->mCondition.notify_all();
+  for (auto &thread : this->mThreads) {
+    thread.join();
+  }
+}
+
+int thread_pool::size() const { return this->mQueues.size(); }
+
+void thread_pool::parallel_for(int pCount,
+                               const std::function<void(int)> &pTask) {
+  if (pCount <= 0) {
+    return;
+  }
+  std::atomic<int> remaining{pCount};
+  int numQueues = this->mQueues.size();
+  for (int i = 0; i < pCount; i += 1) {
+    auto &queue = *this->mQueues[i % numQueues];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.emplace_back([&pTask, &remaining, i]() {
+      pTask(i);
+      remaining.fetch_sub(1, std::memory_order_release);
+    });
+  }
+  {
+    // Taking the lock orders the update against workers about to sleep
+    std::lock_guard<std::mutex> lock(this->mMutex);
+    this->mQueued.fetch_add(pCount);
+  }
+  this->mCondition.notify_all();
+
+  std::function<void()> task;
+  while (remaining.load(std::memory_order_acquire) > 0) {
+    if (this->pop_task(0, task)) {
+      task();
+    } else {
+      // Everything left is being run by the workers
+      std::this_thread::yield();
+    }
+  }
+}
+
+void thread_pool::worker_loop(int pIndex) {
+  std::function<void()> task;
+  while (true) {
+    if (this->pop_task(pIndex, task)) {
+      task();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(this->mMutex);
+    this->mCondition.wait(lock, [this]() {
+      return this->mStopping || this->mQueued.load() > 0;
+    });
+    if (this->mStopping) {
+      return;
+    }
+  }
+}
+
+bool thread_pool::pop_task(int pIndex, std::function<void()> &pTask) {
+  int numQueues = this->mQueues.size();
+  // Take the newest task from our own queue, or steal the oldest one from
+  // another queue.
+  for (int i = 0; i < numQueues; i += 1) {
+    auto &queue = *this->mQueues[(pIndex + i) % numQueues];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+      continue;
+    }
+    if (i == 0) {
+      pTask = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    } else {
+      pTask = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+    this->mQueued.fetch_sub(1);
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,56 @@
+#ifndef __THREAD_POOL_HPP__
+#define __THREAD_POOL_HPP__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace platformer {
+/**
+ * @brief A fixed set of worker threads, each with its own task queue. Idle
+ * workers steal from the other queues, so uneven tasks still keep every
+ * thread busy.
+ */
+class thread_pool {
+public:
+  /**
+   * @param pThreads Number of worker threads to spawn. If zero, one less than
+   * the hardware concurrency is used, as the calling thread also works.
+   */
+  explicit thread_pool(int pThreads = 0);
+  ~thread_pool();
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  // Number of threads running tasks, including the calling thread.
+  int size() const;
+  /**
+   * @brief Runs pTask(i) for every i in [0, pCount) and waits for all of them.
+   * The calling thread takes part in running the tasks.
+   */
+  void parallel_for(int pCount, const std::function<void(int)> &pTask);
+
+private:
+  struct task_queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  void worker_loop(int pIndex);
+  bool pop_task(int pIndex, std::function<void()> &pTask);
+
+  std::vector<std::unique_ptr<task_queue>> mQueues;
+  std::vector<std::thread> mThreads;
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  std::atomic<int> mQueued{0};
+  bool mStopping = false;
+};
+} // namespace platformer
+
+#endif // __THREAD_POOL_HPP__
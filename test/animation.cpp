@@ -0,0 +1,101 @@
+#include "animation/animation.hpp"
+#include "entt/entity/fwd.hpp"
+#include "scenegraph/transform.hpp"
+#include <catch2/catch_approx.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+namespace {
+// A clip moving the target from the origin to (4, 0, 0) over two seconds
+platformer::animation_action make_action(entt::entity pTarget) {
+  platformer::animation_action action;
+  action.name = "move";
+  action.duration = 2.0f;
+  auto &track = action.translations.emplace_back();
+  track.target = action.target(pTarget);
+  track.times = {0.0f, 1.0f, 2.0f};
+  track.values = {glm::vec3(0.0f), glm::vec3(2.0f, 0.0f, 0.0f),
+                  glm::vec3(4.0f, 0.0f, 0.0f)};
+  return action;
+}
+} // namespace
+
+TEST_CASE("Animation sampling", "[animation]") {
+  entt::registry registry;
+  platformer::transform_system transformSystem;
+  transformSystem.init(registry);
+  platformer::animation_system animationSystem;
+  auto target = registry.create();
+  auto &targetTransform = registry.emplace<platformer::transform>(target);
+  auto root = registry.create();
+  auto &anim = registry.emplace<platformer::animation_component>(root);
+  anim.actions.push_back(make_action(target));
+  anim.playbacks.emplace_back();
+
+  REQUIRE(anim.actions[0].target(target) == 0);
+  REQUIRE(anim.actions[0].targets.size() == 1);
+
+  animationSystem.update(registry, 0.5f);
+  REQUIRE(targetTransform.position().x == Catch::Approx(1.0f));
+  animationSystem.update(registry, 1.0f);
+  REQUIRE(targetTransform.position().x == Catch::Approx(3.0f));
+
+  SECTION("Step interpolation holds the previous key") {
+    anim.actions[0].translations[0].interpolation =
+        platformer::animation_channel_interpolation::STEP;
+    animationSystem.update(registry, 0.25f);
+    REQUIRE(targetTransform.position().x == Catch::Approx(2.0f));
+  }
+
+  SECTION("Seeking backwards finds the keys again") {
+    anim.playbacks[0].current = 0.0f;
+    animationSystem.update(registry, 0.25f);
+    REQUIRE(targetTransform.position().x == Catch::Approx(0.5f));
+    // Wraps around the end of the clip
+    animationSystem.update(registry, 1.5f);
+    REQUIRE(targetTransform.position().x == Catch::Approx(3.5f));
+    animationSystem.update(registry, 0.5f);
+    REQUIRE(targetTransform.position().x == Catch::Approx(0.5f));
+  }
+
+  SECTION("Tracks starting late hold their first key") {
+    anim.actions[0].translations[0].times = {0.5f, 1.0f, 2.0f};
+    anim.playbacks[0].current = 0.0f;
+    animationSystem.update(registry, 0.25f);
+    REQUIRE(targetTransform.position().x == Catch::Approx(0.0f));
+    animationSystem.update(registry, 0.5f);
+    REQUIRE(targetTransform.position().x == Catch::Approx(1.0f));
+  }
+
+  SECTION("Weighted actions are blended") {
+    auto &other = anim.actions.emplace_back(make_action(target));
+    other.translations[0].values = {glm::vec3(0.0f, 4.0f, 0.0f),
+                                    glm::vec3(0.0f, 4.0f, 0.0f),
+                                    glm::vec3(0.0f, 4.0f, 0.0f)};
+    anim.playbacks.push_back({0.0f, false, true, 3.0f, {}});
+    animationSystem.update(registry, 0.0f);
+    REQUIRE(targetTransform.position().x == Catch::Approx(0.75f));
+    REQUIRE(targetTransform.position().y == Catch::Approx(3.0f));
+  }
+
+  SECTION("Components animating the same entity are blended") {
+    auto other = registry.create();
+    auto &otherAnim =
+        registry.emplace<platformer::animation_component>(other);
+    auto &action = otherAnim.actions.emplace_back(make_action(target));
+    action.translations[0].values = {glm::vec3(0.0f, 4.0f, 0.0f),
+                                     glm::vec3(0.0f, 4.0f, 0.0f),
+                                     glm::vec3(0.0f, 4.0f, 0.0f)};
+    otherAnim.playbacks.emplace_back();
+    animationSystem.update(registry, 0.0f);
+    REQUIRE(targetTransform.position().x == Catch::Approx(1.5f));
+    REQUIRE(targetTransform.position().y == Catch::Approx(2.0f));
+  }
+
+  SECTION("Changing the targets of an action moves the tracks") {
+    auto other = registry.create();
+    auto &otherTransform = registry.emplace<platformer::transform>(other);
+    anim.actions[0].targets[0] = other;
+    animationSystem.update(registry, 0.0f);
+    REQUIRE(otherTransform.position().x == Catch::Approx(3.0f));
+  }
+}
@@ -0,0 +1,63 @@
+#include "animation/animation.hpp"
+#include "entt/entity/fwd.hpp"
+#include "scenegraph/transform.hpp"
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <string>
+
+// Keys per second of the clips, about what motion capture exports
+static constexpr float KEY_RATE = 120.0f;
+
+/**
+ * @brief Adds pRigs characters of pBones bones, each playing its own clip
+ * with a translation, rotation and scale track per bone.
+ */
+static void make_rigs(entt::registry &pRegistry, int pRigs, int pBones,
+                      float pDuration) {
+  int numKeys = pDuration * KEY_RATE + 1;
+  for (int rig = 0; rig < pRigs; rig += 1) {
+    auto root = pRegistry.create();
+    pRegistry.emplace<platformer::transform>(root);
+    platformer::animation_action action;
+    action.name = "mocap";
+    action.duration = pDuration;
+    for (int bone = 0; bone < pBones; bone += 1) {
+      auto entity = pRegistry.create();
+      pRegistry.emplace<platformer::transform>(entity, root);
+      int target = action.target(entity);
+      auto &translation = action.translations.emplace_back();
+      auto &rotation = action.rotations.emplace_back();
+      auto &scale = action.scales.emplace_back();
+      translation.target = rotation.target = scale.target = target;
+      for (int key = 0; key < numKeys; key += 1) {
+        float time = key / KEY_RATE;
+        translation.times.push_back(time);
+        translation.values.emplace_back(time, bone, 0.0f);
+        rotation.times.push_back(time);
+        rotation.values.push_back(
+            glm::angleAxis(time, glm::vec3(0.0f, 1.0f, 0.0f)));
+        scale.times.push_back(time);
+        scale.values.emplace_back(1.0f + time);
+      }
+    }
+    auto &anim = pRegistry.emplace<platformer::animation_component>(root);
+    anim.actions.push_back(std::move(action));
+    anim.playbacks.emplace_back();
+  }
+}
+
+TEST_CASE("Animation update", "[.][benchmark][animation]") {
+  for (auto [rigs, bones] : {std::pair{10, 50}, {100, 50}}) {
+    entt::registry registry;
+    platformer::transform_system transformSystem;
+    transformSystem.init(registry);
+    platformer::animation_system animationSystem;
+    make_rigs(registry, rigs, bones, 30.0f);
+    auto suffix = " (" + std::to_string(rigs) + " rigs, " +
+                  std::to_string(bones) + " bones)";
+
+    BENCHMARK("update" + suffix) {
+      animationSystem.update(registry, 1.0f / 60.0f);
+    };
+  }
+}
@@ -0,0 +1,730 @@
+#include "physics/aabb_tree.hpp"
+#include "physics/heightfield.hpp"
+#include "physics/narrowphase.hpp"
+#include "physics/physics.hpp"
+#include "physics/static_grid.hpp"
+#include "scenegraph/transform.hpp"
+#include "util/thread_pool.hpp"
+#include "entt/entity/fwd.hpp"
+#include <algorithm>
+#include <catch2/catch_approx.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <vector>
+
+TEST_CASE("AABB tree queries", "[physics]") {
+  entt::registry registry;
+  platformer::aabb_tree tree;
+  std::vector<int> proxies;
+  for (int i = 0; i < 100; i += 1) {
+    auto entity = registry.create();
+    glm::vec3 center(static_cast<float>(i) * 3.0f, 0.0f, 0.0f);
+    proxies.push_back(tree.insert(entity, center - glm::vec3(1.0f),
+                                  center + glm::vec3(1.0f), 1));
+  }
+  REQUIRE(tree.size() == 100);
+
+  std::vector<entt::entity> found;
+  auto query = [&](const glm::vec3 &pMin, const glm::vec3 &pMax) {
+    found.clear();
+    tree.query(pMin, pMax, [&](entt::entity pEntity) {
+      found.push_back(pEntity);
+    });
+    std::sort(found.begin(), found.end());
+  };
+  query(glm::vec3(29.5f, -0.5f, -0.5f), glm::vec3(30.5f, 0.5f, 0.5f));
+  REQUIRE(found == std::vector<entt::entity>{tree.entity(proxies[10])});
+
+  // Small moves stay inside the enlarged box
+  REQUIRE_FALSE(tree.move(proxies[10], glm::vec3(29.05f, -1.0f, -1.0f),
+                          glm::vec3(31.05f, 1.0f, 1.0f)));
+  REQUIRE(tree.move(proxies[10], glm::vec3(-101.0f, -1.0f, -1.0f),
+                    glm::vec3(-99.0f, 1.0f, 1.0f)));
+  query(glm::vec3(29.5f, -0.5f, -0.5f), glm::vec3(30.5f, 0.5f, 0.5f));
+  REQUIRE(found.empty());
+  query(glm::vec3(-100.5f, -0.5f, -0.5f), glm::vec3(-99.5f, 0.5f, 0.5f));
+  REQUIRE(found == std::vector<entt::entity>{tree.entity(proxies[10])});
+
+  tree.remove(proxies[10]);
+  query(glm::vec3(-100.5f, -0.5f, -0.5f), glm::vec3(-99.5f, 0.5f, 0.5f));
+  REQUIRE(found.empty());
+  REQUIRE(tree.size() == 99);
+
+  // Only proxies sharing a layer with the mask are reported
+  tree.layers(proxies[20], 2);
+  std::vector<entt::entity> layered;
+  tree.query(glm::vec3(-1000.0f), glm::vec3(1000.0f), 2,
+             [&](entt::entity pEntity) { layered.push_back(pEntity); });
+  REQUIRE(layered == std::vector<entt::entity>{tree.entity(proxies[20])});
+}
+
+TEST_CASE("Static grid queries", "[physics]") {
+  entt::registry registry;
+  platformer::static_grid grid;
+  std::vector<platformer::static_grid::entry> entries;
+  std::vector<entt::entity> tiles;
+  for (int x = 0; x < 32; x += 1) {
+    for (int z = 0; z < 32; z += 1) {
+      auto entity = registry.create();
+      glm::vec3 min(static_cast<float>(x), 0.0f, static_cast<float>(z));
+      entries.push_back({entity, min, min + glm::vec3(1.0f)});
+      tiles.push_back(entity);
+    }
+  }
+  // A large platform spanning many cells is reported only once
+  auto platform = registry.create();
+  entries.push_back({platform, glm::vec3(0.0f, 4.0f, 0.0f),
+                     glm::vec3(32.0f, 5.0f, 32.0f)});
+  grid.build(entries);
+  REQUIRE(grid.size() == 32 * 32 + 1);
+
+  std::vector<entt::entity> found;
+  auto query = [&](const glm::vec3 &pMin, const glm::vec3 &pMax) {
+    found.clear();
+    grid.query(pMin, pMax,
+               [&](entt::entity pEntity) { found.push_back(pEntity); });
+    std::sort(found.begin(), found.end());
+  };
+  query(glm::vec3(3.2f, 0.5f, 5.2f), glm::vec3(3.8f, 4.5f, 5.8f));
+  std::vector<entt::entity> expected{tiles[3 * 32 + 5], platform};
+  std::sort(expected.begin(), expected.end());
+  REQUIRE(found == expected);
+  query(glm::vec3(3.2f, 0.5f, 5.2f), glm::vec3(4.5f, 0.8f, 5.8f));
+  expected = {tiles[3 * 32 + 5], tiles[4 * 32 + 5]};
+  std::sort(expected.begin(), expected.end());
+  REQUIRE(found == expected);
+  query(glm::vec3(-10.0f), glm::vec3(-5.0f));
+  REQUIRE(found.empty());
+
+  grid.clear();
+  query(glm::vec3(0.0f), glm::vec3(32.0f));
+  REQUIRE(found.empty());
+}
+
+TEST_CASE("Narrowphase shapes", "[physics]") {
+  using platformer::collision_shape;
+  platformer::shape_batch batch;
+  glm::mat4 identity(1.0f);
+  // A box turned 45 degrees around Z, whose corners stick out along X and Y
+  glm::quat turned =
+      glm::angleAxis(glm::radians(45.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+  batch.add(collision_shape::box(glm::vec3(0.0f), glm::vec3(1.0f), turned)
+                .to_world(identity),
+            0);
+  batch.add(collision_shape::sphere(glm::vec3(10.0f, 0.0f, 0.0f), 1.0f)
+                .to_world(identity),
+            1);
+  batch.add(collision_shape::capsule(glm::vec3(20.0f, -2.0f, 0.0f),
+                                     glm::vec3(20.0f, 2.0f, 0.0f), 0.5f)
+                .to_world(glm::translate(identity, glm::vec3(0.0f, 1.0f, 0.0f))),
+            2);
+  // Enough shapes to fill a whole group of eight lanes and a remainder
+  for (int i = 0; i < 9; i += 1) {
+    batch.add(collision_shape::box(glm::vec3(30.0f + i * 3.0f),
+                                   glm::vec3(31.0f + i * 3.0f))
+                  .to_world(identity),
+              3 + i);
+  }
+
+  std::vector<int> owners;
+  std::vector<int> scalar;
+  auto query = [&](const glm::vec3 &pMin, const glm::vec3 &pMax) {
+    owners.clear();
+    scalar.clear();
+    batch.overlapping(pMin, pMax, owners);
+    batch.overlapping_scalar(pMin, pMax, scalar);
+    std::sort(owners.begin(), owners.end());
+    std::sort(scalar.begin(), scalar.end());
+    REQUIRE(owners == scalar);
+  };
+  // Inside the bounds of the turned box, but beside its corner
+  query(glm::vec3(1.0f, 1.0f, -0.5f), glm::vec3(1.3f, 1.3f, 0.5f));
+  REQUIRE(owners.empty());
+  query(glm::vec3(1.2f, -0.1f, -0.1f), glm::vec3(1.5f, 0.1f, 0.1f));
+  REQUIRE(owners == std::vector<int>{0});
+  // Inside the bounds of the sphere, but beside it
+  query(glm::vec3(10.8f, 0.8f, -0.1f), glm::vec3(11.0f, 1.0f, 0.1f));
+  REQUIRE(owners.empty());
+  query(glm::vec3(10.5f, -0.1f, -0.1f), glm::vec3(11.5f, 0.1f, 0.1f));
+  REQUIRE(owners == std::vector<int>{1});
+  // The capsule was moved up by its matrix
+  query(glm::vec3(19.9f, 3.0f, -0.1f), glm::vec3(20.1f, 3.2f, 0.1f));
+  REQUIRE(owners == std::vector<int>{2});
+  // Inside the box around the capsule, but beside its rounded end
+  query(glm::vec3(20.4f, 3.4f, -0.1f), glm::vec3(20.5f, 3.5f, 0.1f));
+  REQUIRE(owners.empty());
+  query(glm::vec3(29.0f), glm::vec3(60.0f));
+  REQUIRE(owners == std::vector<int>{3, 4, 5, 6, 7, 8, 9, 10, 11});
+}
+
+TEST_CASE("Shape pairs", "[physics]") {
+  using platformer::collision_shape;
+  using platformer::overlaps;
+  glm::mat4 identity(1.0f);
+  glm::quat turned =
+      glm::angleAxis(glm::radians(45.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+  auto turned_box = [&](const glm::vec3 &pCenter) {
+    return collision_shape::box(pCenter, glm::vec3(1.0f), turned)
+        .to_world(identity);
+  };
+  auto capsule = [&](const glm::vec3 &pA, const glm::vec3 &pB, float pRadius) {
+    return collision_shape::capsule(pA, pB, pRadius).to_world(identity);
+  };
+  auto box = turned_box(glm::vec3(0.0f));
+
+  // The corners of both boxes point at each other
+  REQUIRE(overlaps(box, turned_box(glm::vec3(2.8f, 0.0f, 0.0f))));
+  REQUIRE_FALSE(overlaps(box, turned_box(glm::vec3(2.9f, 0.0f, 0.0f))));
+
+  // Beside the face of the box, which is 1.84 away from it along the diagonal
+  auto sphere = [&](float pRadius) {
+    return collision_shape::sphere(glm::vec3(1.3f, 1.3f, 0.0f), pRadius)
+        .to_world(identity);
+  };
+  REQUIRE_FALSE(overlaps(box, sphere(0.3f)));
+  REQUIRE(overlaps(sphere(0.9f), box));
+  glm::vec3 below(1.3f, 1.3f, -1.0f);
+  glm::vec3 above(1.3f, 1.3f, 1.0f);
+  REQUIRE_FALSE(overlaps(box, capsule(below, above, 0.3f)));
+  REQUIRE(overlaps(capsule(below, above, 0.9f), box));
+
+  // Crossing capsules, closest in the middle of both
+  auto across = capsule(glm::vec3(-2.0f, 0.0f, 0.0f),
+                        glm::vec3(2.0f, 0.0f, 0.0f), 0.5f);
+  REQUIRE(overlaps(across, capsule(glm::vec3(0.0f, 0.9f, -2.0f),
+                                   glm::vec3(0.0f, 0.9f, 2.0f), 0.5f)));
+  REQUIRE_FALSE(overlaps(across, capsule(glm::vec3(0.0f, 1.1f, -2.0f),
+                                         glm::vec3(0.0f, 1.1f, 2.0f), 0.5f)));
+  // Capsules in a line, closest at their ends
+  REQUIRE(overlaps(across, capsule(glm::vec3(2.9f, 0.0f, 0.0f),
+                                   glm::vec3(5.0f, 0.0f, 0.0f), 0.5f)));
+  REQUIRE_FALSE(overlaps(across, capsule(glm::vec3(3.1f, 0.0f, 0.0f),
+                                         glm::vec3(5.0f, 0.0f, 0.0f), 0.5f)));
+}
+
+TEST_CASE("Shape casts", "[physics]") {
+  using platformer::collision_shape;
+  glm::mat4 identity(1.0f);
+  auto box = collision_shape::box(glm::vec3(-1.0f), glm::vec3(1.0f))
+                 .to_world(identity);
+  auto turned = collision_shape::box(glm::vec3(0.0f), glm::vec3(1.0f),
+                                     glm::angleAxis(glm::radians(45.0f),
+                                                    glm::vec3(0.0f, 0.0f,
+                                                              1.0f)))
+                    .to_world(identity);
+  auto sphere =
+      collision_shape::sphere(glm::vec3(0.0f), 1.0f).to_world(identity);
+  auto capsule = collision_shape::capsule(glm::vec3(0.0f, 0.0f, -2.0f),
+                                          glm::vec3(0.0f, 0.0f, 2.0f), 0.5f)
+                     .to_world(identity);
+  glm::vec3 right(1.0f, 0.0f, 0.0f);
+  glm::vec3 down(0.0f, -1.0f, 0.0f);
+  glm::vec3 forward(0.0f, 0.0f, 1.0f);
+  float distance;
+  glm::vec3 normal;
+
+  // Rays are spheres without a radius
+  REQUIRE(platformer::cast_sphere(sphere, glm::vec3(-5.0f, 0.0f, 0.0f), 0.0f,
+                                  right, 10.0f, distance, normal));
+  REQUIRE(distance == Catch::Approx(4.0f));
+  REQUIRE_FALSE(platformer::cast_sphere(sphere, glm::vec3(-5.0f, 0.9f, 0.9f),
+                                        0.0f, right, 10.0f, distance,
+                                        normal));
+  REQUIRE(platformer::cast_sphere(box, glm::vec3(-5.0f, 0.0f, 0.0f), 0.5f,
+                                  right, 10.0f, distance, normal));
+  REQUIRE(distance == Catch::Approx(3.5f));
+  REQUIRE(normal == -right);
+  // Rounded around the edge of the box instead of hitting its bounds
+  REQUIRE(platformer::cast_sphere(box, glm::vec3(-5.0f, 1.3f, 0.0f), 0.5f,
+                                  right, 10.0f, distance, normal));
+  REQUIRE(distance == Catch::Approx(3.6f));
+  REQUIRE(normal.x == Catch::Approx(-0.8f));
+  REQUIRE(normal.y == Catch::Approx(0.6f));
+  // Beside the edge of the turned box, which is sqrt(2) - 1 away
+  REQUIRE_FALSE(platformer::cast_sphere(turned,
+                                        glm::vec3(1.0f, 1.0f, -5.0f), 0.4f,
+                                        forward, 10.0f, distance, normal));
+  REQUIRE(platformer::cast_sphere(turned, glm::vec3(1.0f, 1.0f, -5.0f), 0.5f,
+                                  forward, 10.0f, distance, normal));
+  REQUIRE(distance == Catch::Approx(3.71995f).margin(1e-4f));
+  REQUIRE(normal.z < 0.0f);
+  // Too short to reach it
+  REQUIRE_FALSE(platformer::cast_sphere(box, glm::vec3(-5.0f, 0.0f, 0.0f),
+                                        0.5f, right, 3.0f, distance, normal));
+
+  glm::vec3 a(-2.0f, 3.0f, 0.0f);
+  glm::vec3 b(2.0f, 3.0f, 0.0f);
+  REQUIRE(platformer::cast_capsule(sphere, a, b, 0.5f, down, 10.0f, distance,
+                                   normal));
+  REQUIRE(distance == Catch::Approx(1.5f));
+  REQUIRE(normal.y == Catch::Approx(1.0f));
+  // Lying across the top edge of the turned box and the capsule below
+  REQUIRE(platformer::cast_capsule(turned, a, b, 0.5f, down, 10.0f, distance,
+                                   normal));
+  REQUIRE(distance == Catch::Approx(2.5f - std::sqrt(2.0f)));
+  REQUIRE(normal.y == Catch::Approx(1.0f));
+  REQUIRE(platformer::cast_capsule(capsule, a, b, 0.5f, down, 10.0f, distance,
+                                   normal));
+  REQUIRE(distance == Catch::Approx(2.0f));
+  REQUIRE(normal.y == Catch::Approx(1.0f));
+  // Along the edge, touching it with its side rather than its ends
+  REQUIRE(platformer::cast_capsule(turned, glm::vec3(0.0f, 3.0f, -3.0f),
+                                   glm::vec3(0.0f, 3.0f, 3.0f), 0.5f, down,
+                                   10.0f, distance, normal));
+  REQUIRE(distance == Catch::Approx(2.5f - std::sqrt(2.0f)));
+  // Passing the end of the capsule, but not beside the one of the box
+  REQUIRE_FALSE(platformer::cast_capsule(
+      capsule, glm::vec3(-1.0f, 3.0f, 2.6f), glm::vec3(1.0f, 3.0f, 2.6f),
+      0.05f, down, 10.0f, distance, normal));
+  REQUIRE(platformer::cast_capsule(box, glm::vec3(-1.0f, 3.0f, 1.04f),
+                                   glm::vec3(1.0f, 3.0f, 1.04f), 0.05f, down,
+                                   10.0f, distance, normal));
+  // Already touching
+  REQUIRE(platformer::cast_capsule(box, glm::vec3(0.0f), glm::vec3(3.0f),
+                                   0.1f, right, 10.0f, distance, normal));
+  REQUIRE(distance == 0.0f);
+}
+
+TEST_CASE("Shape sweeps", "[physics]") {
+  using platformer::collision_shape;
+  glm::mat4 identity(1.0f);
+  auto box = [&](const glm::vec3 &pCenter) {
+    return collision_shape::box(pCenter - glm::vec3(0.5f),
+                                pCenter + glm::vec3(0.5f))
+        .to_world(identity);
+  };
+  auto turned = collision_shape::box(glm::vec3(0.0f), glm::vec3(1.0f),
+                                     glm::angleAxis(glm::radians(45.0f),
+                                                    glm::vec3(0.0f, 0.0f,
+                                                              1.0f)))
+                    .to_world(identity);
+  auto sphere =
+      collision_shape::sphere(glm::vec3(0.0f), 1.0f).to_world(identity);
+  float time;
+  float depth;
+  glm::vec3 normal;
+
+  // Onto the top edge of the turned box, landing flat
+  REQUIRE(platformer::sweep(box(glm::vec3(0.0f, 3.0f, 0.0f)), turned,
+                            glm::vec3(0.0f, -5.0f, 0.0f), time, normal));
+  REQUIRE(time == Catch::Approx((2.5f - std::sqrt(2.0f)) / 5.0f));
+  REQUIRE(normal.y == Catch::Approx(1.0f));
+  // Past its side, inside the box around it
+  REQUIRE_FALSE(platformer::sweep(box(glm::vec3(1.3f, 1.3f, -5.0f)), turned,
+                                  glm::vec3(0.0f, 0.0f, 10.0f), time,
+                                  normal));
+  REQUIRE(platformer::sweep(box(glm::vec3(-5.0f, 0.0f, 0.0f)), sphere,
+                            glm::vec3(10.0f, 0.0f, 0.0f), time, normal));
+  REQUIRE(time == Catch::Approx(0.35f));
+  REQUIRE(normal.x == Catch::Approx(-1.0f));
+  REQUIRE(platformer::sweep(sphere, box(glm::vec3(-5.0f, 0.0f, 0.0f)),
+                            glm::vec3(-10.0f, 0.0f, 0.0f), time, normal));
+  REQUIRE(time == Catch::Approx(0.35f));
+  REQUIRE(normal.x == Catch::Approx(1.0f));
+
+  // Pushed up out of the top edge, the shallowest way out
+  REQUIRE(platformer::penetration(box(glm::vec3(0.0f, 1.2f, 0.0f)), turned,
+                                  normal, depth));
+  REQUIRE(depth == Catch::Approx(std::sqrt(2.0f) - 0.7f));
+  REQUIRE(normal.y == Catch::Approx(1.0f));
+  REQUIRE_FALSE(platformer::penetration(box(glm::vec3(1.4f, 1.4f, 0.0f)),
+                                        turned, normal, depth));
+  REQUIRE(platformer::penetration(sphere, box(glm::vec3(0.0f, 1.3f, 0.0f)),
+                                  normal, depth));
+  REQUIRE(depth == Catch::Approx(0.2f));
+  REQUIRE(normal.y == Catch::Approx(-1.0f));
+}
+
+TEST_CASE("Physics simulation", "[physics]") {
+  auto make_world = [](entt::registry &pRegistry,
+                       platformer::physics_system &pPhysics) {
+    pRegistry.ctx().emplace<platformer::transform_system>().init(pRegistry);
+    pPhysics.init(pRegistry);
+    // A floor with boxes dropped and pushed around above it
+    auto floor = pRegistry.create();
+    pRegistry.emplace<platformer::transform>(floor);
+    pRegistry.emplace<platformer::collision>(
+        floor, glm::vec3(-20.0f, -1.0f, -20.0f), glm::vec3(20.0f, 0.0f, 20.0f));
+    // Enough bodies for the contacts to be found in parallel batches
+    for (int i = 0; i < 600; i += 1) {
+      auto entity = pRegistry.create();
+      glm::vec3 position(i % 10 * 1.5f - 7.0f, 2.0f + i / 100 * 1.5f,
+                         i / 10 % 10 * 1.5f - 7.0f);
+      pRegistry.emplace<platformer::transform>(
+          entity, glm::translate(glm::mat4(1.0f), position));
+      pRegistry.emplace<platformer::collision>(entity, glm::vec3(-0.5f),
+                                               glm::vec3(0.5f));
+      pRegistry.emplace<platformer::physics>(entity).velocity() =
+          glm::vec3(static_cast<float>(i % 3) - 1.0f, 0.0f, 0.0f);
+    }
+  };
+
+  entt::registry registry;
+  platformer::physics_system physicsSystem;
+  make_world(registry, physicsSystem);
+  entt::registry pooledRegistry;
+  platformer::physics_system pooledPhysics;
+  platformer::thread_pool pool(2);
+  pooledPhysics.pool(&pool);
+  make_world(pooledRegistry, pooledPhysics);
+
+  for (int i = 0; i < 240; i += 1) {
+    physicsSystem.update(registry, 1.0f / physicsSystem.tick_rate());
+    pooledPhysics.update(pooledRegistry, 1.0f / pooledPhysics.tick_rate());
+  }
+  REQUIRE(physicsSystem.stats().pairs >= physicsSystem.stats().contacts);
+
+  // Every box came to rest on the floor, with the same result on any number
+  // of threads
+  auto view = registry.view<platformer::transform, platformer::physics>();
+  for (auto entity : view) {
+    auto &transformVal = registry.get<platformer::transform>(entity);
+    REQUIRE(transformVal.position().y >= 0.5f - 1e-3f);
+    REQUIRE(transformVal.position() ==
+            pooledRegistry.get<platformer::transform>(entity).position());
+  }
+
+  // Bodies are given a history to be drawn in between ticks
+  for (auto entity : registry.view<platformer::physics>()) {
+    REQUIRE(registry.all_of<platformer::transform_snapshot>(entity));
+  }
+
+  platformer::raycast_hit hit;
+  REQUIRE(physicsSystem.raycast(registry, glm::vec3(15.0f, 0.5f, 15.0f),
+                                glm::vec3(0.0f, -1.0f, 0.0f), 10.0f, hit));
+  REQUIRE(hit.distance == 0.5f);
+  REQUIRE(hit.normal == glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+TEST_CASE("Depenetration", "[physics]") {
+  entt::registry registry;
+  registry.ctx().emplace<platformer::transform_system>().init(registry);
+  platformer::physics_system physicsSystem;
+  physicsSystem.init(registry);
+  auto add_box = [&](const glm::vec3 &pPosition, const glm::vec3 &pExtent) {
+    auto entity = registry.create();
+    registry.emplace<platformer::transform>(
+        entity, glm::translate(glm::mat4(1.0f), pPosition));
+    registry.emplace<platformer::collision>(entity, -pExtent, pExtent);
+    return entity;
+  };
+  add_box(glm::vec3(0.0f, -0.5f, 0.0f), glm::vec3(10.0f, 0.5f, 10.0f));
+  // A tall wall from x = 2 to 3
+  add_box(glm::vec3(2.5f, 5.0f, 0.0f), glm::vec3(0.5f, 5.0f, 2.0f));
+  // Spawned into the side of the wall, and slightly into the floor
+  auto beside = add_box(glm::vec3(1.7f, 0.5f, 0.0f), glm::vec3(0.5f));
+  registry.emplace<platformer::physics>(beside).velocity() =
+      glm::vec3(1.0f, 0.0f, 0.0f);
+  auto sunk = add_box(glm::vec3(-3.0f, 0.4f, 0.0f), glm::vec3(0.5f));
+  registry.emplace<platformer::physics>(sunk);
+
+  physicsSystem.update(registry, 1.0f / physicsSystem.tick_rate());
+  // Pushed out sideways rather than onto the top of the wall, and stopped
+  // from moving further in
+  auto &besideTransform = registry.get<platformer::transform>(beside);
+  REQUIRE(besideTransform.position().x == Catch::Approx(1.5f));
+  REQUIRE(besideTransform.position().y < 1.0f);
+  REQUIRE(registry.get<platformer::physics>(beside).velocity().x == 0.0f);
+  // Lifted out of the floor
+  auto &sunkTransform = registry.get<platformer::transform>(sunk);
+  REQUIRE(sunkTransform.position().y >= 0.5f - 1e-5f);
+  REQUIRE(sunkTransform.position().x == Catch::Approx(-3.0f));
+}
+
+TEST_CASE("Static changes", "[physics]") {
+  entt::registry registry;
+  registry.ctx().emplace<platformer::transform_system>().init(registry);
+  platformer::physics_system physicsSystem;
+  physicsSystem.init(registry);
+  auto add_box = [&](const glm::vec3 &pPosition, const glm::vec3 &pExtent) {
+    auto entity = registry.create();
+    registry.emplace<platformer::transform>(
+        entity, glm::translate(glm::mat4(1.0f), pPosition));
+    registry.emplace<platformer::collision>(entity, -pExtent, pExtent);
+    return entity;
+  };
+  auto run = [&](int pTicks) {
+    for (int i = 0; i < pTicks; i += 1) {
+      physicsSystem.update(registry, 1.0f / physicsSystem.tick_rate());
+    }
+  };
+  add_box(glm::vec3(0.0f, -0.5f, 0.0f), glm::vec3(20.0f, 0.5f, 20.0f));
+  // A body resting on a pedestal at each end
+  auto leftPedestal =
+      add_box(glm::vec3(-10.0f, 1.0f, 0.0f), glm::vec3(1.0f, 1.0f, 1.0f));
+  auto rightPedestal =
+      add_box(glm::vec3(10.0f, 1.0f, 0.0f), glm::vec3(1.0f, 1.0f, 1.0f));
+  auto left = add_box(glm::vec3(-10.0f, 2.5f, 0.0f), glm::vec3(0.5f));
+  auto &leftPhysics = registry.emplace<platformer::physics>(left);
+  auto right = add_box(glm::vec3(10.0f, 2.5f, 0.0f), glm::vec3(0.5f));
+  auto &rightPhysics = registry.emplace<platformer::physics>(right);
+  run(120);
+  REQUIRE(leftPhysics.sleeping());
+  REQUIRE(rightPhysics.sleeping());
+
+  // Adding or removing a static collision only wakes the bodies around it
+  add_box(glm::vec3(0.0f, 3.0f, 0.0f), glm::vec3(1.0f));
+  registry.destroy(leftPedestal);
+  run(1);
+  REQUIRE_FALSE(leftPhysics.sleeping());
+  REQUIRE(rightPhysics.sleeping());
+  run(120);
+  REQUIRE(registry.get<platformer::transform>(left).position().y ==
+          Catch::Approx(0.5f).margin(1e-3f));
+
+  // A moved static collision wakes what it moves into, and still holds
+  // bodies up once it has settled back into the grid
+  auto &pedestalTransform = registry.get<platformer::transform>(rightPedestal);
+  pedestalTransform.translate(glm::vec3(0.0f, 0.0f, 5.0f));
+  run(2);
+  REQUIRE(registry.get<platformer::transform>(right).position().y < 2.5f);
+  run(120);
+  auto dropped = add_box(glm::vec3(10.0f, 4.0f, 5.0f), glm::vec3(0.5f));
+  registry.emplace<platformer::physics>(dropped);
+  run(120);
+  REQUIRE(registry.get<platformer::transform>(dropped).position().y ==
+          Catch::Approx(2.5f).margin(1e-3f));
+}
+
+namespace {
+struct trigger_log {
+  void enter(entt::registry &, entt::entity, entt::entity pBody) {
+    entered.push_back(pBody);
+  }
+  void exit(entt::registry &, entt::entity, entt::entity pBody) {
+    exited.push_back(pBody);
+  }
+  std::vector<entt::entity> entered;
+  std::vector<entt::entity> exited;
+};
+} // namespace
+
+TEST_CASE("Shape resolution", "[physics]") {
+  using platformer::collision_shape;
+  entt::registry registry;
+  registry.ctx().emplace<platformer::transform_system>().init(registry);
+  platformer::physics_system physicsSystem;
+  physicsSystem.init(registry);
+  auto add = [&](const glm::vec3 &pPosition, auto &&...pArgs) {
+    auto entity = registry.create();
+    registry.emplace<platformer::transform>(
+        entity, glm::translate(glm::mat4(1.0f), pPosition));
+    registry.emplace<platformer::collision>(entity, pArgs...);
+    return entity;
+  };
+  add(glm::vec3(0.0f, -0.5f, 0.0f), glm::vec3(-10.0f, -0.5f, -10.0f),
+      glm::vec3(10.0f, 0.5f, 10.0f));
+  // A ball on the floor, and a box turned into a diamond
+  add(glm::vec3(0.0f, 1.0f, 0.0f),
+      std::vector{collision_shape::sphere(glm::vec3(0.0f), 1.0f)});
+  add(glm::vec3(6.0f, std::sqrt(2.0f), 0.0f),
+      std::vector{collision_shape::box(
+          glm::vec3(0.0f), glm::vec3(1.0f),
+          glm::angleAxis(glm::radians(45.0f),
+                         glm::vec3(0.0f, 0.0f, 1.0f)))});
+  // Dropped on top of both, and beside the ball inside the box around it
+  auto onBall = add(glm::vec3(0.0f, 4.0f, 0.0f), glm::vec3(-0.4f),
+                    glm::vec3(0.4f));
+  auto onDiamond = add(glm::vec3(6.0f, 5.0f, 0.0f), glm::vec3(-0.4f),
+                       glm::vec3(0.4f));
+  auto beside = add(glm::vec3(1.3f, 4.0f, 0.0f), glm::vec3(-0.4f),
+                    glm::vec3(0.4f));
+  // Spawned into the side of the diamond
+  auto inside = add(glm::vec3(7.0f, 2.0f, 0.0f), glm::vec3(-0.4f),
+                    glm::vec3(0.4f));
+  for (auto entity : {onBall, onDiamond, beside, inside}) {
+    registry.emplace<platformer::physics>(entity);
+  }
+  physicsSystem.update(registry, 1.0f / physicsSystem.tick_rate());
+  auto &transforms = registry.storage<platformer::transform>();
+  // Pushed out along the normal of the face rather than a world axis
+  glm::vec3 pushed = transforms.get(inside).position() -
+                     glm::vec3(7.0f, 2.0f, 0.0f);
+  REQUIRE(pushed.x > 0.0f);
+  REQUIRE(pushed.x == Catch::Approx(pushed.y).margin(0.05f));
+
+  for (int i = 0; i < 60; i += 1) {
+    physicsSystem.update(registry, 1.0f / physicsSystem.tick_rate());
+  }
+  REQUIRE(transforms.get(onBall).position().y ==
+          Catch::Approx(2.4f).margin(1e-3f));
+  REQUIRE(transforms.get(onDiamond).position().y ==
+          Catch::Approx(2.0f * std::sqrt(2.0f) + 0.4f).margin(1e-3f));
+  // Slid off the ball instead of resting on the corner of its box
+  REQUIRE(transforms.get(beside).position().y < 2.0f);
+  REQUIRE(transforms.get(beside).position().x > 1.3f);
+}
+
+TEST_CASE("Layers and triggers", "[physics]") {
+  entt::registry registry;
+  registry.ctx().emplace<platformer::transform_system>().init(registry);
+  platformer::physics_system physicsSystem;
+  physicsSystem.init(registry);
+  trigger_log log;
+  physicsSystem.on_trigger_enter().connect<&trigger_log::enter>(log);
+  physicsSystem.on_trigger_exit().connect<&trigger_log::exit>(log);
+
+  auto add_box = [&](const glm::vec3 &pPosition, const glm::vec3 &pExtent) {
+    auto entity = registry.create();
+    registry.emplace<platformer::transform>(
+        entity, glm::translate(glm::mat4(1.0f), pPosition));
+    return std::pair{entity, &registry.emplace<platformer::collision>(
+                                 entity, -pExtent, pExtent)};
+  };
+  auto [floor, floorVal] = add_box(glm::vec3(0.0f, -0.5f, 0.0f),
+                                   glm::vec3(10.0f, 0.5f, 10.0f));
+  floorVal->layer(2);
+  auto [trigger, triggerVal] =
+      add_box(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(1.0f, 0.5f, 1.0f));
+  triggerVal->trigger(true);
+  // Falls through the trigger and lands on the floor
+  auto [lander, landerVal] =
+      add_box(glm::vec3(0.0f, 3.0f, 0.0f), glm::vec3(0.5f));
+  registry.emplace<platformer::physics>(lander);
+  // Doesn't collide with the layer of the floor
+  auto [ghost, ghostVal] =
+      add_box(glm::vec3(4.0f, 3.0f, 0.0f), glm::vec3(0.5f));
+  ghostVal->mask(1);
+  registry.emplace<platformer::physics>(ghost);
+
+  for (int i = 0; i < 120; i += 1) {
+    physicsSystem.update(registry, 1.0f / physicsSystem.tick_rate());
+  }
+  auto &transforms = registry.storage<platformer::transform>();
+  REQUIRE(transforms.get(lander).position().y ==
+          Catch::Approx(0.5f).margin(1e-3f));
+  REQUIRE(transforms.get(ghost).position().y < -1.0f);
+  REQUIRE(log.entered == std::vector<entt::entity>{lander});
+  REQUIRE(log.exited == std::vector<entt::entity>{lander});
+
+  // Sleeping bodies still see triggers moving onto them, or appearing
+  REQUIRE(registry.get<platformer::physics>(lander).sleeping());
+  auto &triggerTransform = transforms.get(trigger);
+  triggerTransform.position(glm::vec3(0.0f, 0.5f, 0.0f));
+  physicsSystem.update(registry, 1.0f / physicsSystem.tick_rate());
+  REQUIRE(log.entered == std::vector<entt::entity>{lander, lander});
+  triggerTransform.position(glm::vec3(0.0f, 4.0f, 0.0f));
+  physicsSystem.update(registry, 1.0f / physicsSystem.tick_rate());
+  REQUIRE(log.exited == std::vector<entt::entity>{lander, lander});
+  auto [added, addedVal] =
+      add_box(glm::vec3(0.0f, 0.5f, 0.0f), glm::vec3(1.0f, 0.5f, 1.0f));
+  addedVal->trigger(true);
+  physicsSystem.update(registry, 1.0f / physicsSystem.tick_rate());
+  REQUIRE(log.entered == std::vector<entt::entity>{lander, lander, lander});
+  REQUIRE(registry.get<platformer::physics>(lander).sleeping());
+
+  // Rays go through triggers too
+  platformer::raycast_hit hit;
+  REQUIRE(physicsSystem.raycast(registry, glm::vec3(0.0f, 5.0f, 0.0f),
+                                glm::vec3(0.0f, -1.0f, 0.0f), 10.0f, hit));
+  REQUIRE(hit.entity == lander);
+}
+
+TEST_CASE("Heightfield", "[physics]") {
+  entt::registry registry;
+  registry.ctx().emplace<platformer::transform_system>().init(registry);
+  platformer::physics_system physicsSystem;
+  physicsSystem.init(registry);
+
+  // Flat ground at 0 with a step up to 2 and a hole, 10 by 10 cells of 1
+  std::vector<float> heights(100, 0.0f);
+  heights[5 * 10 + 7] = 2.0f;
+  heights[5 * 10 + 2] = -1.0f;
+  auto ground = registry.create();
+  registry.emplace<platformer::heightfield>(
+      ground, glm::vec3(-5.0f, -1.0f, -5.0f), 1.0f, 10, 10, heights);
+  auto body = registry.create();
+  registry.emplace<platformer::transform>(
+      body, glm::translate(glm::mat4(1.0f), glm::vec3(0.5f, 3.0f, 0.5f)));
+  registry.emplace<platformer::collision>(body, glm::vec3(-0.4f),
+                                          glm::vec3(0.4f));
+  registry.emplace<platformer::physics>(body);
+
+  for (int i = 0; i < 120; i += 1) {
+    physicsSystem.update(registry, 1.0f / physicsSystem.tick_rate());
+  }
+  REQUIRE(registry.get<platformer::transform>(body).position().y ==
+          Catch::Approx(0.4f).margin(1e-3f));
+
+  platformer::raycast_hit hit;
+  REQUIRE(physicsSystem.raycast(registry, glm::vec3(2.5f, 5.0f, 0.5f),
+                                glm::vec3(0.0f, -1.0f, 0.0f), 10.0f, hit));
+  REQUIRE(hit.entity == ground);
+  REQUIRE(hit.distance == Catch::Approx(3.0f));
+  REQUIRE(hit.normal == glm::vec3(0.0f, 1.0f, 0.0f));
+  // Straight down the hole
+  REQUIRE_FALSE(physicsSystem.raycast(registry, glm::vec3(-2.5f, 5.0f, 0.5f),
+                                      glm::vec3(0.0f, -1.0f, 0.0f), 10.0f,
+                                      hit));
+
+  std::vector<entt::entity> found;
+  physicsSystem.overlap(registry, glm::vec3(-2.9f, -0.5f, 0.1f),
+                        glm::vec3(-2.1f, 0.5f, 0.9f), found);
+  REQUIRE(found.empty());
+}
+
+TEST_CASE("Scene queries", "[physics]") {
+  using platformer::collision_shape;
+  entt::registry registry;
+  registry.ctx().emplace<platformer::transform_system>().init(registry);
+  platformer::physics_system physicsSystem;
+  physicsSystem.init(registry);
+
+  // A ball in front of a wall on another layer, along the Z axis
+  auto ball = registry.create();
+  registry.emplace<platformer::transform>(ball);
+  registry.emplace<platformer::collision>(
+      ball, std::vector{collision_shape::sphere(glm::vec3(0.0f), 1.0f)});
+  auto wall = registry.create();
+  registry.emplace<platformer::transform>(
+      wall, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 5.0f)));
+  registry.emplace<platformer::collision>(wall, glm::vec3(-3.0f),
+                                          glm::vec3(3.0f))
+      .layer(2);
+  physicsSystem.update(registry, 1.0f / physicsSystem.tick_rate());
+
+  glm::vec3 forward(0.0f, 0.0f, 1.0f);
+  platformer::raycast_hit hit;
+  REQUIRE(physicsSystem.raycast(registry, glm::vec3(0.0f, 0.0f, -5.0f),
+                                forward, 20.0f, hit));
+  REQUIRE(hit.entity == ball);
+  REQUIRE(hit.distance == Catch::Approx(4.0f));
+  // Inside the box around the ball, but beside the ball
+  REQUIRE(physicsSystem.raycast(registry, glm::vec3(0.9f, 0.9f, -5.0f),
+                                forward, 20.0f, hit));
+  REQUIRE(hit.entity == wall);
+  REQUIRE(physicsSystem.raycast(registry, glm::vec3(0.0f, 0.0f, -5.0f),
+                                forward, 20.0f, hit, entt::null, 2));
+  REQUIRE(hit.entity == wall);
+  REQUIRE(hit.distance == Catch::Approx(7.0f));
+  REQUIRE(physicsSystem.sphere_cast(registry, glm::vec3(1.2f, 1.2f, -5.0f),
+                                    0.5f, forward, 20.0f, hit));
+  REQUIRE(hit.entity == wall);
+  REQUIRE(physicsSystem.sphere_cast(registry, glm::vec3(1.0f, 1.0f, -5.0f),
+                                    0.5f, forward, 20.0f, hit));
+  REQUIRE(hit.entity == ball);
+  REQUIRE_FALSE(physicsSystem.capsule_cast(
+      registry, glm::vec3(-1.0f, 0.0f, -5.0f), glm::vec3(1.0f, 0.0f, -5.0f),
+      0.5f, forward, 20.0f, hit, wall, 1u << 1));
+
+  // Batched rays skip what they ignore and the layers not in their mask
+  std::vector<platformer::ray> rays(3, {glm::vec3(0.0f, 0.0f, -5.0f),
+                                        forward, 20.0f});
+  rays[1].ignore = ball;
+  rays[2].mask = 1;
+  rays[2].origin.x = 0.9f;
+  rays[2].origin.y = 0.9f;
+  std::vector<platformer::raycast_hit> hits;
+  physicsSystem.raycast(registry, rays, hits);
+  REQUIRE(hits[0].entity == ball);
+  REQUIRE(hits[1].entity == wall);
+  REQUIRE(hits[2].entity == entt::null);
+
+  std::vector<entt::entity> found;
+  physicsSystem.overlap(registry, glm::vec3(0.8f, 0.8f, -0.2f),
+                        glm::vec3(0.9f, 0.9f, 0.2f), found);
+  REQUIRE(found.empty());
+  physicsSystem.overlap(registry, glm::vec3(0.5f, 0.5f, -0.2f),
+                        glm::vec3(0.9f, 0.9f, 0.2f), found);
+  REQUIRE(found == std::vector<entt::entity>{ball});
+}
@@ -0,0 +1,135 @@
+#include "entt/entity/fwd.hpp"
+#include "physics/physics.hpp"
+#include "scenegraph/transform.hpp"
+#include "util/thread_pool.hpp"
+#include <catch2/catch_test_macros.hpp>
+#include <chrono>
+#include <cmath>
+#include <glm/ext/matrix_transform.hpp>
+#include <iostream>
+#include <random>
+#include <string>
+
+namespace {
+enum class layout { GRID, PILE, SCATTER };
+
+// Number of fixed ticks stepped for each scene
+constexpr int STEPS = 300;
+
+void add_box(entt::registry &pRegistry, const glm::vec3 &pPosition,
+             const glm::vec3 &pExtent, bool pDynamic) {
+  auto entity = pRegistry.create();
+  pRegistry.emplace<platformer::transform>(
+      entity, glm::translate(glm::mat4(1.0f), pPosition));
+  pRegistry.emplace<platformer::collision>(entity, -pExtent, pExtent);
+  if (pDynamic) {
+    pRegistry.emplace<platformer::physics>(entity);
+  }
+}
+
+// A square floor of touching tiles centred on the origin
+void add_floor(entt::registry &pRegistry, int pCount) {
+  int side = std::ceil(std::sqrt(static_cast<float>(pCount)));
+  for (int i = 0; i < pCount; i += 1) {
+    glm::vec3 position(i % side - side / 2, 0.0f, i / side - side / 2);
+    add_box(pRegistry, position, glm::vec3(0.5f), false);
+  }
+}
+
+/**
+ * @brief Fills the registry with pStatics static and pDynamics dynamic boxes:
+ * a grid of spaced out boxes falling onto a floor, columns of touching boxes
+ * piled on a floor, or boxes scattered at random with random velocities.
+ */
+void make_scene(entt::registry &pRegistry, layout pLayout, int pStatics,
+                int pDynamics) {
+  std::mt19937 random(42);
+  switch (pLayout) {
+  case layout::GRID: {
+    add_floor(pRegistry, pStatics);
+    int side = std::ceil(std::sqrt(static_cast<float>(pDynamics)));
+    for (int i = 0; i < pDynamics; i += 1) {
+      glm::vec3 position((i % side - side / 2) * 2.0f, 3.0f,
+                         (i / side - side / 2) * 2.0f);
+      add_box(pRegistry, position, glm::vec3(0.4f), true);
+    }
+    break;
+  }
+  case layout::PILE: {
+    add_floor(pRegistry, pStatics);
+    constexpr int HEIGHT = 10;
+    int columns = (pDynamics + HEIGHT - 1) / HEIGHT;
+    int side = std::ceil(std::sqrt(static_cast<float>(columns)));
+    for (int i = 0; i < pDynamics; i += 1) {
+      int column = i / HEIGHT;
+      glm::vec3 position(column % side - side / 2, 1.0f + i % HEIGHT,
+                         column / side - side / 2);
+      add_box(pRegistry, position, glm::vec3(0.5f), true);
+    }
+    break;
+  }
+  case layout::SCATTER: {
+    // Keeps the density about the same whatever the number of boxes
+    float size = 4.0f * std::cbrt(static_cast<float>(pStatics + pDynamics));
+    std::uniform_real_distribution<float> coordinate(-size, size);
+    std::uniform_real_distribution<float> extent(0.2f, 1.0f);
+    std::uniform_real_distribution<float> speed(-5.0f, 5.0f);
+    for (int i = 0; i < pStatics + pDynamics; i += 1) {
+      bool dynamic = i >= pStatics;
+      glm::vec3 position(coordinate(random), coordinate(random),
+                         coordinate(random));
+      add_box(pRegistry, position,
+              glm::vec3(extent(random), extent(random), extent(random)),
+              dynamic);
+    }
+    for (auto entity : pRegistry.view<platformer::physics>()) {
+      pRegistry.get<platformer::physics>(entity).velocity() =
+          glm::vec3(speed(random), speed(random), speed(random));
+    }
+    break;
+  }
+  }
+}
+
+void run_scene(const std::string &pName, layout pLayout, int pStatics,
+               int pDynamics, platformer::thread_pool *pPool) {
+  entt::registry registry;
+  registry.ctx().emplace<platformer::transform_system>().init(registry);
+  platformer::physics_system physicsSystem;
+  physicsSystem.init(registry);
+  physicsSystem.pool(pPool);
+  make_scene(registry, pLayout, pStatics, pDynamics);
+
+  float delta = 1.0f / physicsSystem.tick_rate();
+  long long pairs = 0;
+  long long contacts = 0;
+  std::chrono::nanoseconds total(0);
+  for (int i = 0; i < STEPS; i += 1) {
+    auto start = std::chrono::steady_clock::now();
+    physicsSystem.update(registry, delta);
+    total += std::chrono::steady_clock::now() - start;
+    pairs += physicsSystem.stats().pairs;
+    contacts += physicsSystem.stats().contacts;
+  }
+  std::cout << pName << " (" << pStatics << " static, " << pDynamics
+            << " dynamic, " << (pPool != nullptr ? "pool" : "serial")
+            << "): " << total.count() / STEPS << " ns/step, "
+            << pairs / STEPS << " pairs/step, " << contacts / STEPS
+            << " contacts/step" << std::endl;
+}
+} // namespace
+
+// Steps whole scenes without a game or a window, printing the average cost
+// and work of each tick. It has its own executable, physics_bench, which
+// runs it by default.
+TEST_CASE("Physics step", "[benchmark][physics]") {
+  platformer::thread_pool pool;
+  for (auto [statics, dynamics] : {std::pair{1000, 100}, {10000, 1000}}) {
+    for (auto *poolVal : {static_cast<platformer::thread_pool *>(nullptr),
+                          &pool}) {
+      run_scene("grid", layout::GRID, statics, dynamics, poolVal);
+      run_scene("pile", layout::PILE, statics, dynamics, poolVal);
+      run_scene("scatter", layout::SCATTER, statics, dynamics, poolVal);
+    }
+  }
+}
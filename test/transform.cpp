@@ -1,9 +1,12 @@
 #define GLM_ENABLE_EXPERIMENTAL
-#include "transform.hpp"
 #include "entt/entity/fwd.hpp"
+#include "scenegraph/transform.hpp"
+#include "util/simd.hpp"
+#include <catch2/catch_approx.hpp>
 #include <catch2/catch_test_macros.hpp>
 #include <glm/ext/matrix_transform.hpp>
 #include <glm/gtx/string_cast.hpp>
+#include <glm/gtx/transform.hpp>
 #include <numbers>
 
 TEST_CASE("Basic use cases", "[transform]") {
@@ -31,3 +34,470 @@ TEST_CASE("Object hierarchy", "[transform]") {
   REQUIRE(childTransform.children().size() == 0);
   REQUIRE(parentTransform.children().size() == 1);
 }
+
+TEST_CASE("Matrix kernel", "[transform]") {
+  // Covers whichever kernel the build selected: AVX with PLATFORMER_AVX,
+  // otherwise SSE or scalar
+  glm::mat4 lhs = glm::rotate(glm::translate(glm::mat4(1.0f),
+                                             glm::vec3(1.0f, -2.0f, 3.0f)),
+                              0.7f, glm::vec3(0.0f, 1.0f, 0.0f));
+  lhs[0][3] = 0.25f;
+  glm::mat4 rhs = glm::scale(glm::rotate(glm::mat4(1.0f), -1.3f,
+                                         glm::vec3(1.0f, 0.0f, 0.0f)),
+                             glm::vec3(2.0f, 0.5f, 3.0f));
+  rhs[3] = glm::vec4(4.0f, 5.0f, -6.0f, 1.0f);
+  glm::mat4 expected = lhs * rhs;
+  glm::mat4 simd;
+  glm::mat4 scalar;
+  platformer::mat4_multiply(lhs, rhs, simd);
+  platformer::mat4_multiply_scalar(lhs, rhs, scalar);
+  // The output may alias the right hand side
+  glm::mat4 aliased = rhs;
+  platformer::mat4_multiply(lhs, aliased, aliased);
+  for (int col = 0; col < 4; col += 1) {
+    for (int row = 0; row < 4; row += 1) {
+      REQUIRE(simd[col][row] ==
+              Catch::Approx(expected[col][row]).margin(1e-5f));
+      REQUIRE(scalar[col][row] ==
+              Catch::Approx(expected[col][row]).margin(1e-5f));
+      REQUIRE(aliased[col][row] ==
+              Catch::Approx(expected[col][row]).margin(1e-5f));
+    }
+  }
+}
+
+TEST_CASE("Propagation", "[transform]") {
+  entt::registry registry;
+  platformer::transform_system transformSystem;
+  transformSystem.init(registry);
+  auto root = registry.create();
+  auto &rootTransform = registry.emplace<platformer::transform>(root);
+  auto child = registry.create();
+  auto &childTransform = registry.emplace<platformer::transform>(child, root);
+  auto grandchild = registry.create();
+  auto &grandchildTransform =
+      registry.emplace<platformer::transform>(grandchild, child);
+
+  rootTransform.translate(glm::vec3(1.0, 0.0, 0.0));
+  childTransform.translate(glm::vec3(0.0, 1.0, 0.0));
+  grandchildTransform.translate(glm::vec3(0.0, 0.0, 1.0));
+  transformSystem.propagate(registry);
+  REQUIRE(glm::to_string(grandchildTransform.position_world(registry)) ==
+          glm::to_string(glm::vec3(1.0, 1.0, 1.0)));
+
+  rootTransform.translate(glm::vec3(1.0, 0.0, 0.0));
+  transformSystem.propagate(registry);
+  REQUIRE(glm::to_string(grandchildTransform.position_world(registry)) ==
+          glm::to_string(glm::vec3(2.0, 1.0, 1.0)));
+}
+
+TEST_CASE("Parent transform added after the child", "[transform]") {
+  entt::registry registry;
+  platformer::transform_system transformSystem;
+  transformSystem.init(registry);
+  auto parent = registry.create();
+  auto child = registry.create();
+  auto &childTransform = registry.emplace<platformer::transform>(
+      child, parent, glm::translate(glm::vec3(1.0, 0.0, 0.0)));
+  transformSystem.propagate(registry);
+  REQUIRE(glm::to_string(childTransform.position_world(registry)) ==
+          glm::to_string(glm::vec3(1.0, 0.0, 0.0)));
+
+  auto &parentTransform = registry.emplace<platformer::transform>(
+      parent, glm::translate(glm::vec3(0.0, 2.0, 0.0)));
+  REQUIRE(parentTransform.children().size() == 1);
+  REQUIRE(*parentTransform.children().begin() == child);
+  transformSystem.propagate(registry);
+  REQUIRE(transformSystem.changed() ==
+          std::vector<entt::entity>{parent, child});
+  REQUIRE(glm::to_string(childTransform.position_world(registry)) ==
+          glm::to_string(glm::vec3(1.0, 2.0, 0.0)));
+
+  // The child is part of the parent's subtree in the sweep
+  parentTransform.translate(glm::vec3(0.0, 1.0, 0.0));
+  transformSystem.propagate(registry);
+  REQUIRE(transformSystem.changed() ==
+          std::vector<entt::entity>{parent, child});
+  REQUIRE(glm::to_string(childTransform.position_world(registry)) ==
+          glm::to_string(glm::vec3(1.0, 3.0, 0.0)));
+}
+
+TEST_CASE("Parent transform removed and added again", "[transform]") {
+  entt::registry registry;
+  platformer::transform_system transformSystem;
+  transformSystem.init(registry);
+  auto parent = registry.create();
+  registry.emplace<platformer::transform>(
+      parent, glm::translate(glm::vec3(0.0, 2.0, 0.0)));
+  auto child = registry.create();
+  auto &childTransform = registry.emplace<platformer::transform>(
+      child, parent, glm::translate(glm::vec3(1.0, 0.0, 0.0)));
+  transformSystem.propagate(registry);
+
+  // Without the parent's transform the child is a root, but keeps its parent
+  registry.remove<platformer::transform>(parent);
+  transformSystem.propagate(registry);
+  REQUIRE(childTransform.parent() == parent);
+  REQUIRE(glm::to_string(childTransform.position_world(registry)) ==
+          glm::to_string(glm::vec3(1.0, 0.0, 0.0)));
+
+  auto &parentTransform = registry.emplace<platformer::transform>(
+      parent, glm::translate(glm::vec3(0.0, 3.0, 0.0)));
+  REQUIRE(parentTransform.children().size() == 1);
+  transformSystem.propagate(registry);
+  REQUIRE(glm::to_string(childTransform.position_world(registry)) ==
+          glm::to_string(glm::vec3(1.0, 3.0, 0.0)));
+
+  // Reparenting and removing the child keeps the lists consistent
+  childTransform.parent(std::nullopt);
+  registry.patch<platformer::transform>(child);
+  REQUIRE(parentTransform.children().empty());
+  childTransform.parent(parent);
+  registry.patch<platformer::transform>(child);
+  registry.remove<platformer::transform>(child);
+  REQUIRE(parentTransform.children().empty());
+  transformSystem.propagate(registry);
+  REQUIRE(transformSystem.changed().empty());
+}
+
+TEST_CASE("Dirty subtrees", "[transform]") {
+  entt::registry registry;
+  platformer::transform_system transformSystem;
+  transformSystem.init(registry);
+  auto root = registry.create();
+  auto &rootTransform = registry.emplace<platformer::transform>(root);
+  auto left = registry.create();
+  auto &leftTransform = registry.emplace<platformer::transform>(left, root);
+  auto right = registry.create();
+  auto &rightTransform = registry.emplace<platformer::transform>(right, root);
+  leftTransform.translate(glm::vec3(-1.0, 0.0, 0.0));
+  rightTransform.translate(glm::vec3(1.0, 0.0, 0.0));
+  transformSystem.propagate(registry);
+
+  // Reads between sweeps still see the latest state
+  rootTransform.translate(glm::vec3(0.0, 2.0, 0.0));
+  REQUIRE(glm::to_string(leftTransform.position_world(registry)) ==
+          glm::to_string(glm::vec3(-1.0, 2.0, 0.0)));
+  transformSystem.propagate(registry);
+  REQUIRE(glm::to_string(rightTransform.position_world(registry)) ==
+          glm::to_string(glm::vec3(1.0, 2.0, 0.0)));
+
+  leftTransform.translate(glm::vec3(0.0, 0.0, 1.0));
+  transformSystem.propagate(registry);
+  REQUIRE(glm::to_string(leftTransform.position_world(registry)) ==
+          glm::to_string(glm::vec3(-1.0, 2.0, 1.0)));
+  REQUIRE(glm::to_string(rightTransform.position_world(registry)) ==
+          glm::to_string(glm::vec3(1.0, 2.0, 0.0)));
+}
+
+TEST_CASE("World decomposition", "[transform]") {
+  entt::registry registry;
+  platformer::transform_system transformSystem;
+  transformSystem.init(registry);
+  auto parent = registry.create();
+  auto &parentTransform = registry.emplace<platformer::transform>(parent);
+  auto child = registry.create();
+  auto &childTransform = registry.emplace<platformer::transform>(child, parent);
+
+  parentTransform.scale(glm::vec3(2.0, 2.0, 2.0));
+  parentTransform.translate(glm::vec3(0.0, 1.0, 0.0));
+  childTransform.translate(glm::vec3(1.0, 0.0, 0.0));
+  REQUIRE(glm::to_string(childTransform.position_world(registry)) ==
+          glm::to_string(glm::vec3(2.0, 1.0, 0.0)));
+  REQUIRE(glm::to_string(childTransform.scale_world(registry)) ==
+          glm::to_string(glm::vec3(2.0, 2.0, 2.0)));
+  auto inverse = childTransform.matrix_world_inverse(registry);
+  REQUIRE(glm::to_string(glm::vec3(inverse * glm::vec4(2.0, 1.0, 0.0, 1.0))) ==
+          glm::to_string(glm::vec3(0.0, 0.0, 0.0)));
+}
+
+TEST_CASE("Affine fast paths", "[transform]") {
+  auto require_near = [](const glm::mat4 &pA, const glm::mat4 &pB) {
+    for (int col = 0; col < 4; col += 1) {
+      for (int row = 0; row < 4; row += 1) {
+        REQUIRE(pA[col][row] == Catch::Approx(pB[col][row]).margin(1e-4f));
+      }
+    }
+  };
+  entt::registry registry;
+  platformer::transform_system transformSystem;
+  transformSystem.init(registry);
+  auto parent = registry.create();
+  auto &parentTransform = registry.emplace<platformer::transform>(parent);
+  auto child = registry.create();
+  auto &childTransform = registry.emplace<platformer::transform>(child, parent);
+  parentTransform.translate(glm::vec3(1.0, 2.0, 3.0));
+  parentTransform.rotate_y(0.6f);
+  childTransform.translate(glm::vec3(-2.0, 0.5, 1.0));
+  childTransform.rotate_axis(glm::normalize(glm::vec3(1.0, 1.0, 0.0)), 1.1f);
+
+  SECTION("Rotated, non-uniformly scaled and mirrored") {
+    // A uniform parent scale keeps the world columns orthogonal
+    parentTransform.scale(glm::vec3(1.5, 1.5, 1.5));
+    childTransform.scale(glm::vec3(2.0, -0.5, 3.0));
+    auto &world = childTransform.matrix_world(registry);
+    require_near(world * childTransform.matrix_world_inverse(registry),
+                 glm::mat4(1.0f));
+    require_near(childTransform.matrix_world_inverse(registry),
+                 glm::inverse(world));
+    glm::mat4 rebuilt = glm::translate(childTransform.position_world(registry)) *
+                        glm::mat4_cast(childTransform.rotation_world(registry)) *
+                        glm::scale(childTransform.scale_world(registry));
+    require_near(rebuilt, world);
+  }
+
+  SECTION("Sheared by the parent chain") {
+    // A non-uniform parent scale under a rotated child shears the world
+    // matrix, which takes the general inverse
+    parentTransform.scale(glm::vec3(1.0, 3.0, 0.5));
+    auto &world = childTransform.matrix_world(registry);
+    require_near(world * childTransform.matrix_world_inverse(registry),
+                 glm::mat4(1.0f));
+  }
+}
+
+TEST_CASE("Parallel propagation", "[transform]") {
+  platformer::thread_pool pool(4);
+  entt::registry serialRegistry;
+  entt::registry parallelRegistry;
+  platformer::transform_system serialSystem;
+  platformer::transform_system parallelSystem;
+  serialSystem.init(serialRegistry);
+  parallelSystem.init(parallelRegistry);
+  parallelSystem.pool(&pool);
+  std::vector<entt::entity> entities;
+  for (auto *registry : {&serialRegistry, &parallelRegistry}) {
+    entities.clear();
+    for (int i = 0; i < 20000; i += 1) {
+      auto entity = registry->create();
+      auto &transformVal =
+          i % 8 == 0 ? registry->emplace<platformer::transform>(entity)
+                     : registry->emplace<platformer::transform>(
+                           entity, entities[i - 1]);
+      transformVal.translate(glm::vec3(0.0, 0.5, 0.0));
+      transformVal.rotate_y(0.1f * (i % 7));
+      entities.push_back(entity);
+    }
+  }
+  serialSystem.propagate(serialRegistry);
+  parallelSystem.propagate(parallelRegistry);
+  auto serialView = serialRegistry.view<platformer::transform>();
+  for (auto entity : serialView) {
+    auto &serialVal = serialRegistry.get<platformer::transform>(entity);
+    auto &parallelVal = parallelRegistry.get<platformer::transform>(entity);
+    REQUIRE(serialVal.matrix_world(serialRegistry) ==
+            parallelVal.matrix_world(parallelRegistry));
+  }
+}
+
+TEST_CASE("Packed propagation", "[transform]") {
+  entt::registry unpackedRegistry;
+  entt::registry packedRegistry;
+  platformer::transform_system unpackedSystem;
+  platformer::transform_system packedSystem;
+  unpackedSystem.init(unpackedRegistry);
+  packedSystem.init(packedRegistry);
+  packedSystem.packed(packedRegistry, true);
+  auto registries = {&unpackedRegistry, &packedRegistry};
+  std::vector<entt::entity> entities;
+  for (auto *registry : registries) {
+    entities.clear();
+    for (int i = 0; i < 64; i += 1) {
+      auto entity = registry->create();
+      auto &transformVal =
+          i % 16 == 0 ? registry->emplace<platformer::transform>(entity)
+                      : registry->emplace<platformer::transform>(
+                            entity, entities[(i - 1) / 2]);
+      transformVal.translate(glm::vec3(0.0, 0.5, 0.0));
+      transformVal.rotate_y(0.1f * (i % 5));
+      entities.push_back(entity);
+    }
+  }
+  auto require_same = [&]() {
+    for (auto entity : entities) {
+      auto &unpackedVal = unpackedRegistry.get<platformer::transform>(entity);
+      auto &packedVal = packedRegistry.get<platformer::transform>(entity);
+      REQUIRE(unpackedVal.matrix_world(unpackedRegistry) ==
+              packedVal.matrix_world(packedRegistry));
+      REQUIRE(unpackedVal.matrix_world_inverse(unpackedRegistry) ==
+              packedVal.matrix_world_inverse(packedRegistry));
+    }
+  };
+  unpackedSystem.propagate(unpackedRegistry);
+  packedSystem.propagate(packedRegistry);
+  require_same();
+
+  for (auto *registry : registries) {
+    auto &root = registry->get<platformer::transform>(entities[0]);
+    auto &inner = registry->get<platformer::transform>(entities[5]);
+    root.translate(glm::vec3(1.0, 0.0, 0.0));
+    inner.scale(glm::vec3(1.0, 2.0, 1.0));
+    // Read lazily in between, then change the local matrix again
+    inner.matrix_world(*registry);
+    inner.rotate_x(0.3f);
+    // A projective local matrix takes the general inverse below it
+    auto projective = glm::mat4(1.0f);
+    projective[0][3] = 0.25f;
+    registry->get<platformer::transform>(entities[40]).matrix_local(projective);
+  }
+  unpackedSystem.propagate(unpackedRegistry);
+  packedSystem.propagate(packedRegistry);
+  REQUIRE(unpackedSystem.changed() == packedSystem.changed());
+  require_same();
+
+  // Reparenting rebuilds the arrays
+  for (auto *registry : registries) {
+    auto &moved = registry->get<platformer::transform>(entities[20]);
+    moved.parent(entities[3]);
+    registry->patch<platformer::transform>(entities[20]);
+    registry->get<platformer::transform>(entities[3]).rotate_z(0.2f);
+  }
+  unpackedSystem.propagate(unpackedRegistry);
+  packedSystem.propagate(packedRegistry);
+  require_same();
+
+  // Switching back keeps the world matrices
+  packedSystem.packed(packedRegistry, false);
+  require_same();
+}
+
+TEST_CASE("World matrix history", "[transform]") {
+  entt::registry registry;
+  platformer::transform_system transformSystem;
+  transformSystem.init(registry);
+  auto entity = registry.create();
+  auto &transformVal = registry.emplace<platformer::transform>(entity);
+  auto &history = registry.emplace<platformer::transform_history>(entity);
+
+  transformSystem.propagate(registry);
+  transformSystem.record_history(registry);
+  transformVal.translate(glm::vec3(2.0, 0.0, 0.0));
+  transformSystem.propagate(registry);
+  transformSystem.record_history(registry);
+  REQUIRE(glm::to_string(glm::vec3(history.previous()[3])) ==
+          glm::to_string(glm::vec3(0.0, 0.0, 0.0)));
+  REQUIRE(glm::to_string(glm::vec3(history.current()[3])) ==
+          glm::to_string(glm::vec3(2.0, 0.0, 0.0)));
+  REQUIRE(glm::to_string(glm::vec3(history.interpolate(0.5f)[3])) ==
+          glm::to_string(glm::vec3(1.0, 0.0, 0.0)));
+}
+
+TEST_CASE("Snapshot interpolation", "[transform]") {
+  entt::registry registry;
+  platformer::transform_system transformSystem;
+  transformSystem.init(registry);
+  auto entity = registry.create();
+  auto &transformVal = registry.emplace<platformer::transform>(entity);
+  registry.emplace<platformer::transform_snapshot>(entity);
+  auto &history = registry.emplace<platformer::transform_history>(entity);
+  auto child = registry.create();
+  auto &childTransform = registry.emplace<platformer::transform>(child, entity);
+  childTransform.translate(glm::vec3(0.0, 1.0, 0.0));
+  auto other = registry.create();
+  auto &otherTransform = registry.emplace<platformer::transform>(other);
+  otherTransform.translate(glm::vec3(0.0, 0.0, 3.0));
+
+  // One tick, then two frames: the history follows the frames while the
+  // snapshot stays on the tick
+  transformSystem.propagate(registry);
+  transformSystem.record_snapshots(registry);
+  transformVal.translate(glm::vec3(2.0, 0.0, 0.0));
+  transformSystem.propagate(registry);
+  transformSystem.record_snapshots(registry);
+  transformSystem.record_history(registry);
+  transformVal.translate(glm::vec3(2.0, 0.0, 0.0));
+  transformSystem.propagate(registry);
+  transformSystem.record_history(registry);
+  REQUIRE(glm::to_string(glm::vec3(history.previous()[3])) ==
+          glm::to_string(glm::vec3(2.0, 0.0, 0.0)));
+  REQUIRE(glm::to_string(glm::vec3(history.current()[3])) ==
+          glm::to_string(glm::vec3(4.0, 0.0, 0.0)));
+
+  // Children without a snapshot of their own follow the interpolated parent
+  transformSystem.interpolate_snapshots(registry, 0.5f);
+  REQUIRE(glm::to_string(glm::vec3(
+              transformVal.matrix_world_interpolated(registry)[3])) ==
+          glm::to_string(glm::vec3(1.0, 0.0, 0.0)));
+  REQUIRE(glm::to_string(glm::vec3(
+              childTransform.matrix_world_interpolated(registry)[3])) ==
+          glm::to_string(glm::vec3(1.0, 1.0, 0.0)));
+  REQUIRE(glm::to_string(glm::vec3(
+              otherTransform.matrix_world_interpolated(registry)[3])) ==
+          glm::to_string(glm::vec3(0.0, 0.0, 3.0)));
+  auto inverse =
+      transformSystem.matrix_world_interpolated_inverse(registry, child);
+  REQUIRE(inverse[3].x == Catch::Approx(-1.0f));
+  REQUIRE(inverse[3].y == Catch::Approx(-1.0f));
+  REQUIRE(inverse[3].z == Catch::Approx(0.0f).margin(1e-5f));
+
+  // A transform reusing the slot of a destroyed one starts from its own
+  // world matrix
+  registry.destroy(child);
+  auto reused = registry.create();
+  auto &reusedTransform = registry.emplace<platformer::transform>(reused);
+  reusedTransform.translate(glm::vec3(0.0, 5.0, 0.0));
+  REQUIRE(glm::to_string(glm::vec3(
+              reusedTransform.matrix_world_interpolated(registry)[3])) ==
+          glm::to_string(glm::vec3(0.0, 5.0, 0.0)));
+}
+
+TEST_CASE("Changed entities", "[transform]") {
+  entt::registry registry;
+  platformer::transform_system transformSystem;
+  transformSystem.init(registry);
+  auto root = registry.create();
+  registry.emplace<platformer::transform>(root);
+  auto child = registry.create();
+  registry.emplace<platformer::transform>(child, root);
+  auto other = registry.create();
+  auto &otherTransform = registry.emplace<platformer::transform>(other);
+  transformSystem.propagate(registry);
+  REQUIRE(transformSystem.changed().size() == 3);
+
+  auto &rootTransform = registry.get<platformer::transform>(root);
+  rootTransform.translate(glm::vec3(1.0, 0.0, 0.0));
+  rootTransform.translate(glm::vec3(1.0, 0.0, 0.0));
+  transformSystem.propagate(registry);
+  REQUIRE(transformSystem.changed() == std::vector<entt::entity>{root, child});
+
+  transformSystem.propagate(registry);
+  REQUIRE(transformSystem.changed().empty());
+  otherTransform.translate(glm::vec3(1.0, 0.0, 0.0));
+  transformSystem.propagate(registry);
+  REQUIRE(transformSystem.changed() == std::vector<entt::entity>{other});
+}
+
+TEST_CASE("Stable slots", "[transform]") {
+  entt::registry registry;
+  platformer::transform_system transformSystem;
+  transformSystem.init(registry);
+  transformSystem.reserve(registry, 4);
+  auto first = registry.create();
+  registry.emplace<platformer::transform>(first);
+  auto second = registry.create();
+  auto &secondTransform = registry.emplace<platformer::transform>(second);
+  auto secondSlot = transformSystem.slot(registry, second);
+
+  registry.destroy(first);
+  REQUIRE(transformSystem.slot(registry, second) == secondSlot);
+  REQUIRE(&registry.get<platformer::transform>(second) == &secondTransform);
+
+  auto third = registry.create();
+  registry.emplace<platformer::transform>(third, second);
+  REQUIRE(transformSystem.slot(registry, third) == 0);
+  transformSystem.propagate(registry);
+  REQUIRE(transformSystem.changed().size() == 2);
+  // The reused slot starts with a clean hierarchy
+  auto &thirdTransform = registry.get<platformer::transform>(third);
+  REQUIRE(thirdTransform.children().empty());
+  REQUIRE(secondTransform.children().size() == 1);
+
+  // A copy gets a hierarchy of its own, with the same parent
+  auto fourth = registry.create();
+  auto copy = thirdTransform;
+  registry.emplace<platformer::transform>(fourth, copy);
+  REQUIRE(registry.get<platformer::transform>(fourth).parent() == second);
+  REQUIRE(secondTransform.children().size() == 2);
+  REQUIRE(*secondTransform.children().begin() == third);
+  REQUIRE(thirdTransform.parent() == second);
+}
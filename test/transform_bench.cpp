@@ -0,0 +1,140 @@
+#define GLM_ENABLE_EXPERIMENTAL
+#include "entt/entity/fwd.hpp"
+#include "scenegraph/transform.hpp"
+#include "util/simd.hpp"
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/gtx/matrix_decompose.hpp>
+#include <glm/gtx/transform.hpp>
+#include <string>
+#include <vector>
+
+// Returns the root
+static entt::entity make_hierarchy(entt::registry &pRegistry, int pCount) {
+  // Every node gets 4 children, roughly matching imported glTF trees
+  std::vector<entt::entity> entities;
+  entities.reserve(pCount);
+  for (int i = 0; i < pCount; i += 1) {
+    auto entity = pRegistry.create();
+    if (i == 0) {
+      pRegistry.emplace<platformer::transform>(entity);
+    } else {
+      pRegistry.emplace<platformer::transform>(entity, entities[(i - 1) / 4]);
+    }
+    entities.push_back(entity);
+  }
+  for (auto entity : entities) {
+    pRegistry.get<platformer::transform>(entity).translate(
+        glm::vec3(0.0, 1.0, 0.0));
+  }
+  return entities[0];
+}
+
+TEST_CASE("Matrix multiply", "[.][benchmark][transform]") {
+  for (int count : {1000, 10000, 100000}) {
+    std::vector<glm::mat4> lhs(count, glm::translate(glm::vec3(1.0f)));
+    std::vector<glm::mat4> rhs(count, glm::scale(glm::vec3(2.0f)));
+    std::vector<glm::mat4> out(count);
+    auto suffix = " (" + std::to_string(count) + ")";
+
+    BENCHMARK("glm" + suffix) {
+      for (int i = 0; i < count; i += 1) {
+        out[i] = lhs[i] * rhs[i];
+      }
+      return out[count - 1][0][0];
+    };
+    BENCHMARK("scalar" + suffix) {
+      for (int i = 0; i < count; i += 1) {
+        platformer::mat4_multiply_scalar(lhs[i], rhs[i], out[i]);
+      }
+      return out[count - 1][0][0];
+    };
+    BENCHMARK("simd" + suffix) {
+      for (int i = 0; i < count; i += 1) {
+        platformer::mat4_multiply(lhs[i], rhs[i], out[i]);
+      }
+      return out[count - 1][0][0];
+    };
+  }
+}
+
+TEST_CASE("Propagate", "[.][benchmark][transform]") {
+  for (int count : {1000, 10000, 100000}) {
+    auto suffix = " (" + std::to_string(count) + ")";
+    // The same tree swept over plain arrays with glm's multiply, as a
+    // reference for the kernel and the layout
+    std::vector<glm::mat4> locals(count,
+                                  glm::translate(glm::vec3(0.0, 1.0, 0.0)));
+    std::vector<glm::mat4> worlds(count);
+    std::vector<int> parents(count);
+    for (int i = 0; i < count; i += 1) {
+      parents[i] = (i - 1) / 4;
+    }
+    BENCHMARK("glm" + suffix) {
+      locals[0] = glm::rotate(locals[0], 0.01f, glm::vec3(0.0, 1.0, 0.0));
+      worlds[0] = locals[0];
+      for (int i = 1; i < count; i += 1) {
+        worlds[i] = worlds[parents[i]] * locals[i];
+      }
+      return worlds[count - 1][3][1];
+    };
+    for (bool packed : {false, true}) {
+      entt::registry registry;
+      platformer::transform_system transformSystem;
+      transformSystem.init(registry);
+      transformSystem.packed(registry, packed);
+      auto root = make_hierarchy(registry, count);
+      transformSystem.propagate(registry);
+      auto &rootTransform = registry.get<platformer::transform>(root);
+
+      BENCHMARK((packed ? "packed" : "unpacked") + suffix) {
+        rootTransform.rotate_y(0.01f);
+        transformSystem.propagate(registry);
+      };
+    }
+  }
+}
+
+TEST_CASE("World getters", "[.][benchmark][transform]") {
+  entt::registry registry;
+  platformer::transform_system transformSystem;
+  transformSystem.init(registry);
+  make_hierarchy(registry, 10000);
+  for (auto entity : registry.view<platformer::transform>()) {
+    registry.get<platformer::transform>(entity).rotate_y(0.5f);
+  }
+  transformSystem.propagate(registry);
+  auto view = registry.view<platformer::transform>();
+
+  BENCHMARK("decompose") {
+    float sum = 0.0f;
+    for (auto entity : view) {
+      auto &transformVal = registry.get<platformer::transform>(entity);
+      transformVal.translate(glm::vec3(0.0f));
+      auto &matrix = transformVal.matrix_world(registry);
+      glm::vec3 scale;
+      glm::quat rotation;
+      glm::vec3 position;
+      glm::vec3 skew;
+      glm::vec4 perspective;
+      glm::decompose(matrix, scale, rotation, position, skew, perspective);
+      glm::decompose(matrix, scale, rotation, position, skew, perspective);
+      glm::decompose(matrix, scale, rotation, position, skew, perspective);
+      sum += position.x + scale.x + rotation.w + glm::inverse(matrix)[3][0];
+    }
+    return sum;
+  };
+  BENCHMARK("affine") {
+    float sum = 0.0f;
+    for (auto entity : view) {
+      auto &transformVal = registry.get<platformer::transform>(entity);
+      transformVal.translate(glm::vec3(0.0f));
+      sum += transformVal.position_world(registry).x +
+             transformVal.scale_world(registry).x +
+             transformVal.rotation_world(registry).w +
+             transformVal.matrix_world_inverse(registry)[3][0];
+    }
+    return sum;
+  };
+}